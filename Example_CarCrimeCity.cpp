@@ -72,6 +72,21 @@ private:
     olc::GFX3D::mesh meshFlat;
     olc::GFX3D::mesh meshWallsOut;
 
+    // Every cell is drawn as an instance of one of two meshes, so the whole
+    // visible city costs two render calls. Instances pick their texture from
+    // this array, the roads occupy the first 12 slots
+    enum
+    {
+        TEX_ROAD = 0,
+        TEX_GROUND = 12,
+        TEX_ROOF,
+        TEX_FRONTAGE,
+        TEX_WINDOWS
+    };
+    std::vector<olc::Sprite *> vecCityTextures;
+    std::vector<olc::GFX3D::instance> vecFlatInstances;
+    std::vector<olc::GFX3D::instance> vecWallInstances;
+
     float fCarAngle = 0.0f;
     float fCarSpeed = 2.0f;
     olc::GFX3D::vec3d vecCarVel = {0, 0, 0};
@@ -164,6 +179,19 @@ public:
         // Don't foregt to set the draw target back to being the main screen (been there... wasted 1.5 hours :| )
         SetDrawTarget(nullptr);
 
+        // Gather the city textures for instanced rendering
+        for (int r = 0; r < 12; r++)
+            vecCityTextures.push_back(sprRoad[r]);
+        vecCityTextures.push_back(sprGround);
+        vecCityTextures.push_back(sprRoof);
+        vecCityTextures.push_back(sprFrontage);
+        vecCityTextures.push_back(sprWindows);
+        pipeRender.SetTextureArray(vecCityTextures);
+
+        // They are only ever sampled from now on, and viewed at all angles
+        for (auto &spr : vecCityTextures)
+            spr->SetLayout(olc::Sprite::Layout::TILED);
+
         // The Yellow Car
         sprCar = new olc::Sprite("./Assets/car_top.png");
 
@@ -726,13 +754,24 @@ public:
                 },
             };
 
+        // Precalculate the face normals for lighting
+        olc::GFX3D::Math::Mesh_ComputeNormals(meshFlat);
+        olc::GFX3D::Math::Mesh_ComputeNormals(meshWallsOut);
+
         // Initialise the 3D Graphics PGE Extension. This is required
         // to setup internal buffers to the same size as the main output
         olc::GFX3D::ConfigureDisplay();
 
+        // The city is mostly seen from a distance, so sample the textures from mip maps
+        olc::GFX3D::SetMipMapping(true);
+
         // Configure the rendering pipeline with projection and viewport properties
         pipeRender.SetProjection(90.0f, (float)ScreenHeight() / (float)ScreenWidth(), 0.1f, 1000.0f, 0.0f, 0.0f, ScreenWidth(), ScreenHeight());
 
+        // A dim ambient fill, and sunlight from above and to one side
+        pipeRender.SetLightSource(0, olc::GFX3D::LIGHT_AMBIENT, olc::Pixel(100, 100, 100), {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f});
+        pipeRender.SetLightSource(1, olc::GFX3D::LIGHT_DIRECTIONAL, olc::Pixel(180, 180, 160), {0.0f, 0.0f, 0.0f}, {0.5f, 0.3f, -1.0f});
+
         // Also make a projection matrix, we might need this later
         matProj = olc::GFX3D::Math::Mat_MakeProjection(90.0f, (float)ScreenHeight() / (float)ScreenWidth(), 0.1f, 1000.0f);
 
@@ -949,7 +988,12 @@ public:
         int nStartY = std::max(0, (int)viewWorldTopLeft.y - 1);
         int nEndY = std::min(nMapHeight, (int)viewWorldBottomRight.y + 1);
 
-        // Iterate through all the cells we wish to draw. Each cell is 1x1 and elevates in the Z -Axis
+        // Iterate through all the cells we wish to draw. Each cell is 1x1 and elevates in the Z -Axis.
+        // Rather than drawing them immediately, collect an instance for each mesh required
+        vecFlatInstances.clear();
+        vecWallInstances.clear();
+        olc::GFX3D::instance inst;
+
         for (int x = nStartX; x < nEndX; x++)
         {
             for (int y = nStartY; y < nEndY; y++)
@@ -991,14 +1035,13 @@ public:
                         road = 11;
 
                     // Create a translation transform to position the cell in the world
-                    olc::GFX3D::mat4x4 matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, 0.0f);
-                    pipeRender.SetTransform(matWorld);
+                    inst.matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, 0.0f);
 
                     // Set the appropriate texture to use
-                    pipeRender.SetTexture(sprRoad[road]);
+                    inst.nTexture = TEX_ROAD + road;
 
                     // Draw a flat quad
-                    pipeRender.Render(meshFlat.tris);
+                    vecFlatInstances.push_back(inst);
                 }
                 else // Not Road
                 {
@@ -1012,10 +1055,9 @@ public:
                     if (pMap[y * nMapWidth + x].nHeight == 0)
                     {
                         // Cell is ground, draw a flat grass quad at height 0
-                        olc::GFX3D::mat4x4 matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, 0.0f);
-                        pipeRender.SetTransform(matWorld);
-                        pipeRender.SetTexture(sprGround);
-                        pipeRender.Render(meshFlat.tris);
+                        inst.matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, 0.0f);
+                        inst.nTexture = TEX_GROUND;
+                        vecFlatInstances.push_back(inst);
                     }
 
                     if (pMap[y * nMapWidth + x].nHeight > 0)
@@ -1027,24 +1069,27 @@ public:
                         for (h = 0; h < t; h++)
                         {
                             // Create a transform that positions the storey according to its height
-                            olc::GFX3D::mat4x4 matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, -(h + 1) * 0.2f);
-                            pipeRender.SetTransform(matWorld);
+                            inst.matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, -(h + 1) * 0.2f);
 
                             // Choose a texture, if its ground level, use the "street level front", otherwise use windows
-                            pipeRender.SetTexture(h == 0 ? sprFrontage : sprWindows);
-                            pipeRender.Render(meshWallsOut.tris);
+                            inst.nTexture = h == 0 ? TEX_FRONTAGE : TEX_WINDOWS;
+                            vecWallInstances.push_back(inst);
                         }
 
                         // Top the building off with a roof
-                        olc::GFX3D::mat4x4 matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, -(h)*0.2f);
-                        pipeRender.SetTransform(matWorld);
-                        pipeRender.SetTexture(sprRoof);
-                        pipeRender.Render(meshFlat.tris);
+                        inst.matWorld = olc::GFX3D::Math::Mat_MakeTranslation(x, y, -(h)*0.2f);
+                        inst.nTexture = TEX_ROOF;
+                        vecFlatInstances.push_back(inst);
                     }
                 }
             }
         }
 
+        // Draw the entire visible city
+        uint32_t nCityFlags = olc::GFX3D::RENDER_CULL_CW | olc::GFX3D::RENDER_TEXTURED | olc::GFX3D::RENDER_DEPTH | olc::GFX3D::RENDER_LIGHTS;
+        pipeRender.RenderInstanced(meshFlat, vecFlatInstances, nCityFlags);
+        pipeRender.RenderInstanced(meshWallsOut, vecWallInstances, nCityFlags);
+
         // Draw Selected Cells, iterate through the set of cells, and draw a wireframe quad at ground level
         // to indicate it is in the selection set
         for (auto &cell : setSelectedCells)
@@ -1053,7 +1098,7 @@ public:
             olc::GFX3D::mat4x4 matWorld = olc::GFX3D::Math::Mat_MakeTranslation(cell->nWorldX, cell->nWorldY, 0.0f);
             pipeRender.SetTransform(matWorld);
             pipeRender.SetTexture(sprRoof);
-            pipeRender.Render(meshFlat.tris, olc::GFX3D::RENDER_WIRE);
+            pipeRender.Render(meshFlat, olc::GFX3D::RENDER_WIRE);
         }
 
         // Draw Car, a few transforms required for this
@@ -1079,7 +1124,7 @@ public:
         // The car has transparency, so enable it
         SetPixelMode(olc::Pixel::ALPHA);
         // Render the quad
-        pipeRender.Render(meshFlat.tris);
+        pipeRender.Render(meshFlat);
         // Set transparency back to none to optimise drawing other pixels
         SetPixelMode(olc::Pixel::NORMAL);
 
@@ -24,10 +24,18 @@ private:
     int sndSampleB;
     int sndSampleC;
     bool bToggle = false;
-    static bool bSynthPlaying;
-    static float fSynthFrequency;
+    static std::atomic<bool> bKeyHeld[12];
     static float fFilterVolume;
 
+    // One synth voice per key, only touched by the audio thread
+    struct sSynthVoice
+    {
+        olc::SOUND::Oscillator osc;
+        olc::SOUND::Envelope env;
+        bool bHeld = false;
+    };
+    static sSynthVoice synthVoices[12];
+
     const olc::Key keys[12] = {olc::Key::Z, olc::Key::S, olc::Key::X, olc::Key::D, olc::Key::C,
                                olc::Key::V, olc::Key::G, olc::Key::B, olc::Key::H, olc::Key::N, olc::Key::J, olc::Key::M};
 
@@ -36,14 +44,33 @@ private:
 
 private:
     // This is an optional function that allows the user to generate or synthesize sounds
-    // in a custom way, it is fed into the output mixer bu the extension
-    static float MyCustomSynthFunction(int nChannel, float fGlobalTime, float fTimeStep)
+    // in a custom way, it is fed into the output mixer by the extension a block at a time
+    static void MyCustomSynthFunction(float *pMix, unsigned int nFrames, unsigned int nChannels, uint64_t nFirstFrame, double dTimeStep)
     {
-        // Just generate a sine wave of the appropriate frequency
-        if (bSynthPlaying)
-            return sin(fSynthFrequency * 2.0f * 3.14159f * fGlobalTime);
-        else
-            return 0.0f;
+        // Each key plays its own note, so chords work
+        for (int i = 0; i < 12; i++)
+        {
+            sSynthVoice &v = synthVoices[i];
+            bool bHeld = bKeyHeld[i];
+            if (bHeld && !v.bHeld)
+                v.env.NoteOn();
+            else if (!bHeld && v.bHeld)
+                v.env.NoteOff();
+            v.bHeld = bHeld;
+            if (v.env.IsFinished())
+                continue;
+
+            // Render the note a piece at a time, shaped by its envelope
+            float fVoice[256];
+            for (unsigned int n = 0; n < nFrames; n += 256)
+            {
+                unsigned int nRun = std::min(256u, nFrames - n);
+                std::fill(fVoice, fVoice + nRun, 0.0f);
+                v.osc.Render(fVoice, nRun, dTimeStep);
+                v.env.Apply(fVoice, nRun, dTimeStep);
+                olc::SOUND::MixMono(pMix + n * nChannels, nRun, nChannels, fVoice, 0.25f);
+            }
+        }
     }
 
     // This is an optional function that allows the user to filter the output from
@@ -70,8 +97,15 @@ private:
         sndSampleB = olc::SOUND::LoadAudioSample("./Assets/SampleB.wav");
         sndSampleC = olc::SOUND::LoadAudioSample("./Assets/SampleC.wav");
 
+        // Tune the synth voices up the keyboard
+        for (int i = 0; i < 12; i++)
+        {
+            synthVoices[i].osc.nWave = olc::SOUND::Oscillator::TRIANGLE;
+            synthVoices[i].osc.dFrequency = 220.0 * pow(2.0, (double)i / 12.0);
+        }
+
         // Give the sound engine a hook to a custom generation function
-        olc::SOUND::SetUserSynthFunction(MyCustomSynthFunction);
+        olc::SOUND::SetUserSynthBlockFunction(MyCustomSynthFunction);
 
         // Give the sound engine a hook to a custom filtering function
         olc::SOUND::SetUserFilterFunction(MyCustomFilterFunction);
@@ -120,25 +154,9 @@ private:
         if (fFilterVolume > 1.0f)
             fFilterVolume = 1.0f;
 
-        // Detect keyboard - very simple synthesizer
-        if (IsFocused())
-        {
-            bool bKeyIsPressed = false;
-            float fFrequency = 0.0f;
-            for (int i = 0; i < 12; i++)
-            {
-                if (GetKey(keys[i]).bHeld)
-                {
-                    bKeyIsPressed = true;
-                    float fOctaveBaseFrequency = 220.0f;
-                    float f12thRootOf2 = pow(2.0f, 1.0f / 12.0f);
-                    fFrequency = fOctaveBaseFrequency * powf(f12thRootOf2, (float)i);
-                }
-            }
-
-            fSynthFrequency = fFrequency;
-            bSynthPlaying = bKeyIsPressed;
-        }
+        // Detect keyboard - simple polyphonic synthesizer
+        for (int i = 0; i < 12; i++)
+            bKeyHeld[i] = IsFocused() && GetKey(keys[i]).bHeld;
 
         // Draw Buttons
         Clear(olc::BLUE);
@@ -200,8 +218,8 @@ private:
     }
 };
 
-bool SoundTest::bSynthPlaying = false;
-float SoundTest::fSynthFrequency = 0.0f;
+std::atomic<bool> SoundTest::bKeyHeld[12];
+SoundTest::sSynthVoice SoundTest::synthVoices[12];
 float SoundTest::fFilterVolume = 1.0f;
 int SoundTest::nSamplePos = 0;
 float SoundTest::fPreviousSamples[128];
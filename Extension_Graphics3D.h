@@ -8,7 +8,34 @@
 
 #include <algorithm>
 #include <vector>
-#include <list>
+#include <unordered_map>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Mesh files are memory mapped where the platform allows
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Use SSE for the vertex stream transforms and textured spans where the target supports it
+#if !defined(OLC_GFX3D_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define OLC_GFX3D_SSE
+#include <emmintrin.h>
+#endif
 
 namespace olc
 {
@@ -44,9 +71,73 @@ namespace olc
             float m[4][4] = {0};
         };
 
+        // Object space bounds, a box and a sphere that both enclose the geometry
+        struct bounding_volume
+        {
+            vec3d vMin;
+            vec3d vMax;
+            vec3d vCentre;
+            float fRadius = 0.0f;
+            bool bValid = false;
+        };
+
+        // A run of consecutive triangles within a mesh, with its own bounds, so
+        // parts of large meshes can be culled seperately
+        struct mesh_chunk
+        {
+            uint32_t nFirst = 0;
+            uint32_t nCount = 0;
+            bounding_volume bounds;
+        };
+
         struct mesh
         {
             std::vector<triangle> tris;
+            std::vector<vec3d> normals; // One per triangle, for lighting, see Math::Mesh_ComputeNormals
+            bounding_volume bounds;
+            std::vector<mesh_chunk> chunks;
+        };
+
+        // An indexed mesh stores each unique vertex once, as seperate streams of
+        // components (structure of arrays), and three indices per triangle. Shared
+        // vertices are then only transformed once per render.
+        struct mesh_indexed
+        {
+            std::vector<float> px, py, pz;
+            std::vector<float> nx, ny, nz; // Optional, unit length, used by lighting
+            std::vector<float> u, v;
+            std::vector<olc::Pixel> col;
+            std::vector<uint32_t> indices;
+            bounding_volume bounds;
+            std::vector<mesh_chunk> chunks;
+        };
+
+        // Progressively simpler versions of one mesh, see Math::Mesh_BuildLOD.
+        // levels[0] is the original, and fError[i] is how far, in object space,
+        // the surface of levels[i] may stray from it
+        struct mesh_lod
+        {
+            std::vector<mesh_indexed> levels;
+            std::vector<float> fError;
+        };
+
+        // Depth as seen from a light, for casting shadows, see PipeLine::BeginShadowMap.
+        // Holds 1/z from the light like the depth buffer, 0 is empty and nearer is greater
+        struct shadow_map
+        {
+            int nSize = 0;
+            std::vector<float> depth;
+            mat4x4 matView;
+            mat4x4 matProj;
+            float fNear = 0.1f;
+        };
+
+        // One copy of a mesh, as drawn by PipeLine::RenderInstanced
+        struct instance
+        {
+            mat4x4 matWorld;
+            uint32_t nTexture = 0;        // Index into the pipelines texture array
+            olc::Pixel tint = olc::WHITE; // Modulates the texture
         };
 
         class Math
@@ -79,6 +170,72 @@ namespace olc
             inline static vec3d Vec_IntersectPlane(vec3d &plane_p, vec3d &plane_n, vec3d &lineStart, vec3d &lineEnd, float &t);
 
             inline static int Triangle_ClipAgainstPlane(vec3d plane_p, vec3d plane_n, triangle &in_tri, triangle &out_tri1, triangle &out_tri2);
+
+            // Transforms a stream of nCount points (w = 1) by matrix m, writing the results into
+            // seperate output streams. Uses SSE four points at a time when available.
+            inline static void Mat_MultiplyVectorStream(mat4x4 &m, const float *x, const float *y, const float *z, size_t nCount,
+                                                        float *out_x, float *out_y, float *out_z, float *out_w);
+            // Builds an indexed mesh from a triangle soup, merging identical vertices.
+            // Vertex normals are calculated too.
+            inline static void Mesh_BuildIndexed(mesh &in, mesh_indexed &out);
+            // Precalculates object space normals for lighting, so they need not be found
+            // every frame. Triangle meshes get a normal per face, and indexed meshes one
+            // per vertex, the area weighted average of the faces that share it.
+            inline static void Mesh_ComputeNormals(mesh &m);
+            inline static void Mesh_ComputeNormals(mesh_indexed &m);
+            // Calculates the bounds of a mesh. If nTrisPerChunk is not zero, the mesh is also
+            // split into chunks of that many consecutive triangles, each with their own bounds
+            inline static void Mesh_ComputeBounds(mesh &m, uint32_t nTrisPerChunk = 0);
+            inline static void Mesh_ComputeBounds(mesh_indexed &m, uint32_t nTrisPerChunk = 0);
+            // Loads a Wavefront OBJ file into an indexed mesh. Polygons are fanned into
+            // triangles, and normals are calculated if the file has none. With bUseCache,
+            // the result is saved beside the OBJ in a binary cache (sFilename + ".g3d"),
+            // which later loads read instead for as long as the OBJ is unchanged.
+            inline static bool Mesh_LoadOBJ(const std::string &sFilename, mesh_indexed &out, bool bUseCache = true);
+            // Simplifies a mesh into up to nLevels levels of detail, each with about
+            // fReduction times the triangles of the one before. Edges are collapsed in
+            // order of least quadric error, and open edges, including texture seams,
+            // are held in place. Vertex attributes are kept, as a collapse moves one
+            // vertex onto another rather than creating new ones.
+            inline static void Mesh_BuildLOD(mesh_indexed &in, mesh_lod &out, uint32_t nLevels = 4, float fReduction = 0.5f);
+
+        private:
+            // A read only view of a whole file, memory mapped if possible, else read in
+            class FileView
+            {
+            public:
+                inline FileView(const std::string &sFilename);
+                inline ~FileView();
+                FileView(const FileView &) = delete;
+                FileView &operator=(const FileView &) = delete;
+
+            public:
+                const char *pData = nullptr;
+                size_t nSize = 0;
+
+            private:
+                std::vector<char> vecBuffer;
+                void *pMapping = nullptr;
+#if defined(_WIN32)
+                HANDLE hFile = INVALID_HANDLE_VALUE;
+                HANDLE hMap = nullptr;
+#endif
+            };
+
+            // Binary mesh cache layout, this header and then each stream in turn
+            struct sMeshCacheHeader
+            {
+                char sMagic[4];
+                uint32_t nVersion;
+                uint64_t nSourceHash;
+                uint32_t nVertices;
+                uint32_t nIndices;
+            };
+
+            inline static uint64_t HashBytes(const char *pData, size_t nSize);
+            inline static bool ParseOBJ(const char *pData, size_t nSize, mesh_indexed &out);
+            inline static bool ReadMeshCache(const std::string &sFilename, uint64_t nHash, mesh_indexed &out);
+            inline static void WriteMeshCache(const std::string &sFilename, uint64_t nHash, mesh_indexed &m);
         };
 
         enum RENDERFLAGS
@@ -89,26 +246,271 @@ namespace olc
             RENDER_CULL_CW = 0x08,
             RENDER_CULL_CCW = 0x10,
             RENDER_DEPTH = 0x20,
+            RENDER_SORT_FRONT_TO_BACK = 0x40, // Nearest triangles first, so more are rejected by the coarse depth
+            RENDER_LIGHTS = 0x80,
+            RENDER_SHADOWS = 0x100, // Textured triangles are darkened where the shadow map is nearer the light
+            RENDER_ALPHA_TEST = 0x200, // Texels with alpha below the reference are discarded, and dont write depth
+            RENDER_ALPHA_BLEND = 0x400, // Blended over the scene by alpha once PipeLine::RenderTransparent is called
+        };
+
+        enum LIGHTS
+        {
+            LIGHT_DISABLED,
+            LIGHT_AMBIENT,
+            LIGHT_DIRECTIONAL,
+            LIGHT_POINT,
         };
 
         class PipeLine
         {
         public:
             PipeLine();
+            ~PipeLine();
+            PipeLine(const PipeLine &) = delete;
+            PipeLine &operator=(const PipeLine &) = delete;
 
         public:
             void SetProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar, float fLeft, float fTop, float fWidth, float fHeight);
             void SetCamera(olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &lookat, olc::GFX3D::vec3d &up);
             void SetTransform(olc::GFX3D::mat4x4 &transform);
             void SetTexture(olc::Sprite *texture);
-            void SetLightSource(olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &dir, olc::Pixel &col);
+            // Textures selected per instance by RenderInstanced, via instance::nTexture
+            void SetTextureArray(std::vector<olc::Sprite *> &textures);
+            // Lights are in world space, and are applied when rendering with RENDER_LIGHTS.
+            // Directional lights shine from dir, which points towards the light. Point
+            // lights fade out linearly to nothing at a distance of fParam, or never if 0.
+            // Triangle meshes are lit per face, indexed meshes with normals per vertex.
+            void SetLightSource(uint32_t nSlot, uint32_t nType, olc::Pixel col, olc::GFX3D::vec3d pos, olc::GFX3D::vec3d dir, float fParam = 0.0f);
+            static const uint32_t MAX_LIGHTS = 4;
+            // Vertex processing is shared between this many threads, counting the one
+            // calling Render, or one per core if 0. The default of 1 starts no threads.
+            // Results are queued in the same order whatever the count, so images match.
+            void SetThreadCount(uint32_t nThreads);
             uint32_t Render(std::vector<olc::GFX3D::triangle> &triangles, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            // Meshes are tested against the view frustum first, and are skipped
+            // entirely if not visible. Bounds are calculated if not yet valid.
+            uint32_t Render(olc::GFX3D::mesh &mesh, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            uint32_t Render(olc::GFX3D::mesh_indexed &mesh, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            // Draws many copies of one mesh in a single call, each with its own world
+            // transform, texture and tint. Instances are culled individually, and all
+            // their triangles are rasterised together at the end.
+            uint32_t RenderInstanced(olc::GFX3D::mesh &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            uint32_t RenderInstanced(olc::GFX3D::mesh_indexed &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            // Draws the simplest level of detail whose error would cover no more than
+            // the LOD threshold in pixels, chosen per mesh or per instance
+            uint32_t Render(olc::GFX3D::mesh_lod &mesh, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+            uint32_t RenderInstanced(olc::GFX3D::mesh_lod &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags = RENDER_CULL_CW | RENDER_TEXTURED | RENDER_DEPTH);
+
+            // Triangles rendered with RENDER_ALPHA_BLEND are held back, as they must be
+            // drawn over everything opaque. This draws all of them, furthest first, so
+            // call it once the opaque scene is done. Their textures must still exist.
+            uint32_t RenderTransparent();
+            void SetLODThreshold(float fPixels);
+
+            // Shadow maps are depth only renders from a light, looking from pos towards
+            // lookat. BeginShadowMap sets up and clears a square map of nSize texels,
+            // then RenderShadow draws casters into it with the current transform, and
+            // RenderShadowInstanced with each instance's. Both return the triangles drawn.
+            void BeginShadowMap(olc::GFX3D::shadow_map &map, olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &lookat, olc::GFX3D::vec3d &up, float fFovDegrees, int nSize, float fNear = 0.1f);
+            uint32_t RenderShadow(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh);
+            uint32_t RenderShadow(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh);
+            uint32_t RenderShadowInstanced(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh, std::vector<olc::GFX3D::instance> &instances);
+            uint32_t RenderShadowInstanced(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh, std::vector<olc::GFX3D::instance> &instances);
+            // The map used by RENDER_SHADOWS. Shadowed pixels are modulated by col,
+            // and PCF blends nine samples to soften the edges. A caster must be nearer
+            // the light by fBias of the distance, so surfaces dont shadow themselves.
+            void SetShadowMap(olc::GFX3D::shadow_map *pMap, olc::Pixel col = olc::Pixel(96, 96, 96), bool bPCF = false, float fBias = 0.01f);
+
+        public:
+            // Running totals, accumulated until ResetStats() is called
+            struct sStats
+            {
+                uint32_t nMeshesSubmitted = 0;
+                uint32_t nMeshesCulled = 0;
+                uint32_t nChunksCulled = 0;
+                uint32_t nInstancesSubmitted = 0;
+                uint32_t nInstancesCulled = 0;
+                uint32_t nTrianglesSubmitted = 0;
+                uint32_t nTrianglesOccluded = 0;
+                uint32_t nTrianglesDrawn = 0;
+            };
+
+            const sStats &GetStats() const;
+            void ResetStats();
+
+        private:
+            // Frustum planes (a, b, c, d) in object space, inside is positive
+            struct sFrustum
+            {
+                float p[6][4];
+            };
+
+            enum FRUSTUM_TEST
+            {
+                FRUSTUM_OUTSIDE,
+                FRUSTUM_INTERSECT,
+                FRUSTUM_INSIDE,
+            };
+
+            void ExtractFrustum(olc::GFX3D::mat4x4 &matWorldViewProj, sFrustum &frustum);
+            FRUSTUM_TEST TestBounds(const sFrustum &frustum, const olc::GFX3D::bounding_volume &bounds);
+            // Tests the bounding sphere of an instance against a world space frustum
+            FRUSTUM_TEST TestInstance(const sFrustum &frustum, const olc::GFX3D::bounding_volume &bounds, olc::GFX3D::mat4x4 &matInstance);
+            olc::Sprite *GetInstanceTexture(const olc::GFX3D::instance &inst);
+            // Picks a level of detail by the projected size of its error
+            uint32_t SelectLOD(const olc::GFX3D::mesh_lod &mesh, olc::GFX3D::mat4x4 &matInstance);
+
+            // Finds the transform from view space into the shadow map's clip space,
+            // false if there is no map to use
+            bool PrepareShadows();
+            // Depth only drawing of casters, transformed straight into the light's clip space
+            uint32_t ShadowMesh(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh, olc::GFX3D::mat4x4 &matInstance);
+            uint32_t ShadowMesh(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh, olc::GFX3D::mat4x4 &matInstance);
+            // Clips a triangle in the light's clip space to its near plane, and draws it
+            uint32_t ShadowTriangle(olc::GFX3D::shadow_map &map, const olc::GFX3D::vec3d *c);
+
+            struct sRasterTriangle;
+
+            // Transforms into view space and processes a run of triangles. The normal
+            // matrix is only needed when lighting with pNormals
+            void ProcessTriangles(std::vector<olc::GFX3D::triangle> &triangles, const std::vector<olc::GFX3D::vec3d> *pNormals, const olc::GFX3D::mat4x4 &matNormal,
+                                  size_t nFirst, size_t nCount, olc::GFX3D::mat4x4 &matWorldView, olc::Pixel tint, uint32_t flags,
+                                  std::vector<sRasterTriangle> &vecOut);
+            // Processes the visible parts of a whole mesh, chunks are tested against the
+            // object space frustum if the mesh is only partially visible
+            void ProcessMesh(olc::GFX3D::mesh &mesh, olc::GFX3D::mat4x4 &matWorldView, const sFrustum &frustum, FRUSTUM_TEST nTest, olc::Pixel tint, uint32_t flags);
+            void ProcessMesh(olc::GFX3D::mesh_indexed &mesh, olc::GFX3D::mat4x4 &matWorldView, const sFrustum &frustum, FRUSTUM_TEST nTest, olc::Pixel tint, uint32_t flags);
+
+        private:
+            struct sLight
+            {
+                uint32_t nType = LIGHT_DISABLED;
+                float r = 0.0f, g = 0.0f, b = 0.0f;
+                olc::GFX3D::vec3d pos;
+                olc::GFX3D::vec3d dir;
+                float fRange = 0.0f;
+            };
+
+            // Gathers the enabled lights into view space, where lighting is done
+            void PrepareLights();
+            // Normals are transformed by the inverse transpose of the world view matrix,
+            // so they stay perpendicular to surfaces under non-uniform scaling
+            static olc::GFX3D::mat4x4 MakeNormalMatrix(olc::GFX3D::mat4x4 &matWorldView);
+            static olc::GFX3D::vec3d TransformNormal(const olc::GFX3D::mat4x4 &matNormal, const olc::GFX3D::vec3d &n);
+            // Light arriving at a view space point, with unit normal n
+            void LightVertex(const olc::GFX3D::vec3d &n, const olc::GFX3D::vec3d &p, float &r, float &g, float &b);
+            // Lights a run of vertices of an indexed mesh into vecLitR/G/B, using its
+            // normals and the view space positions already in the post-transform cache
+            void LightVertexStream(const olc::GFX3D::mat4x4 &matNormal, olc::GFX3D::mesh_indexed &mesh, size_t nFirst, size_t nCount);
+
+        private:
+            // A run of consecutive triangles to be processed
+            struct sRange
+            {
+                size_t nFirst;
+                size_t nCount;
+            };
+
+            // Splits the triangles of all the ranges evenly into jobs, each processed by
+            // func into its own buffer. The buffers are then queued in job order, so the
+            // result is the same as processing the ranges one after the other
+            void ProcessRanges(const std::vector<sRange> &ranges, const std::function<void(size_t, size_t, std::vector<sRasterTriangle> &)> &func);
+            // Calls func for every job number below nJobs, shared between the calling
+            // thread and the workers, and returns once they are all done
+            void RunJobs(uint32_t nJobs, const std::function<void(uint32_t)> &func);
+            void StopWorkers();
+            void WorkerThread();
+
+            // Jobs smaller than these cost more to hand out than they save
+            static const size_t MIN_TRIANGLES_PER_JOB = 512;
+            static const size_t MIN_VERTICES_PER_JOB = 2048;
 
         private:
+            // A vertex in homogeneous clip space, with the attributes that get interpolated
+            struct sClipVertex
+            {
+                float x, y, z, w;
+                float u, v;
+                float r, g, b;
+                float lx, ly, lw; // Shadow map clip space
+            };
+
+            // Culls and clips a triangle already in view space, adding the screen space
+            // results to vecOut. pShade optionally gives a colour per vertex to be
+            // interpolated across the triangle.
+            void ProcessTriangle(olc::GFX3D::triangle &triTransformed, uint32_t flags, std::vector<sRasterTriangle> &vecOut, const olc::Pixel *pShade = nullptr);
+            // Draws and then empties vecTrianglesToRaster, or holds it back for
+            // RenderTransparent if it is blended
+            uint32_t RasterTriangles(uint32_t flags);
+            // Draws one triangle, false if it was occluded
+            bool RasterTriangle(sRasterTriangle &r, uint32_t flags);
+
+        private:
+            // A screen space triangle, and the texture to draw it with
+            struct sRasterTriangle
+            {
+                olc::GFX3D::triangle tri;
+                olc::Sprite *spr;
+                float fNearest; // Largest 1/w, used for sorting and occlusion
+                bool bShaded;
+                olc::Pixel shade[3];
+                bool bShadowed;
+                olc::GFX3D::vec3d shadow[3]; // Shadow map clip x, y and w, divided by w
+                uint32_t flags; // Only kept for transparent triangles, drawn after their call
+            };
+
+            // Screen space triangles awaiting rasterisation. Reused between calls.
+            std::vector<sRasterTriangle> vecTrianglesToRaster;
+            // Blended triangles waiting for RenderTransparent
+            std::vector<sRasterTriangle> vecTransparent;
+            // Output of each job, and the visible ranges of the mesh being processed
+            std::vector<std::vector<sRasterTriangle>> vecJobTriangles;
+            std::vector<sRange> vecRanges;
+
+            // Worker threads wait for a new generation of jobs, then take job numbers
+            // from nNextJob until they run out
+            std::vector<std::thread> vecWorkers;
+            std::mutex muxJobs;
+            std::condition_variable cvJobs;
+            std::condition_variable cvJobsDone;
+            const std::function<void(uint32_t)> *pJobFunc = nullptr;
+            uint32_t nJobCount = 0;
+            std::atomic<uint32_t> nNextJob{0};
+            uint32_t nJobsDone = 0;
+            uint32_t nWorkersBusy = 0;
+            uint64_t nJobGeneration = 0;
+            bool bWorkersQuit = false;
+
+            // Post-transform vertex cache, holds the view space positions of every
+            // vertex of the indexed mesh being rendered. Reused between calls.
+            std::vector<float> vecCacheX;
+            std::vector<float> vecCacheY;
+            std::vector<float> vecCacheZ;
+            std::vector<float> vecCacheW;
+            // Light arriving at each vertex, 0 to 1
+            std::vector<float> vecLitR;
+            std::vector<float> vecLitG;
+            std::vector<float> vecLitB;
+
+            sLight lights[MAX_LIGHTS];
+            sLight lightsView[MAX_LIGHTS];
+            uint32_t nLightsView = 0;
+
+            sStats stats;
+
             olc::GFX3D::mat4x4 matProj;
             olc::GFX3D::mat4x4 matView;
             olc::GFX3D::mat4x4 matWorld;
             olc::Sprite *sprTexture;
+            // Texture used for triangles as they are queued
+            olc::Sprite *sprBatch = nullptr;
+            std::vector<olc::Sprite *> vecTextures;
+            float fLODThreshold = 1.0f;
+            olc::GFX3D::shadow_map *pShadowMap = nullptr;
+            olc::Pixel colShadow;
+            bool bShadowPCF = false;
+            float fShadowBias = 0.01f;
+            olc::GFX3D::mat4x4 matViewToShadow;
             float fViewX;
             float fViewY;
             float fViewW;
@@ -119,7 +521,17 @@ namespace olc
         //static const int RF_TEXTURE = 0x00000001;
         //static const int RF_ = 0x00000002;
 
-        inline static void ConfigureDisplay();
+        enum DEPTH_FORMAT
+        {
+            DEPTH_FLOAT32,
+            DEPTH_UNORM16,
+        };
+
+        // Sizes the depth buffer to the screen. Depth is 1/w, nearer is greater, and it
+        // is cleared to 0, so float depth keeps its precision into the distance. 16 bit
+        // depth holds 1/w as a fraction of 1/fNear, halving the memory traffic at the
+        // cost of precision far away. Anything nearer than fNear is clamped.
+        inline static void ConfigureDisplay(DEPTH_FORMAT format = DEPTH_FLOAT32, float fNear = 0.1f);
         inline static void ClearDepth();
         inline static void AddTriangleToScene(olc::GFX3D::triangle &tri);
         inline static void RenderScene();
@@ -129,13 +541,138 @@ namespace olc
         inline static void DrawTriangleTex(olc::GFX3D::triangle &tri, olc::Sprite *spr);
         inline static void TexturedTriangle(int x1, int y1, float u1, float v1, float w1,
                                             int x2, int y2, float u2, float v2, float w2,
-                                            int x3, int y3, float u3, float v3, float w3, olc::Sprite *spr);
+                                            int x3, int y3, float u3, float v3, float w3, olc::Sprite *spr, olc::Pixel tint = olc::WHITE,
+                                            const olc::Pixel *pShade = nullptr, const olc::GFX3D::vec3d *pShadow = nullptr);
 
         // Draws a sprite with the transform applied
         //inline static void DrawSprite(olc::Sprite *sprite, olc::GFX2D::Transform2D &transform);
 
+        // Restricts textured triangle rasterisation to a screen rectangle
+        inline static void SetScissor(int x, int y, int w, int h);
+
+        // Textured triangles divide by w to find the texture coordinate at every
+        // nPixels along a span, and interpolate linearly in between. 1 is exact.
+        inline static void SetPerspectiveSubdivision(int nPixels);
+
+        // Textured triangles choose a mip level of the texture for each span, from how
+        // quickly the texture coordinates change across the screen. Sprites without a
+        // mip chain have one generated the first time they are drawn.
+        inline static void SetMipMapping(bool bEnable);
+
+        // True if a screen rectangle is certainly hidden behind what has already been
+        // drawn at depths further than fNearest (1/w), according to the coarse depth
+        inline static bool IsOccluded(int x1, int y1, int x2, int y2, float fNearest);
+
+        // Alpha tested triangles keep texels with at least this alpha
+        inline static void SetAlphaReference(uint8_t nReference);
+
+    private:
+        // Component-wise multiply of two colours, including alpha
+        inline static olc::Pixel ModulateColour(olc::Pixel a, olc::Pixel b);
+        // src over dst, by src's alpha
+        inline static olc::Pixel BlendColour(olc::Pixel src, olc::Pixel dst);
+        // Blends a row of source pixels over the target, four at a time with SSE.
+        // Pixels with no alpha leave the target as it was
+        inline static void BlendSpan(olc::Pixel *pDst, const olc::Pixel *pSrc, int nCount);
+
+        // Screen space gradients of u/w, v/w and 1/w across a triangle
+        struct sTexGradients
+        {
+            float dudx, dvdx, dwdx;
+            float dudy, dvdy, dwdy;
+        };
+
+        // A colour interpolated across a triangle, as its value at (x, y) and gradients
+        struct sShadeGradients
+        {
+            int x, y;
+            float r, g, b;
+            float drdx, dgdx, dbdx;
+            float drdy, dgdy, dbdy;
+        };
+
+        // Shadow map clip coordinates, each divided by the screen w, across a triangle
+        struct sShadowGradients
+        {
+            int x, y;
+            float lx, ly, lw;
+            float dxdx, dydx, dwdx;
+            float dxdy, dydy, dwdy;
+        };
+
+        // Draws one row of a textured triangle, between ax and bx. With gradients, the
+        // mip level is chosen from them at the middle of the span
+        inline static void TexturedSpan(int y, int ax, int bx,
+                                        float su, float sv, float sw, float eu, float ev, float ew,
+                                        olc::Sprite *spr, olc::Pixel tint, bool bTint, const sTexGradients *pGrad,
+                                        const sShadeGradients *pShade, const sShadowGradients *pShadow);
+
+        // Fraction of light reaching a point, 0 to 1, from the current shadow map. x and
+        // y are its normalised device coordinates and fInvZ its 1/z from the light
+        inline static float ShadowLookup(float x, float y, float fInvZ);
+
+        // Depth only triangle for shadow maps, corners in texels with their 1/z.
+        // Keeps the nearest (greatest) 1/z in each texel whose centre it covers
+        inline static void DepthOnlyTriangle(float *pDepth, int nSize, float x1, float y1, float w1,
+                                             float x2, float y2, float w2, float x3, float y3, float w3);
+
+        // The coarse depth is a two level pyramid over m_DepthBuffer. Each tile holds
+        // the furthest depth (smallest 1/w) of its pixels, and each block the furthest
+        // of its tiles. Depths only ever get nearer until cleared, so an out of date
+        // value is still safe to reject against, it is just less effective. Tiles that
+        // have been drawn to are marked dirty, and are brought up to date when needed.
+        inline static void HiZ_MarkSpan(int y, int x1, int x2);
+        inline static float HiZ_UpdateTile(int tx, int ty);
+        inline static float HiZ_UpdateBlock(int bx, int by);
+
+        static const int HIZ_TILE_SHIFT = 3;  // 8x8 pixels
+        static const int HIZ_BLOCK_SHIFT = 3; // 8x8 tiles
+
+        // The depth buffer is stored in the same 8x8 tiles, each one contiguous, so a
+        // span within a tile is a contiguous row. Clearing only flags the tiles, and a
+        // tile is filled when it is first drawn to after being cleared.
+        inline static void Depth_PrepareTile(int nTile);
+        inline static bool Depth_TestAndWrite(int x, int y, float w);
+        inline static uint16_t Depth_Encode16(float w);
+
+        static const int DEPTH_TILE_SHIFT = HIZ_TILE_SHIFT * 2;
+
     private:
         static float *m_DepthBuffer;
+        static uint16_t *m_DepthBuffer16;
+        static uint8_t *m_DepthTileCleared;
+        static DEPTH_FORMAT m_nDepthFormat;
+        static float m_fDepthNear;
+        static float m_fDepthScale16;
+        static int m_nDepthWidth;
+        static int m_nDepthHeight;
+        static int m_nPerspectiveSubdivision;
+        static bool m_bMipMapping;
+        static float *m_HiZTiles;
+        static float *m_HiZBlocks;
+        static uint8_t *m_HiZTileDirty;
+        static uint8_t *m_HiZBlockDirty;
+        static int m_nHiZTilesX;
+        static int m_nHiZTilesY;
+        static int m_nHiZBlocksX;
+        static int m_nHiZBlocksY;
+        static int m_nScissorX1;
+        static int m_nScissorY1;
+        static int m_nScissorX2;
+        static int m_nScissorY2;
+        // Narrows the scissor to its overlap with a rectangle, so a pipeline keeps
+        // within both its viewport and whatever scissor the caller set
+        inline static void IntersectScissor(int x, int y, int w, int h);
+        // Shadow map in use while a pipeline rasterises with RENDER_SHADOWS
+        static const shadow_map *m_pShadowMap;
+        static olc::Pixel m_colShadow;
+        static bool m_bShadowPCF;
+        static float m_fShadowBias;
+        // RENDER_ALPHA_TEST or RENDER_ALPHA_BLEND while a pipeline rasterises them
+        static uint32_t m_nAlphaMode;
+        static uint8_t m_nAlphaReference;
+        // Blended spans are gathered here, then blended over the row in one go
+        static olc::Pixel *m_BlendRow;
     };
 }
 
@@ -551,210 +1088,1723 @@ namespace olc
         return 0;
     }
 
-    void GFX3D::DrawTriangleFlat(olc::GFX3D::triangle &tri)
-    {
-        pge->FillTriangle(tri.p[0].x, tri.p[0].y, tri.p[1].x, tri.p[1].y, tri.p[2].x, tri.p[2].y, tri.col);
-    }
-
-    void GFX3D::DrawTriangleWire(olc::GFX3D::triangle &tri, olc::Pixel col)
+    void olc::GFX3D::Math::Mat_MultiplyVectorStream(olc::GFX3D::mat4x4 &m, const float *x, const float *y, const float *z, size_t nCount,
+                                                     float *out_x, float *out_y, float *out_z, float *out_w)
     {
-        pge->DrawTriangle(tri.p[0].x, tri.p[0].y, tri.p[1].x, tri.p[1].y, tri.p[2].x, tri.p[2].y, col);
-    }
+        size_t i = 0;
 
-    void GFX3D::TexturedTriangle(int x1, int y1, float u1, float v1, float w1,
-                                 int x2, int y2, float u2, float v2, float w2,
-                                 int x3, int y3, float u3, float v3, float w3, olc::Sprite *spr)
+#ifdef OLC_GFX3D_SSE
+        // Broadcast the matrix, then process four points per iteration
+        __m128 m00 = _mm_set1_ps(m.m[0][0]), m01 = _mm_set1_ps(m.m[0][1]), m02 = _mm_set1_ps(m.m[0][2]), m03 = _mm_set1_ps(m.m[0][3]);
+        __m128 m10 = _mm_set1_ps(m.m[1][0]), m11 = _mm_set1_ps(m.m[1][1]), m12 = _mm_set1_ps(m.m[1][2]), m13 = _mm_set1_ps(m.m[1][3]);
+        __m128 m20 = _mm_set1_ps(m.m[2][0]), m21 = _mm_set1_ps(m.m[2][1]), m22 = _mm_set1_ps(m.m[2][2]), m23 = _mm_set1_ps(m.m[2][3]);
+        __m128 m30 = _mm_set1_ps(m.m[3][0]), m31 = _mm_set1_ps(m.m[3][1]), m32 = _mm_set1_ps(m.m[3][2]), m33 = _mm_set1_ps(m.m[3][3]);
 
-    {
-        if (y2 < y1)
+        for (; i + 4 <= nCount; i += 4)
         {
-            std::swap(y1, y2);
-            std::swap(x1, x2);
-            std::swap(u1, u2);
-            std::swap(v1, v2);
-            std::swap(w1, w2);
+            __m128 vx = _mm_loadu_ps(x + i);
+            __m128 vy = _mm_loadu_ps(y + i);
+            __m128 vz = _mm_loadu_ps(z + i);
+            _mm_storeu_ps(out_x + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m00), _mm_mul_ps(vy, m10)), _mm_mul_ps(vz, m20)), m30));
+            _mm_storeu_ps(out_y + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m01), _mm_mul_ps(vy, m11)), _mm_mul_ps(vz, m21)), m31));
+            _mm_storeu_ps(out_z + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m02), _mm_mul_ps(vy, m12)), _mm_mul_ps(vz, m22)), m32));
+            _mm_storeu_ps(out_w + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m03), _mm_mul_ps(vy, m13)), _mm_mul_ps(vz, m23)), m33));
         }
+#endif
 
-        if (y3 < y1)
+        // Remaining points (or all of them, without SSE)
+        for (; i < nCount; i++)
         {
-            std::swap(y1, y3);
-            std::swap(x1, x3);
-            std::swap(u1, u3);
-            std::swap(v1, v3);
-            std::swap(w1, w3);
+            out_x[i] = x[i] * m.m[0][0] + y[i] * m.m[1][0] + z[i] * m.m[2][0] + m.m[3][0];
+            out_y[i] = x[i] * m.m[0][1] + y[i] * m.m[1][1] + z[i] * m.m[2][1] + m.m[3][1];
+            out_z[i] = x[i] * m.m[0][2] + y[i] * m.m[1][2] + z[i] * m.m[2][2] + m.m[3][2];
+            out_w[i] = x[i] * m.m[0][3] + y[i] * m.m[1][3] + z[i] * m.m[2][3] + m.m[3][3];
         }
+    }
 
-        if (y3 < y2)
+    void olc::GFX3D::Math::Mesh_BuildIndexed(olc::GFX3D::mesh &in, olc::GFX3D::mesh_indexed &out)
+    {
+        // Vertices are considered identical if position and texture coordinate match exactly
+        struct sVertexKey
         {
-            std::swap(y2, y3);
-            std::swap(x2, x3);
-            std::swap(u2, u3);
-            std::swap(v2, v3);
-            std::swap(w2, w3);
-        }
-
-        int dy1 = y2 - y1;
-        int dx1 = x2 - x1;
-        float dv1 = v2 - v1;
-        float du1 = u2 - u1;
-        float dw1 = w2 - w1;
+            float x, y, z, u, v;
+            bool operator==(const sVertexKey &k) const
+            {
+                return x == k.x && y == k.y && z == k.z && u == k.u && v == k.v;
+            }
+        };
 
-        int dy2 = y3 - y1;
-        int dx2 = x3 - x1;
-        float dv2 = v3 - v1;
-        float du2 = u3 - u1;
-        float dw2 = w3 - w1;
+        struct sVertexKeyHash
+        {
+            size_t operator()(const sVertexKey &k) const
+            {
+                size_t h = 0;
+                for (float f : {k.x, k.y, k.z, k.u, k.v})
+                {
+                    uint32_t n;
+                    memcpy(&n, &f, sizeof(uint32_t));
+                    h = (h ^ n) * 16777619u;
+                }
+                return h;
+            }
+        };
 
-        float tex_u, tex_v, tex_w;
+        out = mesh_indexed();
+        out.indices.reserve(in.tris.size() * 3);
 
-        float dax_step = 0, dbx_step = 0,
-              du1_step = 0, dv1_step = 0,
-              du2_step = 0, dv2_step = 0,
-              dw1_step = 0, dw2_step = 0;
+        std::unordered_map<sVertexKey, uint32_t, sVertexKeyHash> mapVertices;
+        mapVertices.reserve(in.tris.size() * 3);
 
-        if (dy1)
-            dax_step = dx1 / (float)abs(dy1);
-        if (dy2)
-            dbx_step = dx2 / (float)abs(dy2);
+        for (auto &tri : in.tris)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                sVertexKey key = {tri.p[i].x, tri.p[i].y, tri.p[i].z, tri.t[i].x, tri.t[i].y};
+                auto it = mapVertices.find(key);
+                if (it != mapVertices.end())
+                {
+                    out.indices.push_back(it->second);
+                }
+                else
+                {
+                    uint32_t nIndex = (uint32_t)out.px.size();
+                    mapVertices[key] = nIndex;
+                    out.px.push_back(key.x);
+                    out.py.push_back(key.y);
+                    out.pz.push_back(key.z);
+                    out.u.push_back(key.u);
+                    out.v.push_back(key.v);
+                    // Triangle colours are assigned by the pipeline, so vertices start white
+                    out.col.push_back(olc::WHITE);
+                    out.indices.push_back(nIndex);
+                }
+            }
+        }
 
-        if (dy1)
-            du1_step = du1 / (float)abs(dy1);
-        if (dy1)
-            dv1_step = dv1 / (float)abs(dy1);
-        if (dy1)
-            dw1_step = dw1 / (float)abs(dy1);
+        Mesh_ComputeNormals(out);
+    }
 
-        if (dy2)
-            du2_step = du2 / (float)abs(dy2);
-        if (dy2)
-            dv2_step = dv2 / (float)abs(dy2);
-        if (dy2)
-            dw2_step = dw2 / (float)abs(dy2);
+    void olc::GFX3D::Math::Mesh_ComputeNormals(olc::GFX3D::mesh &m)
+    {
+        m.normals.resize(m.tris.size());
+        for (size_t i = 0; i < m.tris.size(); i++)
+        {
+            triangle &tri = m.tris[i];
+            vec3d line1 = Vec_Sub(tri.p[1], tri.p[0]);
+            vec3d line2 = Vec_Sub(tri.p[2], tri.p[0]);
+            vec3d normal = Vec_CrossProduct(line1, line2);
+            float l = Vec_Length(normal);
+            m.normals[i] = l > 0.0f ? Vec_Div(normal, l) : normal;
+        }
+    }
 
-        if (dy1)
+    void olc::GFX3D::Math::Mesh_ComputeNormals(olc::GFX3D::mesh_indexed &m)
+    {
+        size_t nVerts = m.px.size();
+        m.nx.assign(nVerts, 0.0f);
+        m.ny.assign(nVerts, 0.0f);
+        m.nz.assign(nVerts, 0.0f);
+
+        // The cross product's length is twice the triangle's area, so summing them
+        // unnormalised weights each face by its size
+        for (size_t i = 0; i + 2 < m.indices.size(); i += 3)
         {
-            for (int i = y1; i <= y2; i++)
+            uint32_t a = m.indices[i + 0], b = m.indices[i + 1], c = m.indices[i + 2];
+            vec3d p0 = {m.px[a], m.py[a], m.pz[a]};
+            vec3d p1 = {m.px[b], m.py[b], m.pz[b]};
+            vec3d p2 = {m.px[c], m.py[c], m.pz[c]};
+            vec3d line1 = Vec_Sub(p1, p0);
+            vec3d line2 = Vec_Sub(p2, p0);
+            vec3d normal = Vec_CrossProduct(line1, line2);
+            for (uint32_t n : {a, b, c})
             {
-                int ax = x1 + (float)(i - y1) * dax_step;
-                int bx = x1 + (float)(i - y1) * dbx_step;
-
-                float tex_su = u1 + (float)(i - y1) * du1_step;
-                float tex_sv = v1 + (float)(i - y1) * dv1_step;
-                float tex_sw = w1 + (float)(i - y1) * dw1_step;
+                m.nx[n] += normal.x;
+                m.ny[n] += normal.y;
+                m.nz[n] += normal.z;
+            }
+        }
 
-                float tex_eu = u1 + (float)(i - y1) * du2_step;
-                float tex_ev = v1 + (float)(i - y1) * dv2_step;
-                float tex_ew = w1 + (float)(i - y1) * dw2_step;
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            float l = sqrtf(m.nx[i] * m.nx[i] + m.ny[i] * m.ny[i] + m.nz[i] * m.nz[i]);
+            if (l > 0.0f)
+            {
+                m.nx[i] /= l;
+                m.ny[i] /= l;
+                m.nz[i] /= l;
+            }
+        }
+    }
 
-                if (ax > bx)
+    void olc::GFX3D::Math::Mesh_ComputeBounds(olc::GFX3D::mesh &m, uint32_t nTrisPerChunk)
+    {
+        // Bounds of a run of triangles, the sphere is centred on the box
+        auto ComputeBounds = [&](size_t nFirst, size_t nCount) {
+            bounding_volume b;
+            if (nCount == 0)
+                return b;
+
+            b.vMin = b.vMax = m.tris[nFirst].p[0];
+            for (size_t i = nFirst; i < nFirst + nCount; i++)
+                for (int n = 0; n < 3; n++)
                 {
-                    std::swap(ax, bx);
-                    std::swap(tex_su, tex_eu);
-                    std::swap(tex_sv, tex_ev);
-                    std::swap(tex_sw, tex_ew);
+                    vec3d &p = m.tris[i].p[n];
+                    b.vMin = {std::min(b.vMin.x, p.x), std::min(b.vMin.y, p.y), std::min(b.vMin.z, p.z)};
+                    b.vMax = {std::max(b.vMax.x, p.x), std::max(b.vMax.y, p.y), std::max(b.vMax.z, p.z)};
                 }
 
-                tex_u = tex_su;
-                tex_v = tex_sv;
-                tex_w = tex_sw;
-
-                float tstep = 1.0f / ((float)(bx - ax));
-                float t = 0.0f;
-
-                for (int j = ax; j < bx; j++)
+            b.vCentre = {(b.vMin.x + b.vMax.x) * 0.5f, (b.vMin.y + b.vMax.y) * 0.5f, (b.vMin.z + b.vMax.z) * 0.5f};
+            float fRadius2 = 0.0f;
+            for (size_t i = nFirst; i < nFirst + nCount; i++)
+                for (int n = 0; n < 3; n++)
                 {
-                    tex_u = (1.0f - t) * tex_su + t * tex_eu;
-                    tex_v = (1.0f - t) * tex_sv + t * tex_ev;
-                    tex_w = (1.0f - t) * tex_sw + t * tex_ew;
-                    if (tex_w > m_DepthBuffer[i * pge->ScreenWidth() + j])
-                    {
-                        pge->Draw(j, i, spr->Sample(tex_u / tex_w, tex_v / tex_w));
-                        m_DepthBuffer[i * pge->ScreenWidth() + j] = tex_w;
-                    }
-                    t += tstep;
+                    vec3d d = Vec_Sub(m.tris[i].p[n], b.vCentre);
+                    fRadius2 = std::max(fRadius2, Vec_DotProduct(d, d));
                 }
+            b.fRadius = sqrtf(fRadius2);
+            b.bValid = true;
+            return b;
+        };
+
+        m.bounds = ComputeBounds(0, m.tris.size());
+
+        m.chunks.clear();
+        if (nTrisPerChunk > 0)
+        {
+            for (size_t i = 0; i < m.tris.size(); i += nTrisPerChunk)
+            {
+                mesh_chunk c;
+                c.nFirst = (uint32_t)i;
+                c.nCount = (uint32_t)std::min((size_t)nTrisPerChunk, m.tris.size() - i);
+                c.bounds = ComputeBounds(c.nFirst, c.nCount);
+                m.chunks.push_back(c);
             }
         }
+    }
 
-        dy1 = y3 - y2;
-        dx1 = x3 - x2;
-        dv1 = v3 - v2;
-        du1 = u3 - u2;
-        dw1 = w3 - w2;
+    void olc::GFX3D::Math::Mesh_ComputeBounds(olc::GFX3D::mesh_indexed &m, uint32_t nTrisPerChunk)
+    {
+        // Bounds of a run of indexed triangles, the sphere is centred on the box
+        auto ComputeBounds = [&](size_t nFirst, size_t nCount) {
+            bounding_volume b;
+            if (nCount == 0)
+                return b;
+
+            uint32_t v = m.indices[nFirst * 3];
+            b.vMin = b.vMax = {m.px[v], m.py[v], m.pz[v]};
+            for (size_t i = nFirst * 3; i < (nFirst + nCount) * 3; i++)
+            {
+                v = m.indices[i];
+                b.vMin = {std::min(b.vMin.x, m.px[v]), std::min(b.vMin.y, m.py[v]), std::min(b.vMin.z, m.pz[v])};
+                b.vMax = {std::max(b.vMax.x, m.px[v]), std::max(b.vMax.y, m.py[v]), std::max(b.vMax.z, m.pz[v])};
+            }
 
-        if (dy1)
-            dax_step = dx1 / (float)abs(dy1);
-        if (dy2)
-            dbx_step = dx2 / (float)abs(dy2);
+            b.vCentre = {(b.vMin.x + b.vMax.x) * 0.5f, (b.vMin.y + b.vMax.y) * 0.5f, (b.vMin.z + b.vMax.z) * 0.5f};
+            float fRadius2 = 0.0f;
+            for (size_t i = nFirst * 3; i < (nFirst + nCount) * 3; i++)
+            {
+                v = m.indices[i];
+                vec3d d = {m.px[v] - b.vCentre.x, m.py[v] - b.vCentre.y, m.pz[v] - b.vCentre.z};
+                fRadius2 = std::max(fRadius2, Vec_DotProduct(d, d));
+            }
+            b.fRadius = sqrtf(fRadius2);
+            b.bValid = true;
+            return b;
+        };
 
-        du1_step = 0, dv1_step = 0;
-        if (dy1)
-            du1_step = du1 / (float)abs(dy1);
-        if (dy1)
-            dv1_step = dv1 / (float)abs(dy1);
-        if (dy1)
-            dw1_step = dw1 / (float)abs(dy1);
+        size_t nTris = m.indices.size() / 3;
+        m.bounds = ComputeBounds(0, nTris);
 
-        if (dy1)
+        m.chunks.clear();
+        if (nTrisPerChunk > 0)
         {
-            for (int i = y2; i <= y3; i++)
+            for (size_t i = 0; i < nTris; i += nTrisPerChunk)
             {
-                int ax = x2 + (float)(i - y2) * dax_step;
-                int bx = x1 + (float)(i - y1) * dbx_step;
-
-                float tex_su = u2 + (float)(i - y2) * du1_step;
-                float tex_sv = v2 + (float)(i - y2) * dv1_step;
-                float tex_sw = w2 + (float)(i - y2) * dw1_step;
-
-                float tex_eu = u1 + (float)(i - y1) * du2_step;
-                float tex_ev = v1 + (float)(i - y1) * dv2_step;
-                float tex_ew = w1 + (float)(i - y1) * dw2_step;
+                mesh_chunk c;
+                c.nFirst = (uint32_t)i;
+                c.nCount = (uint32_t)std::min((size_t)nTrisPerChunk, nTris - i);
+                c.bounds = ComputeBounds(c.nFirst, c.nCount);
+                m.chunks.push_back(c);
+            }
+        }
+    }
 
-                if (ax > bx)
+    olc::GFX3D::Math::FileView::FileView(const std::string &sFilename)
+    {
+#if defined(_WIN32)
+        hFile = CreateFileA(sFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0)
+            {
+                hMap = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (hMap)
+                    pMapping = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+                if (pMapping)
                 {
-                    std::swap(ax, bx);
-                    std::swap(tex_su, tex_eu);
-                    std::swap(tex_sv, tex_ev);
-                    std::swap(tex_sw, tex_ew);
+                    pData = (const char *)pMapping;
+                    nSize = (size_t)size.QuadPart;
+                    return;
                 }
-
-                tex_u = tex_su;
-                tex_v = tex_sv;
-                tex_w = tex_sw;
-
-                float tstep = 1.0f / ((float)(bx - ax));
-                float t = 0.0f;
-
-                for (int j = ax; j < bx; j++)
+            }
+        }
+#else
+        int fd = open(sFilename.c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
                 {
-                    tex_u = (1.0f - t) * tex_su + t * tex_eu;
-                    tex_v = (1.0f - t) * tex_sv + t * tex_ev;
-                    tex_w = (1.0f - t) * tex_sw + t * tex_ew;
-
-                    if (tex_w > m_DepthBuffer[i * pge->ScreenWidth() + j])
-                    {
-                        pge->Draw(j, i, spr->Sample(tex_u / tex_w, tex_v / tex_w));
-                        m_DepthBuffer[i * pge->ScreenWidth() + j] = tex_w;
-                    }
-                    t += tstep;
+                    pMapping = p;
+                    pData = (const char *)p;
+                    nSize = (size_t)st.st_size;
                 }
             }
+            close(fd);
+            if (pMapping)
+                return;
         }
+#endif
+
+        // Mapping failed, so read it all in one go instead
+        std::ifstream ifs(sFilename, std::ifstream::binary);
+        if (!ifs.is_open())
+            return;
+        ifs.seekg(0, std::ios::end);
+        std::streamoff nLength = ifs.tellg();
+        if (nLength <= 0)
+            return;
+        ifs.seekg(0, std::ios::beg);
+        vecBuffer.resize((size_t)nLength);
+        ifs.read(vecBuffer.data(), nLength);
+        if (!ifs)
+            return;
+        pData = vecBuffer.data();
+        nSize = vecBuffer.size();
     }
 
-    void GFX3D::DrawTriangleTex(olc::GFX3D::triangle &tri, olc::Sprite *spr)
+    olc::GFX3D::Math::FileView::~FileView()
     {
-        if (tri.p[1].y < tri.p[0].y)
+#if defined(_WIN32)
+        if (pMapping)
+            UnmapViewOfFile(pMapping);
+        if (hMap)
+            CloseHandle(hMap);
+        if (hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(hFile);
+#else
+        if (pMapping)
+            munmap(pMapping, nSize);
+#endif
+    }
+
+    uint64_t olc::GFX3D::Math::HashBytes(const char *pData, size_t nSize)
+    {
+        // FNV-1a, a word at a time. Only used to notice a changed file
+        uint64_t h = 14695981039346656037ull;
+        size_t i = 0;
+        for (; i + 8 <= nSize; i += 8)
         {
-            std::swap(tri.p[0].y, tri.p[1].y);
-            std::swap(tri.p[0].x, tri.p[1].x);
-            std::swap(tri.t[0].x, tri.t[1].x);
-            std::swap(tri.t[0].y, tri.t[1].y);
-            std::swap(tri.t[0].z, tri.t[1].z);
+            uint64_t n;
+            memcpy(&n, pData + i, sizeof(uint64_t));
+            h = (h ^ n) * 1099511628211ull;
         }
+        for (; i < nSize; i++)
+            h = (h ^ (uint8_t)pData[i]) * 1099511628211ull;
+        return (h ^ nSize) * 1099511628211ull;
+    }
 
-        if (tri.p[2].y < tri.p[0].y)
-        {
+    bool olc::GFX3D::Math::ParseOBJ(const char *pData, size_t nSize, olc::GFX3D::mesh_indexed &out)
+    {
+        const char *end = pData + nSize;
+
+        auto SkipSpace = [&](const char *p) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            return p;
+        };
+
+        // Decimal numbers only, which is all OBJ exporters write. Returns nullptr
+        // if there is no number here
+        static const double fPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+        auto ParseFloat = [&](const char *p, float &f) -> const char * {
+            p = SkipSpace(p);
+            bool bNeg = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                bNeg = *p++ == '-';
+
+            uint64_t nMantissa = 0;
+            int nDigits = 0, nExp = 0;
+            const char *pStart = p;
+            for (; p < end && *p >= '0' && *p <= '9'; p++)
+            {
+                if (nDigits < 18)
+                {
+                    nMantissa = nMantissa * 10 + (*p - '0');
+                    if (nMantissa)
+                        nDigits++;
+                }
+                else
+                    nExp++;
+            }
+            if (p < end && *p == '.')
+            {
+                p++;
+                for (; p < end && *p >= '0' && *p <= '9'; p++)
+                {
+                    if (nDigits < 18)
+                    {
+                        nMantissa = nMantissa * 10 + (*p - '0');
+                        if (nMantissa)
+                            nDigits++;
+                        nExp--;
+                    }
+                }
+            }
+            if (p == pStart || (p == pStart + 1 && *pStart == '.'))
+                return nullptr;
+
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                const char *q = p + 1;
+                bool bExpNeg = false;
+                if (q < end && (*q == '-' || *q == '+'))
+                    bExpNeg = *q++ == '-';
+                if (q < end && *q >= '0' && *q <= '9')
+                {
+                    int e = 0;
+                    for (; q < end && *q >= '0' && *q <= '9'; q++)
+                        e = std::min(e * 10 + (*q - '0'), 1000);
+                    nExp += bExpNeg ? -e : e;
+                    p = q;
+                }
+            }
+
+            double d = (double)nMantissa;
+            while (nExp > 18)
+            {
+                d *= 1e18;
+                nExp -= 18;
+            }
+            while (nExp < -18)
+            {
+                d /= 1e18;
+                nExp += 18;
+            }
+            d = nExp >= 0 ? d * fPow10[nExp] : d / fPow10[-nExp];
+            f = (float)(bNeg ? -d : d);
+            return p;
+        };
+
+        auto ParseInt = [&](const char *p, int &n) -> const char * {
+            bool bNeg = false;
+            if (p < end && *p == '-')
+            {
+                bNeg = true;
+                p++;
+            }
+            if (p >= end || *p < '0' || *p > '9')
+                return nullptr;
+            int v = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; p++)
+                v = v * 10 + (*p - '0');
+            n = bNeg ? -v : v;
+            return p;
+        };
+
+        std::vector<float> vecPos, vecTex, vecNorm;
+        vecPos.reserve(nSize / 24);
+
+        // Vertices are unique combinations of position, texture and normal indices.
+        // The common case of positions alone is looked up directly
+        struct sCornerKey
+        {
+            int v, vt, vn;
+            bool operator==(const sCornerKey &k) const { return v == k.v && vt == k.vt && vn == k.vn; }
+        };
+        struct sCornerKeyHash
+        {
+            size_t operator()(const sCornerKey &k) const
+            {
+                return ((size_t)k.v * 73856093u) ^ ((size_t)k.vt * 19349663u) ^ ((size_t)k.vn * 83492791u);
+            }
+        };
+        std::unordered_map<sCornerKey, uint32_t, sCornerKeyHash> mapCorners;
+        std::vector<uint32_t> vecPosOnly;
+        bool bAllNormals = true;
+
+        out = mesh_indexed();
+
+        auto AddCorner = [&](int v, int vt, int vn) {
+            uint32_t *pIndex = nullptr;
+            if (vt < 0 && vn < 0)
+            {
+                if (vecPosOnly.size() <= (size_t)v)
+                    vecPosOnly.resize(vecPos.size() / 3, UINT32_MAX);
+                pIndex = &vecPosOnly[v];
+            }
+            else
+                pIndex = &mapCorners.emplace(sCornerKey{v, vt, vn}, UINT32_MAX).first->second;
+
+            if (*pIndex == UINT32_MAX)
+            {
+                *pIndex = (uint32_t)out.px.size();
+                out.px.push_back(vecPos[v * 3 + 0]);
+                out.py.push_back(vecPos[v * 3 + 1]);
+                out.pz.push_back(vecPos[v * 3 + 2]);
+                out.u.push_back(vt >= 0 ? vecTex[vt * 2 + 0] : 0.0f);
+                out.v.push_back(vt >= 0 ? vecTex[vt * 2 + 1] : 0.0f);
+                out.nx.push_back(vn >= 0 ? vecNorm[vn * 3 + 0] : 0.0f);
+                out.ny.push_back(vn >= 0 ? vecNorm[vn * 3 + 1] : 0.0f);
+                out.nz.push_back(vn >= 0 ? vecNorm[vn * 3 + 2] : 0.0f);
+                out.col.push_back(olc::WHITE);
+                bAllNormals &= vn >= 0;
+            }
+            return *pIndex;
+        };
+
+        // OBJ indices start at 1, and negative ones count back from the latest
+        auto Resolve = [](int n, size_t nCount) {
+            if (n > 0)
+                return (size_t)n <= nCount ? n - 1 : -2;
+            if (n < 0)
+                return (size_t)-n <= nCount ? (int)nCount + n : -2;
+            return -2;
+        };
+
+        const char *p = pData;
+        while (p < end)
+        {
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            if (!eol)
+                eol = end;
+            p = SkipSpace(p);
+
+            if (eol - p > 2 && p[0] == 'v')
+            {
+                float f[3];
+                if (p[1] == ' ' || p[1] == '\t')
+                {
+                    const char *q = p + 1;
+                    for (int i = 0; i < 3 && q; i++)
+                        q = ParseFloat(q, f[i]);
+                    if (!q)
+                        return false;
+                    vecPos.insert(vecPos.end(), f, f + 3);
+                }
+                else if (p[1] == 't')
+                {
+                    // The second coordinate is optional
+                    const char *q = ParseFloat(p + 2, f[0]);
+                    if (!q)
+                        return false;
+                    if (!ParseFloat(q, f[1]))
+                        f[1] = 0.0f;
+                    vecTex.insert(vecTex.end(), f, f + 2);
+                }
+                else if (p[1] == 'n')
+                {
+                    const char *q = p + 2;
+                    for (int i = 0; i < 3 && q; i++)
+                        q = ParseFloat(q, f[i]);
+                    if (!q)
+                        return false;
+                    float l = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+                    if (l > 0.0f)
+                        f[0] /= l, f[1] /= l, f[2] /= l;
+                    vecNorm.insert(vecNorm.end(), f, f + 3);
+                }
+            }
+            else if (eol - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                // Each corner is v, v/vt, v//vn or v/vt/vn. Fan polygons from the first
+                uint32_t nFirst = 0, nPrev = 0;
+                int nCorner = 0;
+                const char *q = SkipSpace(p + 1);
+                while (q < eol && *q != '\r' && *q != '#')
+                {
+                    int v, vt = 0, vn = 0;
+                    q = ParseInt(q, v);
+                    if (!q)
+                        return false;
+                    if (q < eol && *q == '/')
+                    {
+                        q++;
+                        if (q < eol && *q != '/')
+                            q = ParseInt(q, vt);
+                        if (q && q < eol && *q == '/')
+                            q = ParseInt(q + 1, vn);
+                        if (!q)
+                            return false;
+                    }
+
+                    v = Resolve(v, vecPos.size() / 3);
+                    vt = vt ? Resolve(vt, vecTex.size() / 2) : -1;
+                    vn = vn ? Resolve(vn, vecNorm.size() / 3) : -1;
+                    if (v < 0 || vt == -2 || vn == -2)
+                        return false;
+
+                    uint32_t nIndex = AddCorner(v, vt, vn);
+                    if (nCorner == 0)
+                        nFirst = nIndex;
+                    else if (nCorner >= 2)
+                    {
+                        out.indices.push_back(nFirst);
+                        out.indices.push_back(nPrev);
+                        out.indices.push_back(nIndex);
+                    }
+                    nPrev = nIndex;
+                    nCorner++;
+                    q = SkipSpace(q);
+                }
+            }
+
+            p = eol + 1;
+        }
+
+        // Vertices the file gave no normal are still zero, and are filled in from
+        // the faces around them
+        if (!bAllNormals)
+        {
+            std::vector<float> nx = out.nx, ny = out.ny, nz = out.nz;
+            Mesh_ComputeNormals(out);
+            for (size_t i = 0; i < nx.size(); i++)
+                if (nx[i] != 0.0f || ny[i] != 0.0f || nz[i] != 0.0f)
+                {
+                    out.nx[i] = nx[i];
+                    out.ny[i] = ny[i];
+                    out.nz[i] = nz[i];
+                }
+        }
+        return true;
+    }
+
+    bool olc::GFX3D::Math::ReadMeshCache(const std::string &sFilename, uint64_t nHash, olc::GFX3D::mesh_indexed &out)
+    {
+        FileView file(sFilename);
+        sMeshCacheHeader h;
+        if (file.nSize < sizeof(h))
+            return false;
+        memcpy(&h, file.pData, sizeof(h));
+        if (memcmp(h.sMagic, "G3DM", 4) != 0 || h.nVersion != 1 || h.nSourceHash != nHash)
+            return false;
+        if (file.nSize != sizeof(h) + (size_t)h.nVertices * 8 * sizeof(float) + (size_t)h.nIndices * sizeof(uint32_t))
+            return false;
+
+        out = mesh_indexed();
+        const char *p = file.pData + sizeof(h);
+        auto Read = [&](auto &vec, size_t nCount) {
+            vec.resize(nCount);
+            memcpy(vec.data(), p, nCount * sizeof(vec[0]));
+            p += nCount * sizeof(vec[0]);
+        };
+        for (auto *vec : {&out.px, &out.py, &out.pz, &out.nx, &out.ny, &out.nz, &out.u, &out.v})
+            Read(*vec, h.nVertices);
+        Read(out.indices, h.nIndices);
+        out.col.assign(h.nVertices, olc::WHITE);
+
+        for (uint32_t i : out.indices)
+            if (i >= h.nVertices)
+            {
+                out = mesh_indexed();
+                return false;
+            }
+        return true;
+    }
+
+    void olc::GFX3D::Math::WriteMeshCache(const std::string &sFilename, uint64_t nHash, olc::GFX3D::mesh_indexed &m)
+    {
+        std::ofstream ofs(sFilename, std::ofstream::binary);
+        if (!ofs.is_open())
+            return;
+
+        sMeshCacheHeader h = {{'G', '3', 'D', 'M'}, 1, nHash, (uint32_t)m.px.size(), (uint32_t)m.indices.size()};
+        ofs.write((const char *)&h, sizeof(h));
+        for (auto *vec : {&m.px, &m.py, &m.pz, &m.nx, &m.ny, &m.nz, &m.u, &m.v})
+            ofs.write((const char *)vec->data(), vec->size() * sizeof(float));
+        ofs.write((const char *)m.indices.data(), m.indices.size() * sizeof(uint32_t));
+    }
+
+    bool olc::GFX3D::Math::Mesh_LoadOBJ(const std::string &sFilename, olc::GFX3D::mesh_indexed &out, bool bUseCache)
+    {
+        FileView file(sFilename);
+        if (!file.pData)
+            return false;
+
+        // Hashing the source is far quicker than parsing it
+        std::string sCache = sFilename + ".g3d";
+        uint64_t nHash = 0;
+        if (bUseCache)
+        {
+            nHash = HashBytes(file.pData, file.nSize);
+            if (ReadMeshCache(sCache, nHash, out))
+                return true;
+        }
+
+        if (!ParseOBJ(file.pData, file.nSize, out))
+        {
+            out = mesh_indexed();
+            return false;
+        }
+
+        if (bUseCache)
+            WriteMeshCache(sCache, nHash, out);
+        return true;
+    }
+
+    void olc::GFX3D::Math::Mesh_BuildLOD(olc::GFX3D::mesh_indexed &in, olc::GFX3D::mesh_lod &out, uint32_t nLevels, float fReduction)
+    {
+        out = mesh_lod();
+        out.levels.push_back(in);
+        out.fError.push_back(0.0f);
+        if (!out.levels[0].bounds.bValid)
+            Mesh_ComputeBounds(out.levels[0]);
+
+        size_t nVertices = in.px.size();
+        size_t nTris = in.indices.size() / 3;
+        if (nLevels < 2 || nTris == 0 || fReduction <= 0.0f || fReduction >= 1.0f)
+            return;
+
+        // Symmetric 4x4 error quadric, the sum of squared distances to a set of planes
+        struct sQuadric
+        {
+            double a[10] = {0};
+
+            void AddPlane(double x, double y, double z, double d, double w)
+            {
+                a[0] += w * x * x; a[1] += w * x * y; a[2] += w * x * z; a[3] += w * x * d;
+                a[4] += w * y * y; a[5] += w * y * z; a[6] += w * y * d;
+                a[7] += w * z * z; a[8] += w * z * d;
+                a[9] += w * d * d;
+            }
+
+            void Add(const sQuadric &q)
+            {
+                for (int i = 0; i < 10; i++)
+                    a[i] += q.a[i];
+            }
+
+            double Evaluate(double x, double y, double z) const
+            {
+                return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+                       a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+                       a[7] * z * z + 2.0 * a[8] * z + a[9];
+            }
+        };
+
+        std::vector<uint32_t> vecTris = in.indices;
+        std::vector<bool> vecTriDead(nTris, false);
+        std::vector<std::vector<uint32_t>> vecVertexTris(nVertices);
+        std::vector<sQuadric> vecQuadrics(nVertices);
+
+        auto Position = [&](uint32_t v) { return vec3d{in.px[v], in.py[v], in.pz[v]}; };
+        auto FaceNormal = [&](uint32_t a, uint32_t b, uint32_t c) {
+            vec3d pa = Position(a), pb = Position(b), pc = Position(c);
+            vec3d line1 = Vec_Sub(pb, pa);
+            vec3d line2 = Vec_Sub(pc, pa);
+            return Vec_CrossProduct(line1, line2);
+        };
+
+        // Each vertex starts with the planes of the faces around it
+        std::unordered_map<uint64_t, uint32_t> mapEdgeUse;
+        for (size_t t = 0; t < nTris; t++)
+        {
+            uint32_t *f = &vecTris[t * 3];
+            vec3d n = FaceNormal(f[0], f[1], f[2]);
+            float l = Vec_Length(n);
+            for (int i = 0; i < 3; i++)
+            {
+                vecVertexTris[f[i]].push_back((uint32_t)t);
+                uint32_t a = std::min(f[i], f[(i + 1) % 3]), b = std::max(f[i], f[(i + 1) % 3]);
+                mapEdgeUse[((uint64_t)a << 32) | b]++;
+            }
+            if (l <= 0.0f)
+                continue;
+            n = Vec_Div(n, l);
+            vec3d p = Position(f[0]);
+            double d = -(double)Vec_DotProduct(n, p);
+            for (int i = 0; i < 3; i++)
+                vecQuadrics[f[i]].AddPlane(n.x, n.y, n.z, d, 1.0);
+        }
+
+        // Edges with only one face are borders or seams. A steep plane through each,
+        // at right angles to its face, stops them being pulled out of place
+        const double fBorderWeight = 10.0;
+        for (size_t t = 0; t < nTris; t++)
+        {
+            uint32_t *f = &vecTris[t * 3];
+            vec3d n = FaceNormal(f[0], f[1], f[2]);
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t a = f[i], b = f[(i + 1) % 3];
+                if (mapEdgeUse[((uint64_t)std::min(a, b) << 32) | std::max(a, b)] != 1)
+                    continue;
+                vec3d pa = Position(a), pb = Position(b);
+                vec3d e = Vec_Sub(pb, pa);
+                vec3d bn = Vec_CrossProduct(e, n);
+                float l = Vec_Length(bn);
+                if (l <= 0.0f)
+                    continue;
+                bn = Vec_Div(bn, l);
+                double d = -(double)Vec_DotProduct(bn, pa);
+                vecQuadrics[a].AddPlane(bn.x, bn.y, bn.z, d, fBorderWeight);
+                vecQuadrics[b].AddPlane(bn.x, bn.y, bn.z, d, fBorderWeight);
+            }
+        }
+
+        // Candidate collapses, cheapest first. Entries go stale when either vertex
+        // changes, which the stamps detect
+        struct sCollapse
+        {
+            double fCost;
+            uint32_t nFrom, nTo;
+            uint32_t nStampFrom, nStampTo;
+            bool operator<(const sCollapse &c) const { return fCost > c.fCost; }
+        };
+        std::vector<sCollapse> vecHeap;
+        std::vector<uint32_t> vecStamp(nVertices, 0);
+        std::vector<bool> vecRemoved(nVertices, false);
+
+        auto ConsiderEdge = [&](uint32_t a, uint32_t b) {
+            sQuadric q = vecQuadrics[a];
+            q.Add(vecQuadrics[b]);
+            double fCostToA = q.Evaluate(in.px[a], in.py[a], in.pz[a]);
+            double fCostToB = q.Evaluate(in.px[b], in.py[b], in.pz[b]);
+            sCollapse c = fCostToB <= fCostToA ? sCollapse{std::max(fCostToB, 0.0), a, b, vecStamp[a], vecStamp[b]}
+                                               : sCollapse{std::max(fCostToA, 0.0), b, a, vecStamp[b], vecStamp[a]};
+            vecHeap.push_back(c);
+            std::push_heap(vecHeap.begin(), vecHeap.end());
+        };
+
+        for (size_t t = 0; t < nTris; t++)
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t a = vecTris[t * 3 + i], b = vecTris[t * 3 + (i + 1) % 3];
+                if (a < b || mapEdgeUse[((uint64_t)b << 32) | a] == 1)
+                    ConsiderEdge(a, b);
+            }
+
+        // Copies the surviving triangles out as a new level, keeping only used vertices
+        auto Snapshot = [&](double fMaxCost) {
+            mesh_indexed lod;
+            std::vector<uint32_t> vecNewIndex(nVertices, UINT32_MAX);
+            bool bNormals = in.nx.size() == nVertices;
+            for (size_t t = 0; t < nTris; t++)
+            {
+                if (vecTriDead[t])
+                    continue;
+                for (int i = 0; i < 3; i++)
+                {
+                    uint32_t v = vecTris[t * 3 + i];
+                    if (vecNewIndex[v] == UINT32_MAX)
+                    {
+                        vecNewIndex[v] = (uint32_t)lod.px.size();
+                        lod.px.push_back(in.px[v]);
+                        lod.py.push_back(in.py[v]);
+                        lod.pz.push_back(in.pz[v]);
+                        if (bNormals)
+                        {
+                            lod.nx.push_back(in.nx[v]);
+                            lod.ny.push_back(in.ny[v]);
+                            lod.nz.push_back(in.nz[v]);
+                        }
+                        lod.u.push_back(v < in.u.size() ? in.u[v] : 0.0f);
+                        lod.v.push_back(v < in.v.size() ? in.v[v] : 0.0f);
+                        lod.col.push_back(v < in.col.size() ? in.col[v] : olc::WHITE);
+                    }
+                    lod.indices.push_back(vecNewIndex[v]);
+                }
+            }
+            Mesh_ComputeBounds(lod);
+            out.levels.push_back(std::move(lod));
+            out.fError.push_back((float)sqrt(fMaxCost));
+        };
+
+        size_t nLive = nTris;
+        size_t nTarget = (size_t)(nTris * fReduction);
+        double fMaxCost = 0.0;
+        while (!vecHeap.empty() && out.levels.size() < nLevels)
+        {
+            std::pop_heap(vecHeap.begin(), vecHeap.end());
+            sCollapse c = vecHeap.back();
+            vecHeap.pop_back();
+
+            uint32_t u = c.nFrom, v = c.nTo;
+            if (vecRemoved[u] || vecRemoved[v] || c.nStampFrom != vecStamp[u] || c.nStampTo != vecStamp[v])
+                continue;
+
+            // Reject collapses that would fold a face over, or squash it flat
+            bool bValid = true;
+            for (uint32_t t : vecVertexTris[u])
+            {
+                if (vecTriDead[t])
+                    continue;
+                uint32_t *f = &vecTris[t * 3];
+                if (f[0] == v || f[1] == v || f[2] == v)
+                    continue;
+                vec3d nOld = FaceNormal(f[0], f[1], f[2]);
+                vec3d nNew = FaceNormal(f[0] == u ? v : f[0], f[1] == u ? v : f[1], f[2] == u ? v : f[2]);
+                float fOld = Vec_Length(nOld), fNew = Vec_Length(nNew);
+                if (fNew <= 1e-4f * fOld || Vec_DotProduct(nOld, nNew) <= 0.2f * fOld * fNew)
+                {
+                    bValid = false;
+                    break;
+                }
+            }
+            if (!bValid)
+                continue;
+
+            // Move u onto v. Faces that had both are now degenerate and go
+            fMaxCost = std::max(fMaxCost, c.fCost);
+            vecRemoved[u] = true;
+            vecQuadrics[v].Add(vecQuadrics[u]);
+            for (uint32_t t : vecVertexTris[u])
+            {
+                if (vecTriDead[t])
+                    continue;
+                uint32_t *f = &vecTris[t * 3];
+                if (f[0] == v || f[1] == v || f[2] == v)
+                {
+                    vecTriDead[t] = true;
+                    nLive--;
+                    continue;
+                }
+                for (int i = 0; i < 3; i++)
+                    if (f[i] == u)
+                        f[i] = v;
+                vecVertexTris[v].push_back(t);
+            }
+            vecVertexTris[u].clear();
+            vecVertexTris[v].erase(std::remove_if(vecVertexTris[v].begin(), vecVertexTris[v].end(),
+                                                  [&](uint32_t t) { return (bool)vecTriDead[t]; }),
+                                   vecVertexTris[v].end());
+            vecStamp[v]++;
+
+            for (uint32_t t : vecVertexTris[v])
+                for (int i = 0; i < 3; i++)
+                {
+                    uint32_t w = vecTris[t * 3 + i];
+                    if (w != v)
+                        ConsiderEdge(v, w);
+                }
+
+            if (nLive <= nTarget)
+            {
+                Snapshot(fMaxCost);
+                nTarget = (size_t)(nLive * fReduction);
+            }
+        }
+
+        // Nothing left that could be collapsed, keep what was reached
+        if (out.levels.size() < nLevels && nLive < out.levels.back().indices.size() / 3)
+            Snapshot(fMaxCost);
+    }
+
+    olc::Pixel GFX3D::ModulateColour(olc::Pixel a, olc::Pixel b)
+    {
+        return olc::Pixel(
+            (uint8_t)((a.r * (b.r + 1)) >> 8),
+            (uint8_t)((a.g * (b.g + 1)) >> 8),
+            (uint8_t)((a.b * (b.b + 1)) >> 8),
+            (uint8_t)((a.a * (b.a + 1)) >> 8));
+    }
+
+    olc::Pixel GFX3D::BlendColour(olc::Pixel src, olc::Pixel dst)
+    {
+        // Rounded division by 255, exact for everything a blend can produce
+        auto Mix = [a = (int)src.a](int s, int d) {
+            int x = s * a + d * (255 - a) + 128;
+            return (uint8_t)((x + (x >> 8)) >> 8);
+        };
+        return olc::Pixel(Mix(src.r, dst.r), Mix(src.g, dst.g), Mix(src.b, dst.b), Mix(src.a, dst.a));
+    }
+
+    void GFX3D::BlendSpan(olc::Pixel *pDst, const olc::Pixel *pSrc, int nCount)
+    {
+        int i = 0;
+#ifdef OLC_GFX3D_SSE
+        // Each pixel widens to four 16 bit channels, two pixels to a register, and
+        // its alpha is broadcast across them. The sums fit unsigned 16 bits
+        const __m128i vZero = _mm_setzero_si128();
+        const __m128i v255 = _mm_set1_epi16(255), v128 = _mm_set1_epi16(128);
+        auto Blend2 = [&](__m128i s, __m128i d) {
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(v255, a)));
+            x = _mm_add_epi16(x, v128);
+            return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        };
+        for (; i + 4 <= nCount; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *)(pSrc + i));
+            __m128i d = _mm_loadu_si128((const __m128i *)(pDst + i));
+            __m128i lo = Blend2(_mm_unpacklo_epi8(s, vZero), _mm_unpacklo_epi8(d, vZero));
+            __m128i hi = Blend2(_mm_unpackhi_epi8(s, vZero), _mm_unpackhi_epi8(d, vZero));
+            _mm_storeu_si128((__m128i *)(pDst + i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < nCount; i++)
+            pDst[i] = BlendColour(pSrc[i], pDst[i]);
+    }
+
+    void GFX3D::DrawTriangleFlat(olc::GFX3D::triangle &tri)
+    {
+        pge->FillTriangle(tri.p[0].x, tri.p[0].y, tri.p[1].x, tri.p[1].y, tri.p[2].x, tri.p[2].y, tri.col);
+    }
+
+    void GFX3D::DrawTriangleWire(olc::GFX3D::triangle &tri, olc::Pixel col)
+    {
+        pge->DrawTriangle(tri.p[0].x, tri.p[0].y, tri.p[1].x, tri.p[1].y, tri.p[2].x, tri.p[2].y, col);
+    }
+
+    void GFX3D::TexturedTriangle(int x1, int y1, float u1, float v1, float w1,
+                                 int x2, int y2, float u2, float v2, float w2,
+                                 int x3, int y3, float u3, float v3, float w3, olc::Sprite *spr, olc::Pixel tint,
+                                 const olc::Pixel *pShade, const olc::GFX3D::vec3d *pShadow)
+
+    {
+        olc::Pixel c1 = pShade ? pShade[0] : olc::WHITE;
+        olc::Pixel c2 = pShade ? pShade[1] : olc::WHITE;
+        olc::Pixel c3 = pShade ? pShade[2] : olc::WHITE;
+        vec3d l1, l2, l3;
+        if (pShadow)
+        {
+            l1 = pShadow[0];
+            l2 = pShadow[1];
+            l3 = pShadow[2];
+        }
+
+        if (y2 < y1)
+        {
+            std::swap(y1, y2);
+            std::swap(x1, x2);
+            std::swap(u1, u2);
+            std::swap(v1, v2);
+            std::swap(w1, w2);
+            std::swap(c1, c2);
+            std::swap(l1, l2);
+        }
+
+        if (y3 < y1)
+        {
+            std::swap(y1, y3);
+            std::swap(x1, x3);
+            std::swap(u1, u3);
+            std::swap(v1, v3);
+            std::swap(w1, w3);
+            std::swap(c1, c3);
+            std::swap(l1, l3);
+        }
+
+        if (y3 < y2)
+        {
+            std::swap(y2, y3);
+            std::swap(x2, x3);
+            std::swap(u2, u3);
+            std::swap(v2, v3);
+            std::swap(w2, w3);
+            std::swap(c2, c3);
+            std::swap(l2, l3);
+        }
+
+        int dy1 = y2 - y1;
+        int dx1 = x2 - x1;
+        float dv1 = v2 - v1;
+        float du1 = u2 - u1;
+        float dw1 = w2 - w1;
+
+        int dy2 = y3 - y1;
+        int dx2 = x3 - x1;
+        float dv2 = v3 - v1;
+        float du2 = u3 - u1;
+        float dw2 = w3 - w1;
+
+        float fDet = (float)(dx1 * dy2 - dx2 * dy1);
+
+        // Gouraud shading, each colour channel varies linearly across the triangles
+        // plane. Degenerate triangles just take the first colour
+        sShadeGradients shade;
+        const sShadeGradients *pShadeGrad = nullptr;
+        if (pShade)
+        {
+            if (fDet != 0.0f)
+            {
+                float fInvDet = 1.0f / fDet;
+                float dr1 = (float)(c2.r - c1.r), dg1 = (float)(c2.g - c1.g), db1 = (float)(c2.b - c1.b);
+                float dr2 = (float)(c3.r - c1.r), dg2 = (float)(c3.g - c1.g), db2 = (float)(c3.b - c1.b);
+                shade.x = x1;
+                shade.y = y1;
+                shade.r = (float)c1.r;
+                shade.g = (float)c1.g;
+                shade.b = (float)c1.b;
+                shade.drdx = (dr1 * dy2 - dr2 * dy1) * fInvDet;
+                shade.dgdx = (dg1 * dy2 - dg2 * dy1) * fInvDet;
+                shade.dbdx = (db1 * dy2 - db2 * dy1) * fInvDet;
+                shade.drdy = (dr2 * dx1 - dr1 * dx2) * fInvDet;
+                shade.dgdy = (dg2 * dx1 - dg1 * dx2) * fInvDet;
+                shade.dbdy = (db2 * dx1 - db1 * dx2) * fInvDet;
+                pShadeGrad = &shade;
+            }
+            else
+                tint = ModulateColour(tint, c1);
+        }
+
+        // Shadow map coordinates vary linearly across the plane in the same way
+        sShadowGradients shadow;
+        const sShadowGradients *pShadowGrad = nullptr;
+        if (pShadow && m_pShadowMap && fDet != 0.0f)
+        {
+            float fInvDet = 1.0f / fDet;
+            shadow.x = x1;
+            shadow.y = y1;
+            shadow.lx = l1.x;
+            shadow.ly = l1.y;
+            shadow.lw = l1.z;
+            shadow.dxdx = ((l2.x - l1.x) * dy2 - (l3.x - l1.x) * dy1) * fInvDet;
+            shadow.dydx = ((l2.y - l1.y) * dy2 - (l3.y - l1.y) * dy1) * fInvDet;
+            shadow.dwdx = ((l2.z - l1.z) * dy2 - (l3.z - l1.z) * dy1) * fInvDet;
+            shadow.dxdy = ((l3.x - l1.x) * dx1 - (l2.x - l1.x) * dx2) * fInvDet;
+            shadow.dydy = ((l3.y - l1.y) * dx1 - (l2.y - l1.y) * dx2) * fInvDet;
+            shadow.dwdy = ((l3.z - l1.z) * dx1 - (l2.z - l1.z) * dx2) * fInvDet;
+            pShadowGrad = &shadow;
+        }
+
+        // Only pay for modulation when there is a tint
+        bool bTint = tint != olc::WHITE;
+
+        // Mip selection needs to know how the texture coordinates change in y as
+        // well as along the spans, so find the gradients of the triangles plane
+        sTexGradients grad;
+        const sTexGradients *pGrad = nullptr;
+        if (m_bMipMapping)
+        {
+            if (spr->GetMipLevelCount() == 1)
+                spr->GenerateMipMaps();
+
+            if (spr->GetMipLevelCount() > 1 && fDet != 0.0f)
+            {
+                float fInvDet = 1.0f / fDet;
+                grad.dudx = (du1 * dy2 - du2 * dy1) * fInvDet;
+                grad.dvdx = (dv1 * dy2 - dv2 * dy1) * fInvDet;
+                grad.dwdx = (dw1 * dy2 - dw2 * dy1) * fInvDet;
+                grad.dudy = (du2 * dx1 - du1 * dx2) * fInvDet;
+                grad.dvdy = (dv2 * dx1 - dv1 * dx2) * fInvDet;
+                grad.dwdy = (dw2 * dx1 - dw1 * dx2) * fInvDet;
+                pGrad = &grad;
+            }
+        }
+
+        float dax_step = 0, dbx_step = 0,
+              du1_step = 0, dv1_step = 0,
+              du2_step = 0, dv2_step = 0,
+              dw1_step = 0, dw2_step = 0;
+
+        if (dy1)
+            dax_step = dx1 / (float)abs(dy1);
+        if (dy2)
+            dbx_step = dx2 / (float)abs(dy2);
+
+        if (dy1)
+            du1_step = du1 / (float)abs(dy1);
+        if (dy1)
+            dv1_step = dv1 / (float)abs(dy1);
+        if (dy1)
+            dw1_step = dw1 / (float)abs(dy1);
+
+        if (dy2)
+            du2_step = du2 / (float)abs(dy2);
+        if (dy2)
+            dv2_step = dv2 / (float)abs(dy2);
+        if (dy2)
+            dw2_step = dw2 / (float)abs(dy2);
+
+        if (dy1)
+        {
+            for (int i = std::max(y1, m_nScissorY1); i <= std::min(y2, m_nScissorY2 - 1); i++)
+            {
+                int ax = x1 + (float)(i - y1) * dax_step;
+                int bx = x1 + (float)(i - y1) * dbx_step;
+
+                float tex_su = u1 + (float)(i - y1) * du1_step;
+                float tex_sv = v1 + (float)(i - y1) * dv1_step;
+                float tex_sw = w1 + (float)(i - y1) * dw1_step;
+
+                float tex_eu = u1 + (float)(i - y1) * du2_step;
+                float tex_ev = v1 + (float)(i - y1) * dv2_step;
+                float tex_ew = w1 + (float)(i - y1) * dw2_step;
+
+                if (ax > bx)
+                {
+                    std::swap(ax, bx);
+                    std::swap(tex_su, tex_eu);
+                    std::swap(tex_sv, tex_ev);
+                    std::swap(tex_sw, tex_ew);
+                }
+
+                TexturedSpan(i, ax, bx, tex_su, tex_sv, tex_sw, tex_eu, tex_ev, tex_ew, spr, tint, bTint, pGrad, pShadeGrad, pShadowGrad);
+            }
+        }
+
+        dy1 = y3 - y2;
+        dx1 = x3 - x2;
+        dv1 = v3 - v2;
+        du1 = u3 - u2;
+        dw1 = w3 - w2;
+
+        if (dy1)
+            dax_step = dx1 / (float)abs(dy1);
+        if (dy2)
+            dbx_step = dx2 / (float)abs(dy2);
+
+        du1_step = 0, dv1_step = 0;
+        if (dy1)
+            du1_step = du1 / (float)abs(dy1);
+        if (dy1)
+            dv1_step = dv1 / (float)abs(dy1);
+        if (dy1)
+            dw1_step = dw1 / (float)abs(dy1);
+
+        if (dy1)
+        {
+            for (int i = std::max(y2, m_nScissorY1); i <= std::min(y3, m_nScissorY2 - 1); i++)
+            {
+                int ax = x2 + (float)(i - y2) * dax_step;
+                int bx = x1 + (float)(i - y1) * dbx_step;
+
+                float tex_su = u2 + (float)(i - y2) * du1_step;
+                float tex_sv = v2 + (float)(i - y2) * dv1_step;
+                float tex_sw = w2 + (float)(i - y2) * dw1_step;
+
+                float tex_eu = u1 + (float)(i - y1) * du2_step;
+                float tex_ev = v1 + (float)(i - y1) * dv2_step;
+                float tex_ew = w1 + (float)(i - y1) * dw2_step;
+
+                if (ax > bx)
+                {
+                    std::swap(ax, bx);
+                    std::swap(tex_su, tex_eu);
+                    std::swap(tex_sv, tex_ev);
+                    std::swap(tex_sw, tex_ew);
+                }
+
+                TexturedSpan(i, ax, bx, tex_su, tex_sv, tex_sw, tex_eu, tex_ev, tex_ew, spr, tint, bTint, pGrad, pShadeGrad, pShadowGrad);
+            }
+        }
+    }
+
+    void GFX3D::TexturedSpan(int y, int ax, int bx,
+                             float su, float sv, float sw, float eu, float ev, float ew,
+                             olc::Sprite *spr, olc::Pixel tint, bool bTint, const sTexGradients *pGrad,
+                             const sShadeGradients *pShade, const sShadowGradients *pShadow)
+    {
+        // Scissor the span
+        int sx = std::max(ax, m_nScissorX1);
+        int ex = std::min(bx, m_nScissorX2);
+        if (sx >= ex)
+            return;
+
+        if (pGrad)
+        {
+            // The derivatives of u = (u/w) / (1/w) follow from the quotient rule.
+            // The level is log2 of the larger footprint of a pixel in texels
+            float t = ((float)((sx + ex) / 2 - ax) + 0.5f) / (float)(bx - ax);
+            float w = (1.0f - t) * sw + t * ew;
+            float u = ((1.0f - t) * su + t * eu) / w;
+            float v = ((1.0f - t) * sv + t * ev) / w;
+            float dUdx = (pGrad->dudx - u * pGrad->dwdx) / w * (float)spr->width;
+            float dVdx = (pGrad->dvdx - v * pGrad->dwdx) / w * (float)spr->height;
+            float dUdy = (pGrad->dudy - u * pGrad->dwdy) / w * (float)spr->width;
+            float dVdy = (pGrad->dvdy - v * pGrad->dwdy) / w * (float)spr->height;
+            float fRho2 = std::max(dUdx * dUdx + dVdx * dVdx, dUdy * dUdy + dVdy * dVdy);
+            if (fRho2 > 1.0f)
+                spr = spr->GetMipLevel((uint32_t)(0.5f * log2f(fRho2)));
+        }
+
+        // u/w, v/w and 1/w are linear in screen space, so they change by a constant
+        // amount per pixel. Each pixel is found from the start of the visible span,
+        // rather than accumulated, so rounding errors dont build up along it
+        float tstep = 1.0f / ((float)(bx - ax));
+        float du = (eu - su) * tstep;
+        float dv = (ev - sv) * tstep;
+        float dw = (ew - sw) * tstep;
+        float t = (float)(sx - ax);
+        su += t * du;
+        sv += t * dv;
+        sw += t * dw;
+
+        int nTileRow = (y >> HIZ_TILE_SHIFT) * m_nHiZTilesX;
+        const float *pTiles = m_HiZTiles + nTileRow;
+        int nWrittenX1 = ex, nWrittenX2 = sx;
+
+        // Write straight into the target's row, unless the pixel mode, its layout or
+        // a size different to the depth buffer means it must go through Draw
+        olc::Sprite *pTarget = pge->GetDrawTarget();
+        olc::Pixel *pRow = nullptr;
+        if (pge->GetPixelMode() == olc::Pixel::NORMAL && pTarget->GetLayout() == olc::Sprite::Layout::LINEAR &&
+            pTarget->width == pge->ScreenWidth() && pTarget->height == pge->ScreenHeight())
+            pRow = pTarget->GetData() + y * pTarget->width;
+
+        // Shading at the start of the visible span
+        float fShadeR = 0.0f, fShadeG = 0.0f, fShadeB = 0.0f;
+        if (pShade)
+        {
+            float fx = (float)(sx - pShade->x), fy = (float)(y - pShade->y);
+            fShadeR = pShade->r + fx * pShade->drdx + fy * pShade->drdy;
+            fShadeG = pShade->g + fx * pShade->dgdx + fy * pShade->dgdy;
+            fShadeB = pShade->b + fx * pShade->dbdx + fy * pShade->dbdy;
+        }
+
+        // Blended pixels gather in a cleared row, so they can be blended over the target
+        // together once the depth tests are done. They never write depth
+        olc::Pixel *pBlend = nullptr;
+        if (m_nAlphaMode == RENDER_ALPHA_BLEND && pRow)
+        {
+            pBlend = m_BlendRow;
+            std::fill(pBlend + sx, pBlend + ex, olc::Pixel(0, 0, 0, 0));
+        }
+
+        // Likewise the shadow map coordinates
+        float fShadowX = 0.0f, fShadowY = 0.0f, fShadowW = 0.0f;
+        if (pShadow)
+        {
+            float fx = (float)(sx - pShadow->x), fy = (float)(y - pShadow->y);
+            fShadowX = pShadow->lx + fx * pShadow->dxdx + fy * pShadow->dxdy;
+            fShadowY = pShadow->ly + fx * pShadow->dydx + fy * pShadow->dydy;
+            fShadowW = pShadow->lw + fx * pShadow->dwdx + fy * pShadow->dwdy;
+        }
+
+        // Returns true if the pixel should write its depth
+        auto Plot = [&](int x, float u, float v) {
+            olc::Pixel p = spr->Sample(u, v);
+            if (bTint)
+                p = ModulateColour(p, tint);
+            if (pShade)
+            {
+                float k = (float)(x - sx);
+                auto Channel = [](float c) { return (uint8_t)std::min(std::max(c, 0.0f), 255.0f); };
+                p = ModulateColour(p, olc::Pixel(Channel(fShadeR + k * pShade->drdx),
+                                                 Channel(fShadeG + k * pShade->dgdx),
+                                                 Channel(fShadeB + k * pShade->dbdx)));
+            }
+            if (pShadow)
+            {
+                // The screen's w cancels out of the light's divide, all but for the
+                // depth, which needs the pixel's own 1/w
+                float k = (float)(x - sx);
+                float lw = fShadowW + k * pShadow->dwdx;
+                if (lw > 0.0f)
+                {
+                    float fInvLW = 1.0f / lw;
+                    float fLit = ShadowLookup((fShadowX + k * pShadow->dxdx) * fInvLW, (fShadowY + k * pShadow->dydx) * fInvLW,
+                                              (sw + k * dw) * fInvLW);
+                    if (fLit < 1.0f)
+                    {
+                        olc::Pixel s = ModulateColour(p, m_colShadow);
+                        int a = (int)(fLit * 256.0f), b = 256 - a;
+                        p = olc::Pixel((uint8_t)((p.r * a + s.r * b) >> 8), (uint8_t)((p.g * a + s.g * b) >> 8),
+                                       (uint8_t)((p.b * a + s.b * b) >> 8), p.a);
+                    }
+                }
+            }
+            if (m_nAlphaMode == RENDER_ALPHA_TEST && p.a < m_nAlphaReference)
+                return false;
+            if (m_nAlphaMode == RENDER_ALPHA_BLEND)
+            {
+                if (pBlend)
+                    pBlend[x] = p;
+                else
+                {
+                    // Already blended, so the pixel mode must take it as it is
+                    olc::Pixel c = BlendColour(p, pTarget->GetPixel(x, y));
+                    c.a = 255;
+                    pge->Draw(x, y, c);
+                }
+                return false;
+            }
+            if (pRow)
+                pRow[x] = p;
+            else
+                pge->Draw(x, y, p);
+            nWrittenX1 = std::min(nWrittenX1, x);
+            nWrittenX2 = x;
+            return true;
+        };
+
+        // Texture coordinates of the current subdivision, sx + k * N to sx + (k + 1) * N
+        int nSub = m_nPerspectiveSubdivision;
+        int nRunX1 = sx, nRunX2 = sx;
+        float fRunU = 0.0f, fRunV = 0.0f, fRunDU = 0.0f, fRunDV = 0.0f;
+
+        // Textures a pixel that has passed the depth test
+        auto Shade = [&](int x, float tex_w) {
+            if (nSub == 1)
+            {
+                float k = (float)(x - sx);
+                return Plot(x, (su + k * du) / tex_w, (sv + k * dv) / tex_w);
+            }
+
+            // Entering a new subdivision, find its true texture coordinates
+            // at both ends. Only done for runs that have visible pixels
+            if (x >= nRunX2)
+            {
+                nRunX1 = sx + ((x - sx) / nSub) * nSub;
+                nRunX2 = std::min(nRunX1 + nSub, ex);
+                float k1 = (float)(nRunX1 - sx), k2 = (float)(nRunX2 - sx);
+                float w1 = sw + k1 * dw, w2 = sw + k2 * dw;
+                fRunU = (su + k1 * du) / w1;
+                fRunV = (sv + k1 * dv) / w1;
+                float fInvLength = 1.0f / (float)(nRunX2 - nRunX1);
+                fRunDU = ((su + k2 * du) / w2 - fRunU) * fInvLength;
+                fRunDV = ((sv + k2 * dv) / w2 - fRunV) * fInvLength;
+            }
+
+            float k = (float)(x - nRunX1);
+            return Plot(x, fRunU + k * fRunDU, fRunV + k * fRunDV);
+        };
+
+        int j = sx;
+        while (j < ex)
+        {
+            // Work a tile at a time. If the span is behind everything in the tile,
+            // skip it without touching the depth buffer
+            int tx = j >> HIZ_TILE_SHIFT;
+            int je = std::min((tx + 1) << HIZ_TILE_SHIFT, ex);
+            float w0 = sw + (float)(j - sx) * dw;
+            float w1 = sw + (float)(je - 1 - sx) * dw;
+            if (std::max(w0, w1) <= pTiles[tx])
+            {
+                j = je;
+                continue;
+            }
+
+            int nTile = nTileRow + tx;
+            if (m_DepthTileCleared[nTile])
+                Depth_PrepareTile(nTile);
+
+            // Offset to this span's row within the tile, so it can be indexed by x
+            int nDepthRow = (nTile << DEPTH_TILE_SHIFT) + ((y & ((1 << HIZ_TILE_SHIFT) - 1)) << HIZ_TILE_SHIFT) - (tx << HIZ_TILE_SHIFT);
+
+            if (m_nDepthFormat == DEPTH_UNORM16)
+            {
+                uint16_t *pDepth = m_DepthBuffer16 + nDepthRow;
+                for (; j < je; j++)
+                {
+                    float tex_w = sw + (float)(j - sx) * dw;
+                    uint16_t d = Depth_Encode16(tex_w);
+                    if (d > pDepth[j] && Shade(j, tex_w))
+                        pDepth[j] = d;
+                }
+                continue;
+            }
+
+            float *pDepth = m_DepthBuffer + nDepthRow;
+#ifdef OLC_GFX3D_SSE
+            if (nSub == 1)
+            {
+                // Four pixels at a time, depth test and divides in parallel
+                const __m128 vLane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+                const __m128 vDU = _mm_set1_ps(du), vDV = _mm_set1_ps(dv), vDW = _mm_set1_ps(dw);
+                for (; j + 4 <= je; j += 4)
+                {
+                    __m128 k = _mm_add_ps(_mm_set1_ps((float)(j - sx)), vLane);
+                    __m128 w = _mm_add_ps(_mm_set1_ps(sw), _mm_mul_ps(k, vDW));
+                    __m128 d = _mm_loadu_ps(pDepth + j);
+                    __m128 mask = _mm_cmpgt_ps(w, d);
+                    int nMask = _mm_movemask_ps(mask);
+                    if (nMask == 0)
+                        continue;
+
+                    alignas(16) float u[4], v[4];
+                    _mm_store_ps(u, _mm_div_ps(_mm_add_ps(_mm_set1_ps(su), _mm_mul_ps(k, vDU)), w));
+                    _mm_store_ps(v, _mm_div_ps(_mm_add_ps(_mm_set1_ps(sv), _mm_mul_ps(k, vDV)), w));
+
+                    // Alpha can reject pixels after the depth test, so those go one at a time
+                    if (m_nAlphaMode == 0)
+                    {
+                        _mm_storeu_ps(pDepth + j, _mm_or_ps(_mm_and_ps(mask, w), _mm_andnot_ps(mask, d)));
+                        for (int l = 0; l < 4; l++)
+                            if (nMask & (1 << l))
+                                Plot(j + l, u[l], v[l]);
+                    }
+                    else
+                    {
+                        alignas(16) float fw[4];
+                        _mm_store_ps(fw, w);
+                        for (int l = 0; l < 4; l++)
+                            if ((nMask & (1 << l)) && Plot(j + l, u[l], v[l]))
+                                pDepth[j + l] = fw[l];
+                    }
+                }
+            }
+#endif
+            for (; j < je; j++)
+            {
+                float tex_w = sw + (float)(j - sx) * dw;
+                if (tex_w > pDepth[j] && Shade(j, tex_w))
+                    pDepth[j] = tex_w;
+            }
+        }
+
+        if (pBlend)
+            BlendSpan(pRow + sx, pBlend + sx, ex - sx);
+
+        if (nWrittenX1 <= nWrittenX2)
+            HiZ_MarkSpan(y, nWrittenX1, nWrittenX2);
+    }
+
+    float GFX3D::ShadowLookup(float x, float y, float fInvZ)
+    {
+        const shadow_map &map = *m_pShadowMap;
+        int tx = (int)floorf((x + 1.0f) * 0.5f * (float)map.nSize);
+        int ty = (int)floorf((y + 1.0f) * 0.5f * (float)map.nSize);
+
+        // Shadowed where the caster's 1/z is greater, so nearer the light
+        float fThreshold = fInvZ / (1.0f - m_fShadowBias);
+        auto Lit = [&](int sx, int sy) {
+            if (sx < 0 || sy < 0 || sx >= map.nSize || sy >= map.nSize)
+                return 1;
+            return map.depth[sy * map.nSize + sx] > fThreshold ? 0 : 1;
+        };
+
+        if (!m_bShadowPCF)
+            return (float)Lit(tx, ty);
+
+        int nLit = 0;
+        for (int j = -1; j <= 1; j++)
+            for (int i = -1; i <= 1; i++)
+                nLit += Lit(tx + i, ty + j);
+        return (float)nLit / 9.0f;
+    }
+
+    void GFX3D::DepthOnlyTriangle(float *pDepth, int nSize, float x1, float y1, float w1,
+                                  float x2, float y2, float w2, float x3, float y3, float w3)
+    {
+        // 1/z is linear in screen space, so it follows the triangles plane
+        float fDet = (x2 - x1) * (y3 - y1) - (x3 - x1) * (y2 - y1);
+        if (fDet == 0.0f)
+            return;
+        float fInvDet = 1.0f / fDet;
+        float dwdx = ((w2 - w1) * (y3 - y1) - (w3 - w1) * (y2 - y1)) * fInvDet;
+        float dwdy = ((w3 - w1) * (x2 - x1) - (w2 - w1) * (x3 - x1)) * fInvDet;
+        // The plane is anchored at the first corner, before sorting moves it
+        float fAnchorX = x1, fAnchorY = y1, fAnchorW = w1;
+
+        if (y2 < y1)
+        {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+        }
+        if (y3 < y1)
+        {
+            std::swap(x1, x3);
+            std::swap(y1, y3);
+        }
+        if (y3 < y2)
+        {
+            std::swap(x2, x3);
+            std::swap(y2, y3);
+        }
+
+        // Rows whose centres lie within the triangle, clamped to the map before
+        // conversion, as corners near the light's near plane can be far outside it
+        float fSize = (float)nSize;
+        if (std::min({x1, x2, x3}) >= fSize || std::max({x1, x2, x3}) <= 0.0f || y1 >= fSize || y3 <= 0.0f)
+            return;
+        int ys = (int)ceilf(std::max(y1, 0.0f) - 0.5f);
+        int ye = (int)ceilf(std::min(y3, fSize) - 0.5f);
+        float fSlope13 = (x3 - x1) / (y3 - y1);
+        float fSlope12 = y2 > y1 ? (x2 - x1) / (y2 - y1) : 0.0f;
+        float fSlope23 = y3 > y2 ? (x3 - x2) / (y3 - y2) : 0.0f;
+
+        for (int y = ys; y < ye; y++)
+        {
+            float fy = (float)y + 0.5f;
+            float xa = x1 + (fy - y1) * fSlope13;
+            float xb = fy < y2 ? x1 + (fy - y1) * fSlope12 : x2 + (fy - y2) * fSlope23;
+            if (xa > xb)
+                std::swap(xa, xb);
+
+            int xs = (int)ceilf(std::max(xa, 0.0f) - 0.5f);
+            int xe = (int)ceilf(std::min(xb, fSize) - 0.5f);
+            if (xs >= xe)
+                continue;
+
+            float *pRow = pDepth + y * nSize;
+            float w = fAnchorW + ((float)xs + 0.5f - fAnchorX) * dwdx + (fy - fAnchorY) * dwdy;
+            int x = xs;
+#ifdef OLC_GFX3D_SSE
+            const __m128 vStep = _mm_set1_ps(4.0f * dwdx);
+            __m128 vW = _mm_add_ps(_mm_set1_ps(w), _mm_mul_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_set1_ps(dwdx)));
+            for (; x + 4 <= xe; x += 4)
+            {
+                _mm_storeu_ps(pRow + x, _mm_max_ps(_mm_loadu_ps(pRow + x), vW));
+                vW = _mm_add_ps(vW, vStep);
+            }
+            w += (float)(x - xs) * dwdx;
+#endif
+            for (; x < xe; x++)
+            {
+                pRow[x] = std::max(pRow[x], w);
+                w += dwdx;
+            }
+        }
+    }
+
+    void GFX3D::HiZ_MarkSpan(int y, int x1, int x2)
+    {
+        uint8_t *pDirty = m_HiZTileDirty + (y >> HIZ_TILE_SHIFT) * m_nHiZTilesX;
+        for (int tx = x1 >> HIZ_TILE_SHIFT; tx <= x2 >> HIZ_TILE_SHIFT; tx++)
+            pDirty[tx] = 1;
+    }
+
+    float GFX3D::HiZ_UpdateTile(int tx, int ty)
+    {
+        int nTile = ty * m_nHiZTilesX + tx;
+        if (m_HiZTileDirty[nTile])
+        {
+            // Tiles on the right and bottom edges may hang over the screen
+            int nw = std::min(1 << HIZ_TILE_SHIFT, m_nDepthWidth - (tx << HIZ_TILE_SHIFT));
+            int nh = std::min(1 << HIZ_TILE_SHIFT, m_nDepthHeight - (ty << HIZ_TILE_SHIFT));
+
+            float fFurthest;
+            if (m_nDepthFormat == DEPTH_UNORM16)
+            {
+                const uint16_t *pDepth = m_DepthBuffer16 + (nTile << DEPTH_TILE_SHIFT);
+                uint16_t nFurthest = pDepth[0];
+                for (int y = 0; y < nh; y++)
+                    for (int x = 0; x < nw; x++)
+                        nFurthest = std::min(nFurthest, pDepth[(y << HIZ_TILE_SHIFT) + x]);
+                fFurthest = (float)nFurthest / m_fDepthScale16;
+            }
+            else
+            {
+                const float *pDepth = m_DepthBuffer + (nTile << DEPTH_TILE_SHIFT);
+                fFurthest = pDepth[0];
+                for (int y = 0; y < nh; y++)
+                    for (int x = 0; x < nw; x++)
+                        fFurthest = std::min(fFurthest, pDepth[(y << HIZ_TILE_SHIFT) + x]);
+            }
+
+            m_HiZTiles[nTile] = fFurthest;
+            m_HiZTileDirty[nTile] = 0;
+            m_HiZBlockDirty[(ty >> HIZ_BLOCK_SHIFT) * m_nHiZBlocksX + (tx >> HIZ_BLOCK_SHIFT)] = 1;
+        }
+        return m_HiZTiles[nTile];
+    }
+
+    void GFX3D::Depth_PrepareTile(int nTile)
+    {
+        if (m_nDepthFormat == DEPTH_UNORM16)
+            memset(m_DepthBuffer16 + (nTile << DEPTH_TILE_SHIFT), 0, sizeof(uint16_t) << DEPTH_TILE_SHIFT);
+        else
+            memset(m_DepthBuffer + (nTile << DEPTH_TILE_SHIFT), 0, sizeof(float) << DEPTH_TILE_SHIFT);
+        m_DepthTileCleared[nTile] = 0;
+    }
+
+    bool GFX3D::Depth_TestAndWrite(int x, int y, float w)
+    {
+        if (x < 0 || x >= m_nDepthWidth || y < 0 || y >= m_nDepthHeight)
+            return false;
+
+        int nTile = (y >> HIZ_TILE_SHIFT) * m_nHiZTilesX + (x >> HIZ_TILE_SHIFT);
+        if (m_DepthTileCleared[nTile])
+            Depth_PrepareTile(nTile);
+
+        int mask = (1 << HIZ_TILE_SHIFT) - 1;
+        int i = (nTile << DEPTH_TILE_SHIFT) + ((y & mask) << HIZ_TILE_SHIFT) + (x & mask);
+        if (m_nDepthFormat == DEPTH_UNORM16)
+        {
+            uint16_t d = Depth_Encode16(w);
+            if (d <= m_DepthBuffer16[i])
+                return false;
+            m_DepthBuffer16[i] = d;
+        }
+        else
+        {
+            if (w <= m_DepthBuffer[i])
+                return false;
+            m_DepthBuffer[i] = w;
+        }
+
+        m_HiZTileDirty[nTile] = 1;
+        return true;
+    }
+
+    uint16_t GFX3D::Depth_Encode16(float w)
+    {
+        return (uint16_t)std::min(w * m_fDepthScale16, 65535.0f);
+    }
+
+    float GFX3D::HiZ_UpdateBlock(int bx, int by)
+    {
+        // Built from the tiles as they stand, without bringing them up to date first,
+        // so this stays cheap and is no less safe
+        int nBlock = by * m_nHiZBlocksX + bx;
+        if (m_HiZBlockDirty[nBlock])
+        {
+            int tx1 = bx << HIZ_BLOCK_SHIFT, tx2 = std::min(tx1 + (1 << HIZ_BLOCK_SHIFT), m_nHiZTilesX);
+            int ty1 = by << HIZ_BLOCK_SHIFT, ty2 = std::min(ty1 + (1 << HIZ_BLOCK_SHIFT), m_nHiZTilesY);
+
+            float fFurthest = m_HiZTiles[ty1 * m_nHiZTilesX + tx1];
+            for (int ty = ty1; ty < ty2; ty++)
+                for (int tx = tx1; tx < tx2; tx++)
+                    fFurthest = std::min(fFurthest, m_HiZTiles[ty * m_nHiZTilesX + tx]);
+
+            m_HiZBlocks[nBlock] = fFurthest;
+            m_HiZBlockDirty[nBlock] = 0;
+        }
+        return m_HiZBlocks[nBlock];
+    }
+
+    bool GFX3D::IsOccluded(int x1, int y1, int x2, int y2, float fNearest)
+    {
+        x1 = std::max(x1, m_nScissorX1);
+        y1 = std::max(y1, m_nScissorY1);
+        x2 = std::min(x2, m_nScissorX2 - 1);
+        y2 = std::min(y2, m_nScissorY2 - 1);
+        if (x1 > x2 || y1 > y2)
+            return true;
+
+        int tx1 = x1 >> HIZ_TILE_SHIFT, tx2 = x2 >> HIZ_TILE_SHIFT;
+        int ty1 = y1 >> HIZ_TILE_SHIFT, ty2 = y2 >> HIZ_TILE_SHIFT;
+
+        for (int by = ty1 >> HIZ_BLOCK_SHIFT; by <= ty2 >> HIZ_BLOCK_SHIFT; by++)
+        {
+            for (int bx = tx1 >> HIZ_BLOCK_SHIFT; bx <= tx2 >> HIZ_BLOCK_SHIFT; bx++)
+            {
+                if (fNearest <= HiZ_UpdateBlock(bx, by))
+                    continue;
+
+                // Some of the block may be visible, check the tiles within it
+                int bty1 = std::max(ty1, by << HIZ_BLOCK_SHIFT), bty2 = std::min(ty2, ((by + 1) << HIZ_BLOCK_SHIFT) - 1);
+                int btx1 = std::max(tx1, bx << HIZ_BLOCK_SHIFT), btx2 = std::min(tx2, ((bx + 1) << HIZ_BLOCK_SHIFT) - 1);
+                for (int ty = bty1; ty <= bty2; ty++)
+                    for (int tx = btx1; tx <= btx2; tx++)
+                        if (fNearest > HiZ_UpdateTile(tx, ty))
+                            return false;
+            }
+        }
+
+        return true;
+    }
+
+    void GFX3D::DrawTriangleTex(olc::GFX3D::triangle &tri, olc::Sprite *spr)
+    {
+        if (tri.p[1].y < tri.p[0].y)
+        {
+            std::swap(tri.p[0].y, tri.p[1].y);
+            std::swap(tri.p[0].x, tri.p[1].x);
+            std::swap(tri.t[0].x, tri.t[1].x);
+            std::swap(tri.t[0].y, tri.t[1].y);
+            std::swap(tri.t[0].z, tri.t[1].z);
+        }
+
+        if (tri.p[2].y < tri.p[0].y)
+        {
             std::swap(tri.p[0].y, tri.p[2].y);
             std::swap(tri.p[0].x, tri.p[2].x);
             std::swap(tri.t[0].x, tri.t[2].x);
@@ -762,396 +2812,1635 @@ namespace olc
             std::swap(tri.t[0].z, tri.t[2].z);
         }
 
-        if (tri.p[2].y < tri.p[1].y)
+        if (tri.p[2].y < tri.p[1].y)
+        {
+            std::swap(tri.p[1].y, tri.p[2].y);
+            std::swap(tri.p[1].x, tri.p[2].x);
+            std::swap(tri.t[1].x, tri.t[2].x);
+            std::swap(tri.t[1].y, tri.t[2].y);
+            std::swap(tri.t[1].z, tri.t[2].z);
+        }
+
+        int dy1 = tri.p[1].y - tri.p[0].y;
+        int dx1 = tri.p[1].x - tri.p[0].x;
+        float dv1 = tri.t[1].y - tri.t[0].y;
+        float du1 = tri.t[1].x - tri.t[0].x;
+        float dz1 = tri.t[1].z - tri.t[0].z;
+
+        int dy2 = tri.p[2].y - tri.p[0].y;
+        int dx2 = tri.p[2].x - tri.p[0].x;
+        float dv2 = tri.t[2].y - tri.t[0].y;
+        float du2 = tri.t[2].x - tri.t[0].x;
+        float dz2 = tri.t[2].z - tri.t[0].z;
+
+        float tex_x, tex_y, tex_z;
+
+        float du1_step = 0, dv1_step = 0, du2_step = 0, dv2_step = 0, dz1_step = 0, dz2_step = 0;
+        float dax_step = 0, dbx_step = 0;
+
+        if (dy1)
+            dax_step = dx1 / (float)abs(dy1);
+        if (dy2)
+            dbx_step = dx2 / (float)abs(dy2);
+
+        if (dy1)
+            du1_step = du1 / (float)abs(dy1);
+        if (dy1)
+            dv1_step = dv1 / (float)abs(dy1);
+        if (dy1)
+            dz1_step = dz1 / (float)abs(dy1);
+
+        if (dy2)
+            du2_step = du2 / (float)abs(dy2);
+        if (dy2)
+            dv2_step = dv2 / (float)abs(dy2);
+        if (dy2)
+            dz2_step = dz2 / (float)abs(dy2);
+
+        if (dy1)
+        {
+            for (int i = tri.p[0].y; i <= tri.p[1].y; i++)
+            {
+                int ax = tri.p[0].x + (i - tri.p[0].y) * dax_step;
+                int bx = tri.p[0].x + (i - tri.p[0].y) * dbx_step;
+
+                // Start and end points in texture space
+                float tex_su = tri.t[0].x + (float)(i - tri.p[0].y) * du1_step;
+                float tex_sv = tri.t[0].y + (float)(i - tri.p[0].y) * dv1_step;
+                float tex_sz = tri.t[0].z + (float)(i - tri.p[0].y) * dz1_step;
+
+                float tex_eu = tri.t[0].x + (float)(i - tri.p[0].y) * du2_step;
+                float tex_ev = tri.t[0].y + (float)(i - tri.p[0].y) * dv2_step;
+                float tex_ez = tri.t[0].z + (float)(i - tri.p[0].y) * dz2_step;
+
+                if (ax > bx)
+                {
+                    std::swap(ax, bx);
+                    std::swap(tex_su, tex_eu);
+                    std::swap(tex_sv, tex_ev);
+                    std::swap(tex_sz, tex_ez);
+                }
+
+                tex_x = tex_su;
+                tex_y = tex_sv;
+                tex_z = tex_sz;
+
+                float tstep = 1.0f / ((float)(bx - ax));
+                float t = 0;
+
+                for (int j = ax; j < bx; j++)
+                {
+                    tex_x = (1.0f - t) * tex_su + t * tex_eu;
+                    tex_y = (1.0f - t) * tex_sv + t * tex_ev;
+                    tex_z = (1.0f - t) * tex_sz + t * tex_ez;
+
+                    if (Depth_TestAndWrite(j, i, tex_z))
+                        pge->Draw(j, i, spr->Sample(tex_x / tex_z, tex_y / tex_z));
+                    t += tstep;
+                }
+            }
+        }
+
+        dy1 = tri.p[2].y - tri.p[1].y;
+        dx1 = tri.p[2].x - tri.p[1].x;
+        dv1 = tri.t[2].y - tri.t[1].y;
+        du1 = tri.t[2].x - tri.t[1].x;
+        dz1 = tri.t[2].z - tri.t[1].z;
+
+        if (dy1)
+            dax_step = dx1 / (float)abs(dy1);
+        if (dy2)
+            dbx_step = dx2 / (float)abs(dy2);
+
+        du1_step = 0, dv1_step = 0; // , dz1_step = 0;// , du2_step = 0, dv2_step = 0;
+        if (dy1)
+            du1_step = du1 / (float)abs(dy1);
+        if (dy1)
+            dv1_step = dv1 / (float)abs(dy1);
+        if (dy1)
+            dz1_step = dz1 / (float)abs(dy1);
+
+        if (dy1)
+        {
+            for (int i = tri.p[1].y; i <= tri.p[2].y; i++)
+            {
+                int ax = tri.p[1].x + (i - tri.p[1].y) * dax_step;
+                int bx = tri.p[0].x + (i - tri.p[0].y) * dbx_step;
+
+                // Start and end points in texture space
+                float tex_su = tri.t[1].x + (float)(i - tri.p[1].y) * du1_step;
+                float tex_sv = tri.t[1].y + (float)(i - tri.p[1].y) * dv1_step;
+                float tex_sz = tri.t[1].z + (float)(i - tri.p[1].y) * dz1_step;
+
+                float tex_eu = tri.t[0].x + (float)(i - tri.p[0].y) * du2_step;
+                float tex_ev = tri.t[0].y + (float)(i - tri.p[0].y) * dv2_step;
+                float tex_ez = tri.t[0].z + (float)(i - tri.p[0].y) * dz2_step;
+
+                if (ax > bx)
+                {
+                    std::swap(ax, bx);
+                    std::swap(tex_su, tex_eu);
+                    std::swap(tex_sv, tex_ev);
+                    std::swap(tex_sz, tex_ez);
+                }
+
+                tex_x = tex_su;
+                tex_y = tex_sv;
+                tex_z = tex_sz;
+
+                float tstep = 1.0f / ((float)(bx - ax));
+                float t = 0;
+
+                for (int j = ax; j < bx; j++)
+                {
+                    tex_x = (1.0f - t) * tex_su + t * tex_eu;
+                    tex_y = (1.0f - t) * tex_sv + t * tex_ev;
+                    tex_z = (1.0f - t) * tex_sz + t * tex_ez;
+
+                    if (Depth_TestAndWrite(j, i, tex_z))
+                        pge->Draw(j, i, spr->Sample(tex_x / tex_z, tex_y / tex_z));
+
+                    t += tstep;
+                }
+            }
+        }
+    }
+
+    float *GFX3D::m_DepthBuffer = nullptr;
+    uint16_t *GFX3D::m_DepthBuffer16 = nullptr;
+    uint8_t *GFX3D::m_DepthTileCleared = nullptr;
+    GFX3D::DEPTH_FORMAT GFX3D::m_nDepthFormat = GFX3D::DEPTH_FLOAT32;
+    float GFX3D::m_fDepthNear = 0.1f;
+    float GFX3D::m_fDepthScale16 = 0.0f;
+    int GFX3D::m_nDepthWidth = 0;
+    int GFX3D::m_nDepthHeight = 0;
+    int GFX3D::m_nPerspectiveSubdivision = 1;
+    bool GFX3D::m_bMipMapping = false;
+    float *GFX3D::m_HiZTiles = nullptr;
+    float *GFX3D::m_HiZBlocks = nullptr;
+    uint8_t *GFX3D::m_HiZTileDirty = nullptr;
+    uint8_t *GFX3D::m_HiZBlockDirty = nullptr;
+    int GFX3D::m_nHiZTilesX = 0;
+    int GFX3D::m_nHiZTilesY = 0;
+    int GFX3D::m_nHiZBlocksX = 0;
+    int GFX3D::m_nHiZBlocksY = 0;
+    int GFX3D::m_nScissorX1 = 0;
+    int GFX3D::m_nScissorY1 = 0;
+    int GFX3D::m_nScissorX2 = 0;
+    int GFX3D::m_nScissorY2 = 0;
+    const GFX3D::shadow_map *GFX3D::m_pShadowMap = nullptr;
+    olc::Pixel GFX3D::m_colShadow = olc::Pixel(96, 96, 96);
+    bool GFX3D::m_bShadowPCF = false;
+    float GFX3D::m_fShadowBias = 0.01f;
+    uint32_t GFX3D::m_nAlphaMode = 0;
+    uint8_t GFX3D::m_nAlphaReference = 128;
+    olc::Pixel *GFX3D::m_BlendRow = nullptr;
+
+    void GFX3D::ConfigureDisplay(DEPTH_FORMAT format, float fNear)
+    {
+        // May be called again, if the screen or format changes
+        delete[] m_DepthBuffer;
+        delete[] m_DepthBuffer16;
+        delete[] m_DepthTileCleared;
+        delete[] m_HiZTiles;
+        delete[] m_HiZBlocks;
+        delete[] m_HiZTileDirty;
+        delete[] m_HiZBlockDirty;
+        delete[] m_BlendRow;
+        m_DepthBuffer = nullptr;
+        m_DepthBuffer16 = nullptr;
+
+        m_nDepthFormat = format;
+        m_fDepthNear = fNear;
+        m_fDepthScale16 = 65535.0f * fNear;
+        m_nDepthWidth = pge->ScreenWidth();
+        m_nDepthHeight = pge->ScreenHeight();
+
+        m_nHiZTilesX = (pge->ScreenWidth() + (1 << HIZ_TILE_SHIFT) - 1) >> HIZ_TILE_SHIFT;
+        m_nHiZTilesY = (pge->ScreenHeight() + (1 << HIZ_TILE_SHIFT) - 1) >> HIZ_TILE_SHIFT;
+        m_nHiZBlocksX = (m_nHiZTilesX + (1 << HIZ_BLOCK_SHIFT) - 1) >> HIZ_BLOCK_SHIFT;
+        m_nHiZBlocksY = (m_nHiZTilesY + (1 << HIZ_BLOCK_SHIFT) - 1) >> HIZ_BLOCK_SHIFT;
+        m_HiZTiles = new float[m_nHiZTilesX * m_nHiZTilesY]{0};
+        m_HiZBlocks = new float[m_nHiZBlocksX * m_nHiZBlocksY]{0};
+        m_HiZTileDirty = new uint8_t[m_nHiZTilesX * m_nHiZTilesY]{0};
+        m_HiZBlockDirty = new uint8_t[m_nHiZBlocksX * m_nHiZBlocksY]{0};
+
+        // Whole tiles, so the edges are padded. Every tile starts out cleared
+        int nTiles = m_nHiZTilesX * m_nHiZTilesY;
+        if (format == DEPTH_UNORM16)
+            m_DepthBuffer16 = new uint16_t[nTiles << DEPTH_TILE_SHIFT];
+        else
+            m_DepthBuffer = new float[nTiles << DEPTH_TILE_SHIFT];
+        m_DepthTileCleared = new uint8_t[nTiles];
+        memset(m_DepthTileCleared, 1, nTiles);
+        m_BlendRow = new olc::Pixel[m_nDepthWidth];
+
+        SetScissor(0, 0, pge->ScreenWidth(), pge->ScreenHeight());
+    }
+
+    void GFX3D::SetScissor(int x, int y, int w, int h)
+    {
+        m_nScissorX1 = std::max(x, 0);
+        m_nScissorY1 = std::max(y, 0);
+        m_nScissorX2 = std::min(x + w, (int)pge->ScreenWidth());
+        m_nScissorY2 = std::min(y + h, (int)pge->ScreenHeight());
+    }
+
+    void GFX3D::IntersectScissor(int x, int y, int w, int h)
+    {
+        m_nScissorX1 = std::max(m_nScissorX1, x);
+        m_nScissorY1 = std::max(m_nScissorY1, y);
+        m_nScissorX2 = std::min(m_nScissorX2, x + w);
+        m_nScissorY2 = std::min(m_nScissorY2, y + h);
+    }
+
+    void GFX3D::SetPerspectiveSubdivision(int nPixels)
+    {
+        m_nPerspectiveSubdivision = std::max(nPixels, 1);
+    }
+
+    void GFX3D::SetAlphaReference(uint8_t nReference)
+    {
+        m_nAlphaReference = nReference;
+    }
+
+    void GFX3D::SetMipMapping(bool bEnable)
+    {
+        m_bMipMapping = bEnable;
+    }
+
+    void GFX3D::ClearDepth()
+    {
+        if (m_nDepthWidth != pge->ScreenWidth() || m_nDepthHeight != pge->ScreenHeight())
+        {
+            ConfigureDisplay(m_nDepthFormat, m_fDepthNear);
+            return;
+        }
+
+        memset(m_DepthTileCleared, 1, m_nHiZTilesX * m_nHiZTilesY);
+        memset(m_HiZTiles, 0, m_nHiZTilesX * m_nHiZTilesY * sizeof(float));
+        memset(m_HiZBlocks, 0, m_nHiZBlocksX * m_nHiZBlocksY * sizeof(float));
+        memset(m_HiZTileDirty, 0, m_nHiZTilesX * m_nHiZTilesY);
+        memset(m_HiZBlockDirty, 0, m_nHiZBlocksX * m_nHiZBlocksY);
+    }
+
+    GFX3D::PipeLine::PipeLine()
+    {
+    }
+
+    GFX3D::PipeLine::~PipeLine()
+    {
+        StopWorkers();
+    }
+
+    void GFX3D::PipeLine::SetThreadCount(uint32_t nThreads)
+    {
+        if (nThreads == 0)
+            nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        StopWorkers();
+        for (uint32_t i = 1; i < nThreads; i++)
+            vecWorkers.emplace_back(&PipeLine::WorkerThread, this);
+    }
+
+    void GFX3D::PipeLine::StopWorkers()
+    {
+        {
+            std::unique_lock<std::mutex> lock(muxJobs);
+            bWorkersQuit = true;
+        }
+        cvJobs.notify_all();
+        for (auto &t : vecWorkers)
+            t.join();
+        vecWorkers.clear();
+        bWorkersQuit = false;
+    }
+
+    void GFX3D::PipeLine::WorkerThread()
+    {
+        uint64_t nSeen = 0;
+        std::unique_lock<std::mutex> lock(muxJobs);
+        while (true)
         {
-            std::swap(tri.p[1].y, tri.p[2].y);
-            std::swap(tri.p[1].x, tri.p[2].x);
-            std::swap(tri.t[1].x, tri.t[2].x);
-            std::swap(tri.t[1].y, tri.t[2].y);
-            std::swap(tri.t[1].z, tri.t[2].z);
+            cvJobs.wait(lock, [&] { return bWorkersQuit || nJobGeneration != nSeen; });
+            if (bWorkersQuit)
+                return;
+
+            // While busy, RunJobs cant return, so the jobs stay valid
+            nSeen = nJobGeneration;
+            nWorkersBusy++;
+            const std::function<void(uint32_t)> *pFunc = pJobFunc;
+            uint32_t nJobs = nJobCount;
+            lock.unlock();
+
+            uint32_t nDone = 0;
+            for (uint32_t nJob; (nJob = nNextJob.fetch_add(1)) < nJobs; nDone++)
+                (*pFunc)(nJob);
+
+            lock.lock();
+            nJobsDone += nDone;
+            nWorkersBusy--;
+            if (nJobsDone == nJobCount && nWorkersBusy == 0)
+                cvJobsDone.notify_all();
         }
+    }
 
-        int dy1 = tri.p[1].y - tri.p[0].y;
-        int dx1 = tri.p[1].x - tri.p[0].x;
-        float dv1 = tri.t[1].y - tri.t[0].y;
-        float du1 = tri.t[1].x - tri.t[0].x;
-        float dz1 = tri.t[1].z - tri.t[0].z;
+    void GFX3D::PipeLine::RunJobs(uint32_t nJobs, const std::function<void(uint32_t)> &func)
+    {
+        if (nJobs < 2 || vecWorkers.empty())
+        {
+            for (uint32_t nJob = 0; nJob < nJobs; nJob++)
+                func(nJob);
+            return;
+        }
 
-        int dy2 = tri.p[2].y - tri.p[0].y;
-        int dx2 = tri.p[2].x - tri.p[0].x;
-        float dv2 = tri.t[2].y - tri.t[0].y;
-        float du2 = tri.t[2].x - tri.t[0].x;
-        float dz2 = tri.t[2].z - tri.t[0].z;
+        {
+            std::unique_lock<std::mutex> lock(muxJobs);
+            pJobFunc = &func;
+            nJobCount = nJobs;
+            nNextJob = 0;
+            nJobsDone = 0;
+            nJobGeneration++;
+        }
+        cvJobs.notify_all();
 
-        float tex_x, tex_y, tex_z;
+        // Help out rather than just waiting
+        uint32_t nDone = 0;
+        for (uint32_t nJob; (nJob = nNextJob.fetch_add(1)) < nJobs; nDone++)
+            func(nJob);
 
-        float du1_step = 0, dv1_step = 0, du2_step = 0, dv2_step = 0, dz1_step = 0, dz2_step = 0;
-        float dax_step = 0, dbx_step = 0;
+        std::unique_lock<std::mutex> lock(muxJobs);
+        nJobsDone += nDone;
+        cvJobsDone.wait(lock, [&] { return nJobsDone == nJobCount && nWorkersBusy == 0; });
+        pJobFunc = nullptr;
+    }
 
-        if (dy1)
-            dax_step = dx1 / (float)abs(dy1);
-        if (dy2)
-            dbx_step = dx2 / (float)abs(dy2);
+    void GFX3D::PipeLine::ProcessRanges(const std::vector<sRange> &ranges, const std::function<void(size_t, size_t, std::vector<sRasterTriangle> &)> &func)
+    {
+        size_t nTotal = 0;
+        for (auto &r : ranges)
+            nTotal += r.nCount;
+        stats.nTrianglesSubmitted += (uint32_t)nTotal;
 
-        if (dy1)
-            du1_step = du1 / (float)abs(dy1);
-        if (dy1)
-            dv1_step = dv1 / (float)abs(dy1);
-        if (dy1)
-            dz1_step = dz1 / (float)abs(dy1);
+        uint32_t nJobs = (uint32_t)std::min(vecWorkers.size() + 1, nTotal / MIN_TRIANGLES_PER_JOB);
+        if (nJobs < 2)
+        {
+            for (auto &r : ranges)
+                func(r.nFirst, r.nCount, vecTrianglesToRaster);
+            return;
+        }
+
+        if (vecJobTriangles.size() < nJobs)
+            vecJobTriangles.resize(nJobs);
+
+        RunJobs(nJobs, [&](uint32_t nJob) {
+            // This jobs share, counting through the ranges as if they were one
+            size_t nStart = nTotal * nJob / nJobs;
+            size_t nEnd = nTotal * (nJob + 1) / nJobs;
+            std::vector<sRasterTriangle> &vecOut = vecJobTriangles[nJob];
+            vecOut.clear();
+
+            size_t nOffset = 0;
+            for (auto &r : ranges)
+            {
+                size_t a = std::max(nStart, nOffset);
+                size_t b = std::min(nEnd, nOffset + r.nCount);
+                if (a < b)
+                    func(r.nFirst + (a - nOffset), b - a, vecOut);
+                nOffset += r.nCount;
+            }
+        });
+
+        for (uint32_t nJob = 0; nJob < nJobs; nJob++)
+            vecTrianglesToRaster.insert(vecTrianglesToRaster.end(), vecJobTriangles[nJob].begin(), vecJobTriangles[nJob].end());
+    }
+
+    void GFX3D::PipeLine::SetProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar, float fLeft, float fTop, float fWidth, float fHeight)
+    {
+        matProj = GFX3D::Math::Mat_MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
+        fViewX = fLeft;
+        fViewY = fTop;
+        fViewW = fWidth;
+        fViewH = fHeight;
+    }
+
+    void GFX3D::PipeLine::SetCamera(olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &lookat, olc::GFX3D::vec3d &up)
+    {
+        matView = GFX3D::Math::Mat_PointAt(pos, lookat, up);
+        matView = GFX3D::Math::Mat_QuickInverse(matView);
+    }
+
+    void GFX3D::PipeLine::SetTransform(olc::GFX3D::mat4x4 &transform)
+    {
+        matWorld = transform;
+    }
+
+    void GFX3D::PipeLine::SetTexture(olc::Sprite *texture)
+    {
+        sprTexture = texture;
+    }
+
+    void GFX3D::PipeLine::SetTextureArray(std::vector<olc::Sprite *> &textures)
+    {
+        vecTextures = textures;
+    }
+
+    void GFX3D::PipeLine::SetLightSource(uint32_t nSlot, uint32_t nType, olc::Pixel col, olc::GFX3D::vec3d pos, olc::GFX3D::vec3d dir, float fParam)
+    {
+        if (nSlot >= MAX_LIGHTS)
+            return;
+
+        sLight &light = lights[nSlot];
+        light.nType = nType;
+        light.r = (float)col.r / 255.0f;
+        light.g = (float)col.g / 255.0f;
+        light.b = (float)col.b / 255.0f;
+        light.pos = pos;
+        float l = Math::Vec_Length(dir);
+        light.dir = l > 0.0f ? Math::Vec_Div(dir, l) : dir;
+        light.fRange = fParam;
+    }
+
+    void GFX3D::PipeLine::PrepareLights()
+    {
+        nLightsView = 0;
+        for (auto &light : lights)
+        {
+            if (light.nType == LIGHT_DISABLED)
+                continue;
+
+            sLight &lv = lightsView[nLightsView++];
+            lv = light;
+            lv.pos.w = 1.0f;
+            lv.pos = Math::Mat_MultiplyVector(matView, lv.pos);
+
+            // Directions ignore the translation
+            vec3d d = light.dir;
+            d.w = 0.0f;
+            d = Math::Mat_MultiplyVector(matView, d);
+            float l = Math::Vec_Length(d);
+            lv.dir = l > 0.0f ? Math::Vec_Div(d, l) : d;
+        }
+    }
+
+    olc::GFX3D::mat4x4 GFX3D::PipeLine::MakeNormalMatrix(olc::GFX3D::mat4x4 &matWorldView)
+    {
+        mat4x4 matInv = Math::Mat_Inverse(matWorldView);
+        mat4x4 matNormal;
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                matNormal.m[r][c] = matInv.m[c][r];
+        return matNormal;
+    }
+
+    olc::GFX3D::vec3d GFX3D::PipeLine::TransformNormal(const olc::GFX3D::mat4x4 &matNormal, const olc::GFX3D::vec3d &n)
+    {
+        vec3d o;
+        o.x = n.x * matNormal.m[0][0] + n.y * matNormal.m[1][0] + n.z * matNormal.m[2][0];
+        o.y = n.x * matNormal.m[0][1] + n.y * matNormal.m[1][1] + n.z * matNormal.m[2][1];
+        o.z = n.x * matNormal.m[0][2] + n.y * matNormal.m[1][2] + n.z * matNormal.m[2][2];
+        float l = Math::Vec_Length(o);
+        return l > 0.0f ? Math::Vec_Div(o, l) : o;
+    }
+
+    void GFX3D::PipeLine::LightVertex(const olc::GFX3D::vec3d &n, const olc::GFX3D::vec3d &p, float &r, float &g, float &b)
+    {
+        r = g = b = 0.0f;
+        for (uint32_t i = 0; i < nLightsView; i++)
+        {
+            const sLight &light = lightsView[i];
+            float k = 1.0f;
+            if (light.nType == LIGHT_DIRECTIONAL)
+            {
+                k = std::max(0.0f, n.x * light.dir.x + n.y * light.dir.y + n.z * light.dir.z);
+            }
+            else if (light.nType == LIGHT_POINT)
+            {
+                float lx = light.pos.x - p.x, ly = light.pos.y - p.y, lz = light.pos.z - p.z;
+                float d = sqrtf(lx * lx + ly * ly + lz * lz);
+                k = d > 0.0f ? std::max(0.0f, (n.x * lx + n.y * ly + n.z * lz) / d) : 1.0f;
+                if (light.fRange > 0.0f)
+                    k *= std::max(0.0f, 1.0f - d / light.fRange);
+            }
+            r += light.r * k;
+            g += light.g * k;
+            b += light.b * k;
+        }
+        r = std::min(r, 1.0f);
+        g = std::min(g, 1.0f);
+        b = std::min(b, 1.0f);
+    }
+
+    void GFX3D::PipeLine::LightVertexStream(const olc::GFX3D::mat4x4 &matNormal, olc::GFX3D::mesh_indexed &mesh, size_t nFirst, size_t nCount)
+    {
+        size_t i = nFirst;
+        size_t nEnd = nFirst + nCount;
+
+#ifdef OLC_GFX3D_SSE
+        // Four vertices at a time, the same sums as LightVertex
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= nEnd; i += 4)
+        {
+            __m128 inx = _mm_loadu_ps(&mesh.nx[i]);
+            __m128 iny = _mm_loadu_ps(&mesh.ny[i]);
+            __m128 inz = _mm_loadu_ps(&mesh.nz[i]);
+            __m128 nx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(inx, _mm_set1_ps(matNormal.m[0][0])), _mm_mul_ps(iny, _mm_set1_ps(matNormal.m[1][0]))), _mm_mul_ps(inz, _mm_set1_ps(matNormal.m[2][0])));
+            __m128 ny = _mm_add_ps(_mm_add_ps(_mm_mul_ps(inx, _mm_set1_ps(matNormal.m[0][1])), _mm_mul_ps(iny, _mm_set1_ps(matNormal.m[1][1]))), _mm_mul_ps(inz, _mm_set1_ps(matNormal.m[2][1])));
+            __m128 nz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(inx, _mm_set1_ps(matNormal.m[0][2])), _mm_mul_ps(iny, _mm_set1_ps(matNormal.m[1][2]))), _mm_mul_ps(inz, _mm_set1_ps(matNormal.m[2][2])));
+
+            // Normalise, leaving zero length normals alone
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+            __m128 valid = _mm_cmpgt_ps(len, zero);
+            __m128 inv = _mm_and_ps(valid, _mm_div_ps(one, _mm_or_ps(len, _mm_andnot_ps(valid, one))));
+            nx = _mm_mul_ps(nx, inv);
+            ny = _mm_mul_ps(ny, inv);
+            nz = _mm_mul_ps(nz, inv);
+
+            __m128 px = _mm_loadu_ps(&vecCacheX[i]);
+            __m128 py = _mm_loadu_ps(&vecCacheY[i]);
+            __m128 pz = _mm_loadu_ps(&vecCacheZ[i]);
+
+            __m128 r = zero, g = zero, b = zero;
+            for (uint32_t l = 0; l < nLightsView; l++)
+            {
+                const sLight &light = lightsView[l];
+                __m128 k = one;
+                if (light.nType == LIGHT_DIRECTIONAL)
+                {
+                    k = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(light.dir.x)), _mm_mul_ps(ny, _mm_set1_ps(light.dir.y))), _mm_mul_ps(nz, _mm_set1_ps(light.dir.z)));
+                    k = _mm_max_ps(k, zero);
+                }
+                else if (light.nType == LIGHT_POINT)
+                {
+                    __m128 lx = _mm_sub_ps(_mm_set1_ps(light.pos.x), px);
+                    __m128 ly = _mm_sub_ps(_mm_set1_ps(light.pos.y), py);
+                    __m128 lz = _mm_sub_ps(_mm_set1_ps(light.pos.z), pz);
+                    __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz)));
+                    __m128 ndotl = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+                    __m128 apart = _mm_cmpgt_ps(d, zero);
+                    k = _mm_max_ps(_mm_div_ps(ndotl, _mm_or_ps(d, _mm_andnot_ps(apart, one))), zero);
+                    k = _mm_or_ps(_mm_and_ps(apart, k), _mm_andnot_ps(apart, one));
+                    if (light.fRange > 0.0f)
+                        k = _mm_mul_ps(k, _mm_max_ps(zero, _mm_sub_ps(one, _mm_div_ps(d, _mm_set1_ps(light.fRange)))));
+                }
+                r = _mm_add_ps(r, _mm_mul_ps(k, _mm_set1_ps(light.r)));
+                g = _mm_add_ps(g, _mm_mul_ps(k, _mm_set1_ps(light.g)));
+                b = _mm_add_ps(b, _mm_mul_ps(k, _mm_set1_ps(light.b)));
+            }
+
+            _mm_storeu_ps(&vecLitR[i], _mm_min_ps(r, one));
+            _mm_storeu_ps(&vecLitG[i], _mm_min_ps(g, one));
+            _mm_storeu_ps(&vecLitB[i], _mm_min_ps(b, one));
+        }
+#endif
+
+        for (; i < nEnd; i++)
+        {
+            vec3d n = TransformNormal(matNormal, {mesh.nx[i], mesh.ny[i], mesh.nz[i]});
+            vec3d p = {vecCacheX[i], vecCacheY[i], vecCacheZ[i]};
+            LightVertex(n, p, vecLitR[i], vecLitG[i], vecLitB[i]);
+        }
+    }
+
+    void GFX3D::PipeLine::SetLODThreshold(float fPixels)
+    {
+        fLODThreshold = fPixels;
+    }
+
+    const GFX3D::PipeLine::sStats &GFX3D::PipeLine::GetStats() const
+    {
+        return stats;
+    }
+
+    void GFX3D::PipeLine::ResetStats()
+    {
+        stats = sStats();
+    }
+
+    void GFX3D::PipeLine::ExtractFrustum(olc::GFX3D::mat4x4 &matWorldViewProj, sFrustum &frustum)
+    {
+        // Points are row vectors, so each clip space component is a dot product with
+        // a column of the matrix. The planes follow directly from -w <= x <= w,
+        // -w <= y <= w and 0 <= z <= w, and as the matrix includes the world
+        // transform, they come out in object space.
+        auto &m = matWorldViewProj.m;
+        auto SetPlane = [&](int n, int c, float s) {
+            for (int r = 0; r < 4; r++)
+                frustum.p[n][r] = m[r][3] + s * m[r][c];
+        };
+
+        SetPlane(0, 0, +1.0f); // Left
+        SetPlane(1, 0, -1.0f); // Right
+        SetPlane(2, 1, +1.0f); // Bottom
+        SetPlane(3, 1, -1.0f); // Top
+        SetPlane(5, 2, -1.0f); // Far
+        for (int r = 0; r < 4; r++)
+            frustum.p[4][r] = m[r][2]; // Near
+
+        // Normalise so the sphere test can use real distances
+        for (auto &p : frustum.p)
+        {
+            float l = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            if (l > 0.0f)
+                for (int r = 0; r < 4; r++)
+                    p[r] /= l;
+        }
+    }
+
+    GFX3D::PipeLine::FRUSTUM_TEST GFX3D::PipeLine::TestBounds(const sFrustum &frustum, const olc::GFX3D::bounding_volume &bounds)
+    {
+        // The sphere test is cheap, and usually decisive
+        bool bIntersects = false;
+        for (auto &p : frustum.p)
+        {
+            float d = p[0] * bounds.vCentre.x + p[1] * bounds.vCentre.y + p[2] * bounds.vCentre.z + p[3];
+            if (d < -bounds.fRadius)
+                return FRUSTUM_OUTSIDE;
+            if (d < bounds.fRadius)
+                bIntersects = true;
+        }
+
+        if (!bIntersects)
+            return FRUSTUM_INSIDE;
+
+        // Sphere straddles a plane, so refine with the box. Test the corner
+        // furthest along each plane normal, then the nearest corner
+        bool bAllInside = true;
+        for (auto &p : frustum.p)
+        {
+            float fx = p[0] >= 0.0f ? bounds.vMax.x : bounds.vMin.x;
+            float fy = p[1] >= 0.0f ? bounds.vMax.y : bounds.vMin.y;
+            float fz = p[2] >= 0.0f ? bounds.vMax.z : bounds.vMin.z;
+            if (p[0] * fx + p[1] * fy + p[2] * fz + p[3] < 0.0f)
+                return FRUSTUM_OUTSIDE;
+
+            float nx = p[0] >= 0.0f ? bounds.vMin.x : bounds.vMax.x;
+            float ny = p[1] >= 0.0f ? bounds.vMin.y : bounds.vMax.y;
+            float nz = p[2] >= 0.0f ? bounds.vMin.z : bounds.vMax.z;
+            if (p[0] * nx + p[1] * ny + p[2] * nz + p[3] < 0.0f)
+                bAllInside = false;
+        }
+
+        return bAllInside ? FRUSTUM_INSIDE : FRUSTUM_INTERSECT;
+    }
+
+    GFX3D::PipeLine::FRUSTUM_TEST GFX3D::PipeLine::TestInstance(const sFrustum &frustum, const olc::GFX3D::bounding_volume &bounds, olc::GFX3D::mat4x4 &matInstance)
+    {
+        // Move the sphere into world space, growing it by the largest scale in the transform
+        auto &m = matInstance.m;
+        vec3d c = GFX3D::Math::Mat_MultiplyVector(matInstance, const_cast<vec3d &>(bounds.vCentre));
+        float fScale2 = std::max({m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2],
+                                  m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2],
+                                  m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2]});
+        float fRadius = bounds.fRadius * sqrtf(fScale2);
+
+        FRUSTUM_TEST nTest = FRUSTUM_INSIDE;
+        for (auto &p : frustum.p)
+        {
+            float d = p[0] * c.x + p[1] * c.y + p[2] * c.z + p[3];
+            if (d < -fRadius)
+                return FRUSTUM_OUTSIDE;
+            if (d < fRadius)
+                nTest = FRUSTUM_INTERSECT;
+        }
+        return nTest;
+    }
+
+    uint32_t GFX3D::PipeLine::SelectLOD(const olc::GFX3D::mesh_lod &mesh, olc::GFX3D::mat4x4 &matInstance)
+    {
+        // The nearest point of the bounding sphere decides the scale on screen
+        const bounding_volume &bounds = mesh.levels[0].bounds;
+        auto &m = matInstance.m;
+        float fScale = sqrtf(std::max({m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2],
+                                       m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2],
+                                       m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2]}));
+        mat4x4 matWorldView = Math::Mat_MultiplyMatrix(matInstance, matView);
+        vec3d c = Math::Mat_MultiplyVector(matWorldView, const_cast<vec3d &>(bounds.vCentre));
+        float fDepth = c.z - bounds.fRadius * fScale;
+        if (fDepth <= 0.0f)
+            return 0;
+
+        // Pixels covered by one object space unit at that depth
+        float fPixelsPerUnit = fScale * matProj.m[1][1] * 0.5f * fViewH / fDepth;
+        for (uint32_t i = (uint32_t)mesh.levels.size() - 1; i > 0; i--)
+            if (mesh.fError[i] * fPixelsPerUnit <= fLODThreshold)
+                return i;
+        return 0;
+    }
+
+    olc::Sprite *GFX3D::PipeLine::GetInstanceTexture(const olc::GFX3D::instance &inst)
+    {
+        if (inst.nTexture < vecTextures.size())
+            return vecTextures[inst.nTexture];
+        return sprTexture;
+    }
+
+    void GFX3D::PipeLine::ProcessTriangles(std::vector<olc::GFX3D::triangle> &triangles, const std::vector<olc::GFX3D::vec3d> *pNormals, const olc::GFX3D::mat4x4 &matNormal,
+                                           size_t nFirst, size_t nCount, olc::GFX3D::mat4x4 &matWorldView, olc::Pixel tint, uint32_t flags,
+                                           std::vector<sRasterTriangle> &vecOut)
+    {
+        bool bLit = (flags & RENDER_LIGHTS) != 0;
+
+        // Process Triangles
+        for (size_t i = nFirst; i < nFirst + nCount; i++)
+        {
+            GFX3D::triangle &tri = triangles[i];
+            GFX3D::triangle triTransformed;
+
+            // Just copy through texture coordinates
+            triTransformed.t[0] = {tri.t[0].x, tri.t[0].y, tri.t[0].z};
+            triTransformed.t[1] = {tri.t[1].x, tri.t[1].y, tri.t[1].z};
+            triTransformed.t[2] = {tri.t[2].x, tri.t[2].y, tri.t[2].z}; // Think!
+
+            // Transform Triangle from object into projected space
+            triTransformed.p[0] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[0]);
+            triTransformed.p[1] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[1]);
+            triTransformed.p[2] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[2]);
+
+            // If Lighting, calculate shading, once for the whole face at its centre.
+            // Without precomputed normals it has to be found from the triangle
+            triTransformed.col = tint;
+            if (bLit)
+            {
+                vec3d normal;
+                if (pNormals)
+                    normal = TransformNormal(matNormal, (*pNormals)[i]);
+                else
+                {
+                    vec3d line1 = GFX3D::Math::Vec_Sub(triTransformed.p[1], triTransformed.p[0]);
+                    vec3d line2 = GFX3D::Math::Vec_Sub(triTransformed.p[2], triTransformed.p[0]);
+                    normal = GFX3D::Math::Vec_CrossProduct(line1, line2);
+                    float l = GFX3D::Math::Vec_Length(normal);
+                    if (l > 0.0f)
+                        normal = GFX3D::Math::Vec_Div(normal, l);
+                }
+
+                vec3d centre = {(triTransformed.p[0].x + triTransformed.p[1].x + triTransformed.p[2].x) / 3.0f,
+                                (triTransformed.p[0].y + triTransformed.p[1].y + triTransformed.p[2].y) / 3.0f,
+                                (triTransformed.p[0].z + triTransformed.p[1].z + triTransformed.p[2].z) / 3.0f};
+                float r, g, b;
+                LightVertex(normal, centre, r, g, b);
+                triTransformed.col = ModulateColour(tint, olc::Pixel((uint8_t)(r * 255.0f), (uint8_t)(g * 255.0f), (uint8_t)(b * 255.0f)));
+            }
+
+            ProcessTriangle(triTransformed, flags, vecOut);
+        }
+    }
+
+    void GFX3D::PipeLine::ProcessMesh(olc::GFX3D::mesh &mesh, olc::GFX3D::mat4x4 &matWorldView, const sFrustum &frustum, FRUSTUM_TEST nTest, olc::Pixel tint, uint32_t flags)
+    {
+        const std::vector<vec3d> *pNormals = mesh.normals.size() < mesh.tris.size() ? nullptr : &mesh.normals;
+        mat4x4 matNormal;
+        if ((flags & RENDER_LIGHTS) && pNormals)
+            matNormal = MakeNormalMatrix(matWorldView);
+
+        // If it is only partially visible, its chunks may be rejected individually
+        vecRanges.clear();
+        if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+        {
+            for (auto &chunk : mesh.chunks)
+            {
+                if (TestBounds(frustum, chunk.bounds) == FRUSTUM_OUTSIDE)
+                    stats.nChunksCulled++;
+                else
+                    vecRanges.push_back({chunk.nFirst, chunk.nCount});
+            }
+        }
+        else
+            vecRanges.push_back({0, mesh.tris.size()});
+
+        ProcessRanges(vecRanges, [&](size_t nFirst, size_t nCount, std::vector<sRasterTriangle> &vecOut) {
+            ProcessTriangles(mesh.tris, pNormals, matNormal, nFirst, nCount, matWorldView, tint, flags, vecOut);
+        });
+    }
+
+    void GFX3D::PipeLine::ProcessMesh(olc::GFX3D::mesh_indexed &mesh, olc::GFX3D::mat4x4 &matWorldView, const sFrustum &frustum, FRUSTUM_TEST nTest, olc::Pixel tint, uint32_t flags)
+    {
+        // Transform every unique vertex exactly once into the post-transform cache
+        size_t nVertices = mesh.px.size();
+        if (vecCacheX.size() < nVertices)
+        {
+            vecCacheX.resize(nVertices);
+            vecCacheY.resize(nVertices);
+            vecCacheZ.resize(nVertices);
+            vecCacheW.resize(nVertices);
+        }
+
+        // Light every vertex while the cache is warm, triangles then interpolate it.
+        // Meshes without vertex normals are just left unlit
+        bool bLit = (flags & RENDER_LIGHTS) && mesh.nx.size() == nVertices && nVertices > 0;
+        mat4x4 matNormal;
+        if (bLit)
+        {
+            matNormal = MakeNormalMatrix(matWorldView);
+            if (vecLitR.size() < nVertices)
+            {
+                vecLitR.resize(nVertices);
+                vecLitG.resize(nVertices);
+                vecLitB.resize(nVertices);
+            }
+        }
+
+        // Large meshes have their vertices split between threads
+        uint32_t nVertexJobs = (uint32_t)std::max((size_t)1, std::min(vecWorkers.size() + 1, nVertices / MIN_VERTICES_PER_JOB));
+        RunJobs(nVertexJobs, [&](uint32_t nJob) {
+            size_t nStart = nVertices * nJob / nVertexJobs;
+            size_t nCount = nVertices * (nJob + 1) / nVertexJobs - nStart;
+            GFX3D::Math::Mat_MultiplyVectorStream(matWorldView, mesh.px.data() + nStart, mesh.py.data() + nStart, mesh.pz.data() + nStart, nCount,
+                                                  vecCacheX.data() + nStart, vecCacheY.data() + nStart, vecCacheZ.data() + nStart, vecCacheW.data() + nStart);
+            if (bLit)
+                LightVertexStream(matNormal, mesh, nStart, nCount);
+        });
+
+        bool bTint = tint != olc::WHITE;
+
+        // Assemble triangles from the cache
+        auto ProcessRange = [&](size_t nFirst, size_t nCount, std::vector<sRasterTriangle> &vecOut) {
+            for (size_t i = nFirst * 3; i < (nFirst + nCount) * 3; i += 3)
+            {
+                GFX3D::triangle triTransformed;
+
+                for (int n = 0; n < 3; n++)
+                {
+                    uint32_t v = mesh.indices[i + n];
+                    triTransformed.p[n] = {vecCacheX[v], vecCacheY[v], vecCacheZ[v], vecCacheW[v]};
+                    triTransformed.t[n] = {mesh.u[v], mesh.v[v]};
+                }
+
+                triTransformed.col = mesh.col[mesh.indices[i]];
+                if (bTint)
+                    triTransformed.col = ModulateColour(triTransformed.col, tint);
+
+                if (bLit)
+                {
+                    olc::Pixel shade[3];
+                    for (int n = 0; n < 3; n++)
+                    {
+                        uint32_t v = mesh.indices[i + n];
+                        olc::Pixel light((uint8_t)(vecLitR[v] * 255.0f), (uint8_t)(vecLitG[v] * 255.0f), (uint8_t)(vecLitB[v] * 255.0f));
+                        shade[n] = ModulateColour(triTransformed.col, light);
+                    }
+                    triTransformed.col = shade[0];
+                    ProcessTriangle(triTransformed, flags, vecOut, shade);
+                }
+                else
+                    ProcessTriangle(triTransformed, flags, vecOut);
+            }
+        };
+
+        // If it is only partially visible, its chunks may be rejected individually
+        vecRanges.clear();
+        if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+        {
+            for (auto &chunk : mesh.chunks)
+            {
+                if (TestBounds(frustum, chunk.bounds) == FRUSTUM_OUTSIDE)
+                    stats.nChunksCulled++;
+                else
+                    vecRanges.push_back({chunk.nFirst, chunk.nCount});
+            }
+        }
+        else
+            vecRanges.push_back({0, mesh.indices.size() / 3});
+
+        ProcessRanges(vecRanges, ProcessRange);
+    }
+
+    uint32_t GFX3D::PipeLine::Render(std::vector<olc::GFX3D::triangle> &triangles, uint32_t flags)
+    {
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
+
+        // Calculate Transformation Matrix
+        mat4x4 matWorldView = Math::Mat_MultiplyMatrix(matWorld, matView);
+        //matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+
+        sprBatch = sprTexture;
+        mat4x4 matNormal;
+        vecRanges.clear();
+        vecRanges.push_back({0, triangles.size()});
+        ProcessRanges(vecRanges, [&](size_t nFirst, size_t nCount, std::vector<sRasterTriangle> &vecOut) {
+            ProcessTriangles(triangles, nullptr, matNormal, nFirst, nCount, matWorldView, olc::WHITE, flags, vecOut);
+        });
+        return RasterTriangles(flags);
+    }
+
+    uint32_t GFX3D::PipeLine::Render(olc::GFX3D::mesh &mesh, uint32_t flags)
+    {
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
+
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
+
+        stats.nMeshesSubmitted++;
+
+        // Calculate Transformation Matrices
+        mat4x4 matWorldView = Math::Mat_MultiplyMatrix(matWorld, matView);
+        mat4x4 matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+
+        // Reject the whole mesh if it cant be seen
+        sFrustum frustum;
+        ExtractFrustum(matWorldViewProj, frustum);
+        FRUSTUM_TEST nTest = TestBounds(frustum, mesh.bounds);
+        if (nTest == FRUSTUM_OUTSIDE)
+        {
+            stats.nMeshesCulled++;
+            return 0;
+        }
+
+        sprBatch = sprTexture;
+        ProcessMesh(mesh, matWorldView, frustum, nTest, olc::WHITE, flags);
+        return RasterTriangles(flags);
+    }
+
+    uint32_t GFX3D::PipeLine::Render(olc::GFX3D::mesh_indexed &mesh, uint32_t flags)
+    {
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
+
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
 
-        if (dy2)
-            du2_step = du2 / (float)abs(dy2);
-        if (dy2)
-            dv2_step = dv2 / (float)abs(dy2);
-        if (dy2)
-            dz2_step = dz2 / (float)abs(dy2);
+        stats.nMeshesSubmitted++;
 
-        if (dy1)
+        // Calculate Transformation Matrices
+        mat4x4 matWorldView = Math::Mat_MultiplyMatrix(matWorld, matView);
+        mat4x4 matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+
+        // Reject the whole mesh before touching any vertices if it cant be seen
+        sFrustum frustum;
+        ExtractFrustum(matWorldViewProj, frustum);
+        FRUSTUM_TEST nTest = TestBounds(frustum, mesh.bounds);
+        if (nTest == FRUSTUM_OUTSIDE)
         {
-            for (int i = tri.p[0].y; i <= tri.p[1].y; i++)
-            {
-                int ax = tri.p[0].x + (i - tri.p[0].y) * dax_step;
-                int bx = tri.p[0].x + (i - tri.p[0].y) * dbx_step;
+            stats.nMeshesCulled++;
+            return 0;
+        }
 
-                // Start and end points in texture space
-                float tex_su = tri.t[0].x + (float)(i - tri.p[0].y) * du1_step;
-                float tex_sv = tri.t[0].y + (float)(i - tri.p[0].y) * dv1_step;
-                float tex_sz = tri.t[0].z + (float)(i - tri.p[0].y) * dz1_step;
+        sprBatch = sprTexture;
+        ProcessMesh(mesh, matWorldView, frustum, nTest, olc::WHITE, flags);
+        return RasterTriangles(flags);
+    }
 
-                float tex_eu = tri.t[0].x + (float)(i - tri.p[0].y) * du2_step;
-                float tex_ev = tri.t[0].y + (float)(i - tri.p[0].y) * dv2_step;
-                float tex_ez = tri.t[0].z + (float)(i - tri.p[0].y) * dz2_step;
+    uint32_t GFX3D::PipeLine::RenderInstanced(olc::GFX3D::mesh &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags)
+    {
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
 
-                if (ax > bx)
-                {
-                    std::swap(ax, bx);
-                    std::swap(tex_su, tex_eu);
-                    std::swap(tex_sv, tex_ev);
-                    std::swap(tex_sz, tex_ez);
-                }
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
 
-                tex_x = tex_su;
-                tex_y = tex_sv;
-                tex_z = tex_sz;
+        stats.nMeshesSubmitted++;
 
-                float tstep = 1.0f / ((float)(bx - ax));
-                float t = 0;
+        // The view frustum in world space is shared by all instances
+        mat4x4 matViewProj = Math::Mat_MultiplyMatrix(matView, matProj);
+        sFrustum frustumWorld, frustum;
+        ExtractFrustum(matViewProj, frustumWorld);
 
-                for (int j = ax; j < bx; j++)
-                {
-                    tex_x = (1.0f - t) * tex_su + t * tex_eu;
-                    tex_y = (1.0f - t) * tex_sv + t * tex_ev;
-                    tex_z = (1.0f - t) * tex_sz + t * tex_ez;
+        for (auto &inst : instances)
+        {
+            stats.nInstancesSubmitted++;
 
-                    if (tex_z > m_DepthBuffer[i * pge->ScreenWidth() + j])
-                    {
-                        pge->Draw(j, i, spr->Sample(tex_x / tex_z, tex_y / tex_z));
-                        m_DepthBuffer[i * pge->ScreenWidth() + j] = tex_z;
-                    }
-                    t += tstep;
-                }
+            FRUSTUM_TEST nTest = TestInstance(frustumWorld, mesh.bounds, inst.matWorld);
+            if (nTest == FRUSTUM_OUTSIDE)
+            {
+                stats.nInstancesCulled++;
+                continue;
             }
+
+            mat4x4 matWorldView = Math::Mat_MultiplyMatrix(inst.matWorld, matView);
+
+            // Chunks need the frustum in this instances object space
+            if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+            {
+                mat4x4 matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+                ExtractFrustum(matWorldViewProj, frustum);
+            }
+
+            sprBatch = GetInstanceTexture(inst);
+            ProcessMesh(mesh, matWorldView, frustum, nTest, inst.tint, flags);
         }
 
-        dy1 = tri.p[2].y - tri.p[1].y;
-        dx1 = tri.p[2].x - tri.p[1].x;
-        dv1 = tri.t[2].y - tri.t[1].y;
-        du1 = tri.t[2].x - tri.t[1].x;
-        dz1 = tri.t[2].z - tri.t[1].z;
+        return RasterTriangles(flags);
+    }
 
-        if (dy1)
-            dax_step = dx1 / (float)abs(dy1);
-        if (dy2)
-            dbx_step = dx2 / (float)abs(dy2);
+    uint32_t GFX3D::PipeLine::RenderInstanced(olc::GFX3D::mesh_indexed &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags)
+    {
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
 
-        du1_step = 0, dv1_step = 0; // , dz1_step = 0;// , du2_step = 0, dv2_step = 0;
-        if (dy1)
-            du1_step = du1 / (float)abs(dy1);
-        if (dy1)
-            dv1_step = dv1 / (float)abs(dy1);
-        if (dy1)
-            dz1_step = dz1 / (float)abs(dy1);
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
 
-        if (dy1)
+        stats.nMeshesSubmitted++;
+
+        // The view frustum in world space is shared by all instances
+        mat4x4 matViewProj = Math::Mat_MultiplyMatrix(matView, matProj);
+        sFrustum frustumWorld, frustum;
+        ExtractFrustum(matViewProj, frustumWorld);
+
+        for (auto &inst : instances)
         {
-            for (int i = tri.p[1].y; i <= tri.p[2].y; i++)
+            stats.nInstancesSubmitted++;
+
+            FRUSTUM_TEST nTest = TestInstance(frustumWorld, mesh.bounds, inst.matWorld);
+            if (nTest == FRUSTUM_OUTSIDE)
             {
-                int ax = tri.p[1].x + (i - tri.p[1].y) * dax_step;
-                int bx = tri.p[0].x + (i - tri.p[0].y) * dbx_step;
+                stats.nInstancesCulled++;
+                continue;
+            }
 
-                // Start and end points in texture space
-                float tex_su = tri.t[1].x + (float)(i - tri.p[1].y) * du1_step;
-                float tex_sv = tri.t[1].y + (float)(i - tri.p[1].y) * dv1_step;
-                float tex_sz = tri.t[1].z + (float)(i - tri.p[1].y) * dz1_step;
+            mat4x4 matWorldView = Math::Mat_MultiplyMatrix(inst.matWorld, matView);
 
-                float tex_eu = tri.t[0].x + (float)(i - tri.p[0].y) * du2_step;
-                float tex_ev = tri.t[0].y + (float)(i - tri.p[0].y) * dv2_step;
-                float tex_ez = tri.t[0].z + (float)(i - tri.p[0].y) * dz2_step;
+            // Chunks need the frustum in this instances object space
+            if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+            {
+                mat4x4 matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+                ExtractFrustum(matWorldViewProj, frustum);
+            }
 
-                if (ax > bx)
-                {
-                    std::swap(ax, bx);
-                    std::swap(tex_su, tex_eu);
-                    std::swap(tex_sv, tex_ev);
-                    std::swap(tex_sz, tex_ez);
-                }
+            sprBatch = GetInstanceTexture(inst);
+            ProcessMesh(mesh, matWorldView, frustum, nTest, inst.tint, flags);
+        }
 
-                tex_x = tex_su;
-                tex_y = tex_sv;
-                tex_z = tex_sz;
+        return RasterTriangles(flags);
+    }
 
-                float tstep = 1.0f / ((float)(bx - ax));
-                float t = 0;
+    uint32_t GFX3D::PipeLine::Render(olc::GFX3D::mesh_lod &mesh, uint32_t flags)
+    {
+        if (mesh.levels.empty())
+            return 0;
+        return Render(mesh.levels[SelectLOD(mesh, matWorld)], flags);
+    }
 
-                for (int j = ax; j < bx; j++)
-                {
-                    tex_x = (1.0f - t) * tex_su + t * tex_eu;
-                    tex_y = (1.0f - t) * tex_sv + t * tex_ev;
-                    tex_z = (1.0f - t) * tex_sz + t * tex_ez;
+    uint32_t GFX3D::PipeLine::RenderInstanced(olc::GFX3D::mesh_lod &mesh, std::vector<olc::GFX3D::instance> &instances, uint32_t flags)
+    {
+        if (mesh.levels.empty())
+            return 0;
 
-                    if (tex_z > m_DepthBuffer[i * pge->ScreenWidth() + j])
-                    {
-                        pge->Draw(j, i, spr->Sample(tex_x / tex_z, tex_y / tex_z));
-                        m_DepthBuffer[i * pge->ScreenWidth() + j] = tex_z;
-                    }
+        if (flags & RENDER_LIGHTS)
+            PrepareLights();
+        if ((flags & RENDER_SHADOWS) && !PrepareShadows())
+            flags &= ~RENDER_SHADOWS;
 
-                    t += tstep;
-                }
+        for (auto &level : mesh.levels)
+            if (!level.bounds.bValid)
+                Math::Mesh_ComputeBounds(level);
+
+        stats.nMeshesSubmitted++;
+
+        // The view frustum in world space is shared by all instances
+        mat4x4 matViewProj = Math::Mat_MultiplyMatrix(matView, matProj);
+        sFrustum frustumWorld, frustum;
+        ExtractFrustum(matViewProj, frustumWorld);
+
+        for (auto &inst : instances)
+        {
+            stats.nInstancesSubmitted++;
+
+            FRUSTUM_TEST nTest = TestInstance(frustumWorld, mesh.levels[0].bounds, inst.matWorld);
+            if (nTest == FRUSTUM_OUTSIDE)
+            {
+                stats.nInstancesCulled++;
+                continue;
+            }
+
+            mesh_indexed &level = mesh.levels[SelectLOD(mesh, inst.matWorld)];
+            mat4x4 matWorldView = Math::Mat_MultiplyMatrix(inst.matWorld, matView);
+
+            // Chunks need the frustum in this instances object space
+            if (nTest == FRUSTUM_INTERSECT && !level.chunks.empty())
+            {
+                mat4x4 matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+                ExtractFrustum(matWorldViewProj, frustum);
             }
+
+            sprBatch = GetInstanceTexture(inst);
+            ProcessMesh(level, matWorldView, frustum, nTest, inst.tint, flags);
         }
+
+        return RasterTriangles(flags);
     }
 
-    float *GFX3D::m_DepthBuffer = nullptr;
+    void GFX3D::PipeLine::BeginShadowMap(olc::GFX3D::shadow_map &map, olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &lookat, olc::GFX3D::vec3d &up, float fFovDegrees, int nSize, float fNear)
+    {
+        map.matView = GFX3D::Math::Mat_PointAt(pos, lookat, up);
+        map.matView = GFX3D::Math::Mat_QuickInverse(map.matView);
+        map.matProj = GFX3D::Math::Mat_MakeProjection(fFovDegrees, 1.0f, fNear, 1000.0f);
+        map.fNear = fNear;
+        map.nSize = nSize;
+        map.depth.assign((size_t)nSize * nSize, 0.0f);
+    }
 
-    void GFX3D::ConfigureDisplay()
+    uint32_t GFX3D::PipeLine::RenderShadow(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh)
     {
-        m_DepthBuffer = new float[pge->ScreenWidth() * pge->ScreenHeight()]{0};
+        return ShadowMesh(map, mesh, matWorld);
     }
 
-    void GFX3D::ClearDepth()
+    uint32_t GFX3D::PipeLine::RenderShadow(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh)
     {
-        memset(m_DepthBuffer, 0, pge->ScreenWidth() * pge->ScreenHeight() * sizeof(float));
+        return ShadowMesh(map, mesh, matWorld);
     }
 
-    GFX3D::PipeLine::PipeLine()
+    uint32_t GFX3D::PipeLine::RenderShadowInstanced(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh, std::vector<olc::GFX3D::instance> &instances)
     {
+        uint32_t nDrawn = 0;
+        for (auto &inst : instances)
+            nDrawn += ShadowMesh(map, mesh, inst.matWorld);
+        return nDrawn;
     }
 
-    void GFX3D::PipeLine::SetProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar, float fLeft, float fTop, float fWidth, float fHeight)
+    uint32_t GFX3D::PipeLine::RenderShadowInstanced(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh, std::vector<olc::GFX3D::instance> &instances)
     {
-        matProj = GFX3D::Math::Mat_MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
-        fViewX = fLeft;
-        fViewY = fTop;
-        fViewW = fWidth;
-        fViewH = fHeight;
+        uint32_t nDrawn = 0;
+        for (auto &inst : instances)
+            nDrawn += ShadowMesh(map, mesh, inst.matWorld);
+        return nDrawn;
     }
 
-    void GFX3D::PipeLine::SetCamera(olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &lookat, olc::GFX3D::vec3d &up)
+    void GFX3D::PipeLine::SetShadowMap(olc::GFX3D::shadow_map *pMap, olc::Pixel col, bool bPCF, float fBias)
     {
-        matView = GFX3D::Math::Mat_PointAt(pos, lookat, up);
-        matView = GFX3D::Math::Mat_QuickInverse(matView);
+        pShadowMap = pMap;
+        colShadow = col;
+        bShadowPCF = bPCF;
+        fShadowBias = fBias;
     }
 
-    void GFX3D::PipeLine::SetTransform(olc::GFX3D::mat4x4 &transform)
+    bool GFX3D::PipeLine::PrepareShadows()
     {
-        matWorld = transform;
+        if (!pShadowMap || pShadowMap->nSize <= 0 || pShadowMap->depth.size() < (size_t)pShadowMap->nSize * pShadowMap->nSize)
+            return false;
+
+        // Receivers arrive in view space, so undo the camera then look from the light
+        mat4x4 matInvView = Math::Mat_Inverse(matView);
+        mat4x4 matLight = Math::Mat_MultiplyMatrix(pShadowMap->matView, pShadowMap->matProj);
+        matViewToShadow = Math::Mat_MultiplyMatrix(matInvView, matLight);
+        return true;
     }
 
-    void GFX3D::PipeLine::SetTexture(olc::Sprite *texture)
+    uint32_t GFX3D::PipeLine::ShadowMesh(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh &mesh, olc::GFX3D::mat4x4 &matInstance)
     {
-        sprTexture = texture;
+        if (map.nSize <= 0)
+            return 0;
+
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
+
+        // Casters outside the light's frustum cannot shadow anything within it
+        mat4x4 matLight = Math::Mat_MultiplyMatrix(map.matView, map.matProj);
+        mat4x4 matWorldLight = Math::Mat_MultiplyMatrix(matInstance, matLight);
+        sFrustum frustum;
+        ExtractFrustum(matWorldLight, frustum);
+        FRUSTUM_TEST nTest = TestBounds(frustum, mesh.bounds);
+        if (nTest == FRUSTUM_OUTSIDE)
+            return 0;
+
+        vecRanges.clear();
+        if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+        {
+            for (auto &chunk : mesh.chunks)
+                if (TestBounds(frustum, chunk.bounds) != FRUSTUM_OUTSIDE)
+                    vecRanges.push_back({chunk.nFirst, chunk.nCount});
+        }
+        else
+            vecRanges.push_back({0, mesh.tris.size()});
+
+        float fHalf = 0.5f * (float)map.nSize;
+        uint32_t nDrawn = 0;
+        for (auto &range : vecRanges)
+        {
+            for (size_t i = range.nFirst; i < range.nFirst + range.nCount; i++)
+            {
+                vec3d c[3];
+                bool bClip = false;
+                for (int n = 0; n < 3; n++)
+                {
+                    c[n] = Math::Mat_MultiplyVector(matWorldLight, mesh.tris[i].p[n]);
+                    bClip |= c[n].w < map.fNear;
+                }
+
+                if (bClip)
+                {
+                    nDrawn += ShadowTriangle(map, c);
+                    continue;
+                }
+
+                float w1 = 1.0f / c[0].w, w2 = 1.0f / c[1].w, w3 = 1.0f / c[2].w;
+                DepthOnlyTriangle(map.depth.data(), map.nSize,
+                                  (c[0].x * w1 + 1.0f) * fHalf, (c[0].y * w1 + 1.0f) * fHalf, w1,
+                                  (c[1].x * w2 + 1.0f) * fHalf, (c[1].y * w2 + 1.0f) * fHalf, w2,
+                                  (c[2].x * w3 + 1.0f) * fHalf, (c[2].y * w3 + 1.0f) * fHalf, w3);
+                nDrawn++;
+            }
+        }
+        return nDrawn;
     }
 
-    void GFX3D::PipeLine::SetLightSource(olc::GFX3D::vec3d &pos, olc::GFX3D::vec3d &dir, olc::Pixel &col)
+    uint32_t GFX3D::PipeLine::ShadowMesh(olc::GFX3D::shadow_map &map, olc::GFX3D::mesh_indexed &mesh, olc::GFX3D::mat4x4 &matInstance)
     {
+        size_t nVertices = mesh.px.size();
+        if (map.nSize <= 0 || nVertices == 0)
+            return 0;
+
+        if (!mesh.bounds.bValid)
+            Math::Mesh_ComputeBounds(mesh);
+
+        mat4x4 matLight = Math::Mat_MultiplyMatrix(map.matView, map.matProj);
+        mat4x4 matWorldLight = Math::Mat_MultiplyMatrix(matInstance, matLight);
+        sFrustum frustum;
+        ExtractFrustum(matWorldLight, frustum);
+        FRUSTUM_TEST nTest = TestBounds(frustum, mesh.bounds);
+        if (nTest == FRUSTUM_OUTSIDE)
+            return 0;
+
+        if (vecCacheX.size() < nVertices)
+        {
+            vecCacheX.resize(nVertices);
+            vecCacheY.resize(nVertices);
+            vecCacheZ.resize(nVertices);
+            vecCacheW.resize(nVertices);
+        }
+
+        // Transform and project every vertex once, straight into texels. The cache
+        // then holds x, y, 1/w and the clip w, which says if it needs clipping
+        float fHalf = 0.5f * (float)map.nSize;
+        float fNear = map.fNear;
+        uint32_t nVertexJobs = (uint32_t)std::max((size_t)1, std::min(vecWorkers.size() + 1, nVertices / MIN_VERTICES_PER_JOB));
+        RunJobs(nVertexJobs, [&](uint32_t nJob) {
+            size_t nStart = nVertices * nJob / nVertexJobs;
+            size_t nCount = nVertices * (nJob + 1) / nVertexJobs - nStart;
+            float *x = vecCacheX.data(), *y = vecCacheY.data(), *z = vecCacheZ.data(), *w = vecCacheW.data();
+            GFX3D::Math::Mat_MultiplyVectorStream(matWorldLight, mesh.px.data() + nStart, mesh.py.data() + nStart, mesh.pz.data() + nStart, nCount,
+                                                  x + nStart, y + nStart, z + nStart, w + nStart);
+            for (size_t i = nStart; i < nStart + nCount; i++)
+            {
+                if (w[i] < fNear)
+                    continue;
+                float fInvW = 1.0f / w[i];
+                x[i] = (x[i] * fInvW + 1.0f) * fHalf;
+                y[i] = (y[i] * fInvW + 1.0f) * fHalf;
+                z[i] = fInvW;
+            }
+        });
+
+        vecRanges.clear();
+        if (nTest == FRUSTUM_INTERSECT && !mesh.chunks.empty())
+        {
+            for (auto &chunk : mesh.chunks)
+                if (TestBounds(frustum, chunk.bounds) != FRUSTUM_OUTSIDE)
+                    vecRanges.push_back({chunk.nFirst, chunk.nCount});
+        }
+        else
+            vecRanges.push_back({0, mesh.indices.size() / 3});
+
+        float *pDepth = map.depth.data();
+        uint32_t nDrawn = 0;
+        for (auto &range : vecRanges)
+        {
+            for (size_t i = range.nFirst * 3; i < (range.nFirst + range.nCount) * 3; i += 3)
+            {
+                uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+                if (vecCacheW[a] < fNear || vecCacheW[b] < fNear || vecCacheW[c] < fNear)
+                {
+                    // Projected vertices have lost their clip space position, so find it again
+                    vec3d clip[3];
+                    for (int n = 0; n < 3; n++)
+                    {
+                        uint32_t v = mesh.indices[i + n];
+                        vec3d p = {mesh.px[v], mesh.py[v], mesh.pz[v]};
+                        clip[n] = Math::Mat_MultiplyVector(matWorldLight, p);
+                    }
+                    nDrawn += ShadowTriangle(map, clip);
+                    continue;
+                }
+
+                DepthOnlyTriangle(pDepth, map.nSize,
+                                  vecCacheX[a], vecCacheY[a], vecCacheZ[a],
+                                  vecCacheX[b], vecCacheY[b], vecCacheZ[b],
+                                  vecCacheX[c], vecCacheY[c], vecCacheZ[c]);
+                nDrawn++;
+            }
+        }
+        return nDrawn;
     }
 
-    uint32_t GFX3D::PipeLine::Render(std::vector<olc::GFX3D::triangle> &triangles, uint32_t flags)
+    uint32_t GFX3D::PipeLine::ShadowTriangle(olc::GFX3D::shadow_map &map, const olc::GFX3D::vec3d *c)
     {
-        // Calculate Transformation Matrix
-        mat4x4 matWorldView = Math::Mat_MultiplyMatrix(matWorld, matView);
-        //matWorldViewProj = Math::Mat_MultiplyMatrix(matWorldView, matProj);
+        // Only the near plane matters, the rasteriser clamps everything else to the map
+        vec3d poly[4];
+        int nVerts = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const vec3d &a = c[i];
+            const vec3d &b = c[(i + 1) % 3];
+            float da = a.w - map.fNear;
+            float db = b.w - map.fNear;
+
+            if (da >= 0.0f)
+                poly[nVerts++] = a;
 
-        // Store triangles for rastering later
-        std::vector<GFX3D::triangle> vecTrianglesToRaster;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                poly[nVerts++] = {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), a.z + t * (b.z - a.z), a.w + t * (b.w - a.w)};
+            }
+        }
 
-        int nTriangleDrawnCount = 0;
+        if (nVerts < 3)
+            return 0;
 
-        // Process Triangles
-        for (auto &tri : triangles)
+        float fHalf = 0.5f * (float)map.nSize;
+        for (int i = 0; i < nVerts; i++)
         {
-            GFX3D::triangle triTransformed;
+            float fInvW = 1.0f / poly[i].w;
+            poly[i] = {(poly[i].x * fInvW + 1.0f) * fHalf, (poly[i].y * fInvW + 1.0f) * fHalf, fInvW};
+        }
 
-            // Just copy through texture coordinates
-            triTransformed.t[0] = {tri.t[0].x, tri.t[0].y, tri.t[0].z};
-            triTransformed.t[1] = {tri.t[1].x, tri.t[1].y, tri.t[1].z};
-            triTransformed.t[2] = {tri.t[2].x, tri.t[2].y, tri.t[2].z}; // Think!
+        for (int i = 1; i + 1 < nVerts; i++)
+            DepthOnlyTriangle(map.depth.data(), map.nSize,
+                              poly[0].x, poly[0].y, poly[0].z,
+                              poly[i].x, poly[i].y, poly[i].z,
+                              poly[i + 1].x, poly[i + 1].y, poly[i + 1].z);
+        return 1;
+    }
 
-            // Transform Triangle from object into projected space
-            triTransformed.p[0] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[0]);
-            triTransformed.p[1] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[1]);
-            triTransformed.p[2] = GFX3D::Math::Mat_MultiplyVector(matWorldView, tri.p[2]);
+    void GFX3D::PipeLine::ProcessTriangle(olc::GFX3D::triangle &triTransformed, uint32_t flags, std::vector<sRasterTriangle> &vecOut, const olc::Pixel *pShade)
+    {
+        // Calculate Triangle Normal in WorldView Space. Culling only needs
+        // the sign of the dot product, so it is not normalised
+        GFX3D::vec3d normal, line1, line2;
+        line1 = GFX3D::Math::Vec_Sub(triTransformed.p[1], triTransformed.p[0]);
+        line2 = GFX3D::Math::Vec_Sub(triTransformed.p[2], triTransformed.p[0]);
+        normal = GFX3D::Math::Vec_CrossProduct(line1, line2);
+
+        // Cull triangles that face away from viewer
+        if (flags & RENDER_CULL_CW && GFX3D::Math::Vec_DotProduct(normal, triTransformed.p[0]) > 0.0f)
+            return;
+        if (flags & RENDER_CULL_CCW && GFX3D::Math::Vec_DotProduct(normal, triTransformed.p[0]) < 0.0f)
+            return;
+
+        // Textured triangles are scissored by the rasteriser, so they only need
+        // clipping once they stray outside a generous guard band around the
+        // viewport. Wire and flat triangles are drawn by the PGE, so they get
+        // clipped exactly to the viewport edges.
+        const float fGuard = (flags & (RENDER_WIRE | RENDER_FLAT)) ? 1.0f : 4.0f;
+
+        // Signed distance of a clip space vertex to each plane, positive is inside.
+        // Planes are near, far, left, right, top, bottom
+        auto dist = [](const sClipVertex &c, int nPlane, float fBand) {
+            switch (nPlane)
+            {
+            case 0: return c.z;
+            case 1: return c.w - c.z;
+            case 2: return c.x + fBand * c.w;
+            case 3: return fBand * c.w - c.x;
+            case 4: return c.y + fBand * c.w;
+            default: return fBand * c.w - c.y;
+            }
+        };
+
+        // Transform into homogeneous clip space. Nothing has been divided by w yet,
+        // so clipping remains linear, even for vertices behind the camera
+        constexpr int nMaxVerts = 12;
+        sClipVertex poly[2][nMaxVerts];
+        uint32_t nOutsideAll = 0x3F;
+        uint32_t nOutsideGuard = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            GFX3D::vec3d c = GFX3D::Math::Mat_MultiplyVector(matProj, triTransformed.p[i]);
+            olc::Pixel s = pShade ? pShade[i] : olc::WHITE;
+            GFX3D::vec3d l;
+            if (flags & RENDER_SHADOWS)
+                l = GFX3D::Math::Mat_MultiplyVector(matViewToShadow, triTransformed.p[i]);
+            poly[0][i] = {c.x, c.y, c.z, c.w, triTransformed.t[i].x, triTransformed.t[i].y, (float)s.r, (float)s.g, (float)s.b,
+                          l.x, l.y, l.w};
+
+            uint32_t nOutside = 0, nOutsideBand = 0;
+            for (int p = 0; p < 6; p++)
+            {
+                if (dist(poly[0][i], p, 1.0f) < 0.0f)
+                    nOutside |= 1 << p;
+                if (dist(poly[0][i], p, fGuard) < 0.0f)
+                    nOutsideBand |= 1 << p;
+            }
+            nOutsideAll &= nOutside;
+            nOutsideGuard |= nOutsideBand;
+        }
 
-            // Calculate Triangle Normal in WorldView Space
-            GFX3D::vec3d normal, line1, line2;
-            line1 = GFX3D::Math::Vec_Sub(triTransformed.p[1], triTransformed.p[0]);
-            line2 = GFX3D::Math::Vec_Sub(triTransformed.p[2], triTransformed.p[0]);
-            normal = GFX3D::Math::Vec_CrossProduct(line1, line2);
-            normal = GFX3D::Math::Vec_Normalise(normal);
+        // All three vertices lie outside the same frustum plane, so reject it
+        if (nOutsideAll)
+            return;
 
-            // Cull triangles that face away from viewer
-            if (flags & RENDER_CULL_CW && GFX3D::Math::Vec_DotProduct(normal, triTransformed.p[0]) > 0.0f)
-                continue;
-            if (flags & RENDER_CULL_CCW && GFX3D::Math::Vec_DotProduct(normal, triTransformed.p[0]) < 0.0f)
+        // Sutherland-Hodgman, only against the planes the triangle actually
+        // crosses, ping-ponging between two small fixed size buffers
+        int nVerts = 3;
+        int nIn = 0;
+        for (int p = 0; p < 6 && nOutsideGuard; p++)
+        {
+            if (!(nOutsideGuard & (1 << p)))
                 continue;
 
-            // If Lighting, calculate shading
-            triTransformed.col = olc::WHITE;
+            sClipVertex *in = poly[nIn];
+            sClipVertex *out = poly[nIn ^ 1];
+            int nOut = 0;
 
-            // Clip triangle against near plane
-            int nClippedTriangles = 0;
-            triangle clipped[2];
-            nClippedTriangles = GFX3D::Math::Triangle_ClipAgainstPlane({0.0f, 0.0f, 0.1f}, {0.0f, 0.0f, 1.0f}, triTransformed, clipped[0], clipped[1]);
-
-            // This may yield two new triangles
-            for (int n = 0; n < nClippedTriangles; n++)
+            for (int i = 0; i < nVerts; i++)
             {
-                triangle triProjected = clipped[n];
+                const sClipVertex &a = in[i];
+                const sClipVertex &b = in[(i + 1) % nVerts];
+                float da = dist(a, p, fGuard);
+                float db = dist(b, p, fGuard);
 
-                // Project new triangle
-                triProjected.p[0] = GFX3D::Math::Mat_MultiplyVector(matProj, clipped[n].p[0]);
-                triProjected.p[1] = GFX3D::Math::Mat_MultiplyVector(matProj, clipped[n].p[1]);
-                triProjected.p[2] = GFX3D::Math::Mat_MultiplyVector(matProj, clipped[n].p[2]);
+                if (da >= 0.0f)
+                    out[nOut++] = a;
 
-                // Apply Projection to Verts
-                triProjected.p[0].x = triProjected.p[0].x / triProjected.p[0].w;
-                triProjected.p[1].x = triProjected.p[1].x / triProjected.p[1].w;
-                triProjected.p[2].x = triProjected.p[2].x / triProjected.p[2].w;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                {
+                    float t = da / (da - db);
+                    out[nOut++] = {
+                        a.x + t * (b.x - a.x), a.y + t * (b.y - a.y),
+                        a.z + t * (b.z - a.z), a.w + t * (b.w - a.w),
+                        a.u + t * (b.u - a.u), a.v + t * (b.v - a.v),
+                        a.r + t * (b.r - a.r), a.g + t * (b.g - a.g), a.b + t * (b.b - a.b),
+                        a.lx + t * (b.lx - a.lx), a.ly + t * (b.ly - a.ly), a.lw + t * (b.lw - a.lw)};
+                }
+            }
 
-                triProjected.p[0].y = triProjected.p[0].y / triProjected.p[0].w;
-                triProjected.p[1].y = triProjected.p[1].y / triProjected.p[1].w;
-                triProjected.p[2].y = triProjected.p[2].y / triProjected.p[2].w;
+            nVerts = nOut;
+            nIn ^= 1;
+            if (nVerts < 3)
+                return;
+        }
 
-                triProjected.p[0].z = triProjected.p[0].z / triProjected.p[0].w;
-                triProjected.p[1].z = triProjected.p[1].z / triProjected.p[1].w;
-                triProjected.p[2].z = triProjected.p[2].z / triProjected.p[2].w;
+        // Perspective divide and scale to viewport, then fan the polygon
+        // into triangles for the rasteriser
+        GFX3D::triangle triRaster;
+        triRaster.col = triTransformed.col;
+        GFX3D::vec3d vScreen[nMaxVerts];
+        GFX3D::vec2d vTex[nMaxVerts];
+        olc::Pixel vShade[nMaxVerts];
+        GFX3D::vec3d vShadow[nMaxVerts];
+        for (int i = 0; i < nVerts; i++)
+        {
+            const sClipVertex &c = poly[nIn][i];
+            float fInvW = 1.0f / c.w;
+            vScreen[i].x = (c.x * fInvW + 1.0f) * 0.5f * fViewW + fViewX;
+            vScreen[i].y = (c.y * fInvW + 1.0f) * 0.5f * fViewH + fViewY;
+            vScreen[i].z = c.z * fInvW;
+            vScreen[i].w = c.w;
+            vTex[i] = {c.u * fInvW, c.v * fInvW, fInvW};
+            vShade[i] = olc::Pixel((uint8_t)c.r, (uint8_t)c.g, (uint8_t)c.b);
+            vShadow[i] = {c.lx * fInvW, c.ly * fInvW, c.lw * fInvW};
+        }
 
-                // Apply Projection to Tex coords
-                triProjected.t[0].x = triProjected.t[0].x / triProjected.p[0].w;
-                triProjected.t[1].x = triProjected.t[1].x / triProjected.p[1].w;
-                triProjected.t[2].x = triProjected.t[2].x / triProjected.p[2].w;
+        for (int i = 1; i + 1 < nVerts; i++)
+        {
+            triRaster.p[0] = vScreen[0];
+            triRaster.p[1] = vScreen[i];
+            triRaster.p[2] = vScreen[i + 1];
+            triRaster.t[0] = vTex[0];
+            triRaster.t[1] = vTex[i];
+            triRaster.t[2] = vTex[i + 1];
+            float fNearest = std::max({triRaster.t[0].z, triRaster.t[1].z, triRaster.t[2].z});
+            vecOut.push_back({triRaster, sprBatch, fNearest, pShade != nullptr, {vShade[0], vShade[i], vShade[i + 1]},
+                              (flags & RENDER_SHADOWS) != 0, {vShadow[0], vShadow[i], vShadow[i + 1]}, 0u});
+        }
+    }
 
-                triProjected.t[0].y = triProjected.t[0].y / triProjected.p[0].w;
-                triProjected.t[1].y = triProjected.t[1].y / triProjected.p[1].w;
-                triProjected.t[2].y = triProjected.t[2].y / triProjected.p[2].w;
+    uint32_t GFX3D::PipeLine::RasterTriangles(uint32_t flags)
+    {
+        if (flags & RENDER_ALPHA_BLEND)
+        {
+            for (auto &r : vecTrianglesToRaster)
+                r.flags = flags;
+            uint32_t nQueued = (uint32_t)vecTrianglesToRaster.size();
+            vecTransparent.insert(vecTransparent.end(), vecTrianglesToRaster.begin(), vecTrianglesToRaster.end());
+            vecTrianglesToRaster.clear();
+            return nQueued;
+        }
 
-                triProjected.t[0].z = 1.0f / triProjected.p[0].w;
-                triProjected.t[1].z = 1.0f / triProjected.p[1].w;
-                triProjected.t[2].z = 1.0f / triProjected.p[2].w;
+        // Keep the rasteriser within the viewport, as textured
+        // triangles may extend into the guard band
+        const int nScissor[4] = {m_nScissorX1, m_nScissorY1, m_nScissorX2, m_nScissorY2};
+        IntersectScissor((int)fViewX, (int)fViewY, (int)fViewW, (int)fViewH);
 
-                // Clip against viewport in screen space
-                // Clip triangles against all four screen edges, this could yield
-                // a bunch of triangles, so create a queue that we traverse to
-                //  ensure we only test new triangles generated against planes
-                triangle sclipped[2];
-                std::list<triangle> listTriangles;
+        if (flags & RENDER_SHADOWS)
+        {
+            m_pShadowMap = pShadowMap;
+            m_colShadow = colShadow;
+            m_bShadowPCF = bShadowPCF;
+            m_fShadowBias = fShadowBias;
+        }
+        m_nAlphaMode = flags & RENDER_ALPHA_TEST;
 
-                // Add initial triangle
-                listTriangles.push_back(triProjected);
-                int nNewTriangles = 1;
+        if (flags & RENDER_SORT_FRONT_TO_BACK)
+        {
+            std::sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(),
+                      [](const sRasterTriangle &a, const sRasterTriangle &b) { return a.fNearest > b.fNearest; });
+        }
 
-                for (int p = 0; p < 4; p++)
-                {
-                    int nTrisToAdd = 0;
-                    while (nNewTriangles > 0)
-                    {
-                        // Take triangle from front of queue
-                        triangle test = listTriangles.front();
-                        listTriangles.pop_front();
-                        nNewTriangles--;
-
-                        // Clip it against a plane. We only need to test each
-                        // subsequent plane, against subsequent new triangles
-                        // as all triangles after a plane clip are guaranteed
-                        // to lie on the inside of the plane. I like how this
-                        // comment is almost completely and utterly justified
-                        switch (p)
-                        {
-                        case 0:
-                            nTrisToAdd = GFX3D::Math::Triangle_ClipAgainstPlane({0.0f, -1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, test, sclipped[0], sclipped[1]);
-                            break;
-                        case 1:
-                            nTrisToAdd = GFX3D::Math::Triangle_ClipAgainstPlane({0.0f, +1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, test, sclipped[0], sclipped[1]);
-                            break;
-                        case 2:
-                            nTrisToAdd = GFX3D::Math::Triangle_ClipAgainstPlane({-1.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, test, sclipped[0], sclipped[1]);
-                            break;
-                        case 3:
-                            nTrisToAdd = GFX3D::Math::Triangle_ClipAgainstPlane({+1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, test, sclipped[0], sclipped[1]);
-                            break;
-                        }
+        uint32_t nOccluded = 0;
+        for (auto &r : vecTrianglesToRaster)
+            if (!RasterTriangle(r, flags))
+                nOccluded++;
+
+        m_nScissorX1 = nScissor[0];
+        m_nScissorY1 = nScissor[1];
+        m_nScissorX2 = nScissor[2];
+        m_nScissorY2 = nScissor[3];
+        m_pShadowMap = nullptr;
+        m_nAlphaMode = 0;
+
+        uint32_t nTriangleDrawnCount = (uint32_t)vecTrianglesToRaster.size() - nOccluded;
+        stats.nTrianglesOccluded += nOccluded;
+        stats.nTrianglesDrawn += nTriangleDrawnCount;
+        vecTrianglesToRaster.clear();
+        return nTriangleDrawnCount;
+    }
 
-                        // Clipping may yield a variable number of triangles, so
-                        // add these new ones to the back of the queue for subsequent
-                        // clipping against next planes
-                        for (int w = 0; w < nTrisToAdd; w++)
-                            listTriangles.push_back(sclipped[w]);
-                    }
-                    nNewTriangles = listTriangles.size();
-                }
+    uint32_t GFX3D::PipeLine::RenderTransparent()
+    {
+        if (vecTransparent.empty())
+            return 0;
+
+        const int nScissor[4] = {m_nScissorX1, m_nScissorY1, m_nScissorX2, m_nScissorY2};
+        IntersectScissor((int)fViewX, (int)fViewY, (int)fViewW, (int)fViewH);
+        m_pShadowMap = PrepareShadows() ? pShadowMap : nullptr;
+        m_colShadow = colShadow;
+        m_bShadowPCF = bShadowPCF;
+        m_fShadowBias = fShadowBias;
+        m_nAlphaMode = RENDER_ALPHA_BLEND;
+
+        // Furthest first, by the average 1/w of the corners
+        std::sort(vecTransparent.begin(), vecTransparent.end(), [](const sRasterTriangle &a, const sRasterTriangle &b) {
+            return a.tri.t[0].z + a.tri.t[1].z + a.tri.t[2].z < b.tri.t[0].z + b.tri.t[1].z + b.tri.t[2].z;
+        });
+
+        uint32_t nOccluded = 0;
+        for (auto &r : vecTransparent)
+            if (!RasterTriangle(r, r.flags))
+                nOccluded++;
+
+        m_nScissorX1 = nScissor[0];
+        m_nScissorY1 = nScissor[1];
+        m_nScissorX2 = nScissor[2];
+        m_nScissorY2 = nScissor[3];
+        m_pShadowMap = nullptr;
+        m_nAlphaMode = 0;
+
+        uint32_t nTriangleDrawnCount = (uint32_t)vecTransparent.size() - nOccluded;
+        stats.nTrianglesOccluded += nOccluded;
+        stats.nTrianglesDrawn += nTriangleDrawnCount;
+        vecTransparent.clear();
+        return nTriangleDrawnCount;
+    }
 
-                for (auto &triRaster : listTriangles)
-                {
-                    // Scale to viewport
-                    /*triRaster.p[0].x *= -1.0f;
-					triRaster.p[1].x *= -1.0f;
-					triRaster.p[2].x *= -1.0f;
-					triRaster.p[0].y *= -1.0f;
-					triRaster.p[1].y *= -1.0f;
-					triRaster.p[2].y *= -1.0f;*/
-                    vec3d vOffsetView = {1, 1, 0};
-                    triRaster.p[0] = Math::Vec_Add(triRaster.p[0], vOffsetView);
-                    triRaster.p[1] = Math::Vec_Add(triRaster.p[1], vOffsetView);
-                    triRaster.p[2] = Math::Vec_Add(triRaster.p[2], vOffsetView);
-                    triRaster.p[0].x *= 0.5f * fViewW;
-                    triRaster.p[0].y *= 0.5f * fViewH;
-                    triRaster.p[1].x *= 0.5f * fViewW;
-                    triRaster.p[1].y *= 0.5f * fViewH;
-                    triRaster.p[2].x *= 0.5f * fViewW;
-                    triRaster.p[2].y *= 0.5f * fViewH;
-                    vOffsetView = {fViewX, fViewY, 0};
-                    triRaster.p[0] = Math::Vec_Add(triRaster.p[0], vOffsetView);
-                    triRaster.p[1] = Math::Vec_Add(triRaster.p[1], vOffsetView);
-                    triRaster.p[2] = Math::Vec_Add(triRaster.p[2], vOffsetView);
-
-                    // For now, just draw triangle
-
-                    if (flags & RENDER_TEXTURED)
-                    {
-                        TexturedTriangle(
-                            triRaster.p[0].x, triRaster.p[0].y, triRaster.t[0].x, triRaster.t[0].y, triRaster.t[0].z,
-                            triRaster.p[1].x, triRaster.p[1].y, triRaster.t[1].x, triRaster.t[1].y, triRaster.t[1].z,
-                            triRaster.p[2].x, triRaster.p[2].y, triRaster.t[2].x, triRaster.t[2].y, triRaster.t[2].z,
-                            sprTexture);
-                    }
+    bool GFX3D::PipeLine::RasterTriangle(sRasterTriangle &r, uint32_t flags)
+    {
+        GFX3D::triangle &triRaster = r.tri;
 
-                    if (flags & RENDER_WIRE)
-                    {
-                        DrawTriangleWire(triRaster, olc::RED);
-                    }
+        if (flags & RENDER_TEXTURED)
+        {
+            // Skip setting up triangles that are entirely hidden. Wireframes
+            // dont write depth, so are drawn regardless
+            int x1 = std::min({(int)triRaster.p[0].x, (int)triRaster.p[1].x, (int)triRaster.p[2].x});
+            int y1 = std::min({(int)triRaster.p[0].y, (int)triRaster.p[1].y, (int)triRaster.p[2].y});
+            int x2 = std::max({(int)triRaster.p[0].x, (int)triRaster.p[1].x, (int)triRaster.p[2].x});
+            int y2 = std::max({(int)triRaster.p[0].y, (int)triRaster.p[1].y, (int)triRaster.p[2].y});
+            if (!(flags & (RENDER_WIRE | RENDER_FLAT)) && IsOccluded(x1, y1, x2, y2, r.fNearest))
+                return false;
+
+            TexturedTriangle(
+                triRaster.p[0].x, triRaster.p[0].y, triRaster.t[0].x, triRaster.t[0].y, triRaster.t[0].z,
+                triRaster.p[1].x, triRaster.p[1].y, triRaster.t[1].x, triRaster.t[1].y, triRaster.t[1].z,
+                triRaster.p[2].x, triRaster.p[2].y, triRaster.t[2].x, triRaster.t[2].y, triRaster.t[2].z,
+                r.spr, r.bShaded ? olc::WHITE : triRaster.col, r.bShaded ? r.shade : nullptr,
+                r.bShadowed ? r.shadow : nullptr);
+        }
 
-                    if (flags & RENDER_FLAT)
-                    {
-                        DrawTriangleFlat(triRaster);
-                    }
+        if (flags & RENDER_WIRE)
+        {
+            DrawTriangleWire(triRaster, olc::RED);
+        }
 
-                    nTriangleDrawnCount++;
-                }
-            }
+        if (flags & RENDER_FLAT)
+        {
+            DrawTriangleFlat(triRaster);
         }
 
-        return nTriangleDrawnCount;
+        return true;
     }
 }
 
@@ -9,13 +9,25 @@
 #include <istream>
 #include <cstring>
 #include <climits>
+#include <cmath>
 #include <condition_variable>
 #include <algorithm>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
 #undef min
 #undef max
 
-// Choose a default sound backend
-#if !defined(USE_ALSA) && !defined(USE_OPENAL) && !defined(USE_WINDOWS)
+// Use SSE to mix and convert whole blocks where the target supports it
+#if !defined(OLC_SOUND_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define OLC_SOUND_SSE
+#include <emmintrin.h>
+#endif
+
+// Choose a default sound backend. USE_NULL needs no device, and mixes into memory
+// or a file instead, for tests and benchmarks
+#if !defined(USE_ALSA) && !defined(USE_OPENAL) && !defined(USE_WINDOWS) && !defined(USE_NULL)
 #ifdef __linux__
 #define USE_ALSA
 #endif
@@ -41,6 +53,11 @@
 #include <queue>
 #endif
 
+#ifdef USE_NULL
+#include <fstream>
+#include <mutex>
+#endif
+
 #pragma pack(push, 1)
 typedef struct
 {
@@ -67,38 +84,224 @@ namespace olc
             AudioSample();
             AudioSample(std::string sWavFile, olc::ResourcePack *pack = nullptr);
             olc::rcode LoadFromFile(std::string sWavFile, olc::ResourcePack *pack = nullptr);
+            // Encodes fSample as IMA ADPCM and frees it, for about an eighth of the memory
+            void Compress();
 
         public:
             OLC_WAVEFORMATEX wavHeader;
             float *fSample = nullptr;
             long nSamples = 0;
             int nChannels = 0;
+            // The rate the sample was recorded at, the mixer resamples it to the output's
+            unsigned int nSampleRate = 0;
             bool bSampleValid = false;
+            // Once compressed, blocks of ADPCM_BLOCK_FRAMES frames, each channel of a block
+            // in turn, which the mixer decodes as it needs them
+            bool bCompressed = false;
+            std::vector<uint8_t> vADPCM;
         };
 
+        // Each channel of a block starts with the decoder state, a 16 bit predictor and
+        // a step index, followed by a 4 bit code per frame
+        static constexpr unsigned int ADPCM_BLOCK_FRAMES = 256;
+        static constexpr unsigned int ADPCM_BLOCK_BYTES = 4 + ADPCM_BLOCK_FRAMES / 2;
+
         struct sCurrentlyPlayingSample
         {
             int nAudioSampleID = 0;
+            uint32_t nGeneration = 0;
             long nSamplePosition = 0;
+            float fFraction = 0.0f;
+            float fVolume = 1.0f;
+            float fRate = 1.0f;
+            // Index of the stream this voice plays, or -1 if it plays a loaded sample
+            int nStream = -1;
+            bool bActive = false;
             bool bFinished = false;
             bool bLoop = false;
             bool bFlagForStop = false;
+            // -1 is hard left, 1 hard right. A positional voice is panned and
+            // attenuated by where it is relative to the listener as well
+            float fPan = 0.0f;
+            bool bPositional = false;
+            float fX = 0.0f;
+            float fY = 0.0f;
+            // A fade moves fVolume towards its target each block, by a step or a
+            // factor per frame. It is timed from the first block after it is asked for
+            float fFadeTarget = 0.0f;
+            float fFadeTime = 0.0f;
+            float fFadeStep = 0.0f;
+            long nFadeFrames = 0;
+            bool bFadePending = false;
+            bool bFadeExponential = false;
+            bool bStopAfterFade = false;
+            // The gains the voice ended its last block with, which the next block
+            // ramps from so changes dont click
+            float fGain[2] = {0.0f, 0.0f};
+            bool bGainSet = false;
+        };
+
+        // A fixed pool of voices. Handles hold the voice's slot in their low bits and
+        // its generation above, so a handle to a voice that has since finished, or
+        // been stolen, is simply ignored
+        static constexpr unsigned int VOICE_SLOT_BITS = 8;
+        static constexpr unsigned int MAX_VOICES = 1 << VOICE_SLOT_BITS;
+
+        // When every voice is busy, PlaySample takes one over by this policy. Looping
+        // voices are only taken if nothing else can be
+        enum STEAL_POLICY
+        {
+            STEAL_NONE,
+            STEAL_OLDEST,
+            STEAL_QUIETEST
         };
 
-        static std::list<sCurrentlyPlayingSample> listActiveSamples;
+        // Only ever touched by the audio thread, the functions below send it commands
+        static sCurrentlyPlayingSample m_Voices[MAX_VOICES];
 
     public:
         static bool InitialiseAudio(unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512);
         static bool DestroyAudio();
         static void SetUserSynthFunction(std::function<float(int, float, float)> func);
         static void SetUserFilterFunction(std::function<float(int, float, float)> func);
+        // Block versions of the above, called once per block instead of once per sample.
+        // They are given nFrames interleaved frames of nChannels, the index of the first
+        // frame since the audio started and the time step between frames, neither of
+        // which lose precision however long it plays. A synth adds into the block, and
+        // a filter alters it in place.
+        static void SetUserSynthBlockFunction(std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> func);
+        static void SetUserFilterBlockFunction(std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> func);
 
     public:
-        static int LoadAudioSample(std::string sWavFile, olc::ResourcePack *pack = nullptr);
-        static void PlaySample(int id, bool bLoop = false);
+        // Building blocks for block synths, to be used on the audio thread. They work
+        // a run of frames at a time, and keep their timing in double so they dont drift
+        struct Oscillator
+        {
+            enum WAVE
+            {
+                SINE,
+                SQUARE,
+                SAW,
+                TRIANGLE
+            };
+            WAVE nWave = SINE;
+            double dFrequency = 440.0;
+            float fAmplitude = 1.0f;
+            // How far through its cycle the next frame is, from 0 to 1
+            double dPhase = 0.0;
+            // Adds nFrames of the wave into pOut, which has one channel
+            void Render(float *pOut, unsigned int nFrames, double dTimeStep);
+        };
+
+        // A linear ADSR envelope. Times are in seconds, and the sustain is a level
+        struct Envelope
+        {
+            float fAttack = 0.01f;
+            float fDecay = 0.1f;
+            float fSustain = 0.8f;
+            float fRelease = 0.2f;
+            // Starts from the current level, so retriggering a note doesnt click
+            void NoteOn();
+            void NoteOff();
+            // True once released and faded out, or never started
+            bool IsFinished() const;
+            // Multiplies nFrames of pBuffer, which has one channel, by the envelope
+            void Apply(float *pBuffer, unsigned int nFrames, double dTimeStep);
+
+        private:
+            enum
+            {
+                IDLE,
+                ATTACK,
+                DECAY,
+                SUSTAIN,
+                RELEASE
+            } nStage = IDLE;
+            float fLevel = 0.0f;
+            float fReleaseFrom = 0.0f;
+        };
+
+        // Adds nFrames of one channel into every channel of pMix, scaled by fGain
+        static void MixMono(float *pMix, unsigned int nFrames, unsigned int nChannels, const float *pSrc, float fGain = 1.0f);
+
+    public:
+        // Playback is controlled by commands queued for the audio thread, which acts on
+        // them at the start of its next block. They must all come from one thread.
+        // bCompress keeps the sample as ADPCM, trading a little quality and mixing time
+        // for memory
+        static int LoadAudioSample(std::string sWavFile, olc::ResourcePack *pack = nullptr, bool bCompress = false);
+        // Returns a handle to this voice, for StopVoice and SetVoiceVolume. 0 if there
+        // are no voices left, or the command queue is full and the audio thread isnt
+        // running to empty it. fRate scales the playback speed, and so the pitch
+        static uint32_t PlaySample(int id, bool bLoop = false, float fVolume = 1.0f, float fRate = 1.0f);
+        // Plays a WAVE file without loading it, a chunk at a time decoded on a background
+        // thread. Suits music and other long sounds. Returns a voice handle as above, or
+        // 0 if the file cant be read or MAX_STREAMS are already playing
+        static uint32_t PlayStream(std::string sWavFile, olc::ResourcePack *pack = nullptr, bool bLoop = false, float fVolume = 1.0f, float fRate = 1.0f);
+        static void SetStealPolicy(STEAL_POLICY nPolicy);
         static void StopSample(int id);
+        static void StopVoice(uint32_t nVoice);
+        static void SetVoiceVolume(uint32_t nVoice, float fVolume);
+        static void SetVoiceRate(uint32_t nVoice, float fRate);
+        // -1 is hard left, 0 centre and 1 hard right. Only heard with stereo output
+        static void SetVoicePan(uint32_t nVoice, float fPan);
+        // Moves the voice's volume to fTarget over fSeconds, in equal steps or, if
+        // bExponential, by equal ratios, which sounds more even. bStop ends the voice
+        // once the fade is done
+        static void FadeVoice(uint32_t nVoice, float fTarget, float fSeconds, bool bExponential = false, bool bStop = false);
+        // Places a voice in the world. From then on it is panned and attenuated by
+        // where it is relative to the listener, as set by the distance model
+        static void SetVoicePosition(uint32_t nVoice, float fX, float fY);
+        static void SetListenerPosition(float fX, float fY);
+        // Positional voices play at full volume within fMinDistance of the listener,
+        // fading linearly to silence at fMaxDistance
+        static void SetDistanceModel(float fMinDistance, float fMaxDistance);
         static void StopAll();
-        static float GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep);
+        // Mixes the next nFrames of every playing sample and the user functions,
+        // then clips and converts them into pBlock, interleaved by channel
+        static void MixBlock(short *pBlock, unsigned int nFrames, unsigned int nChannels, float fGlobalTime, float fTimeStep);
+
+    public:
+        // What the audio thread has been doing, since InitialiseAudio or ResetAudioStats.
+        // Times are in microseconds. Headroom is how much audio the device still had
+        // queued when it was handed each block, where the backend can tell.
+        static constexpr unsigned int STATS_HISTOGRAM_BUCKETS = 16;
+        struct AudioStats
+        {
+            uint64_t nBlocks = 0;
+            uint64_t nUnderruns = 0;
+            uint64_t nStreamUnderruns = 0;
+            float fBlockBudget = 0.0f;
+            float fRenderTime = 0.0f;
+            float fRenderTimeMean = 0.0f;
+            float fRenderTimeMax = 0.0f;
+            float fHeadroom = 0.0f;
+            float fHeadroomMin = 0.0f;
+            unsigned int nActiveVoices = 0;
+            unsigned int nActiveVoicesMax = 0;
+            unsigned int nCommandQueueDepth = 0;
+            unsigned int nCommandQueueDepthMax = 0;
+            // Render times in eighths of fBlockBudget, the last bucket counting all longer
+            uint32_t nRenderHistogram[STATS_HISTOGRAM_BUCKETS] = {};
+            // Headroom in whole blocks, the last bucket counting all deeper
+            uint32_t nHeadroomHistogram[STATS_HISTOGRAM_BUCKETS] = {};
+        };
+        static AudioStats GetAudioStats();
+        static void ResetAudioStats();
+
+#ifdef USE_NULL
+    public:
+        // Set before InitialiseAudio. The mix is written to sWavFile if it isnt empty,
+        // and kept for GetNullOutput if bCapture is set. A virtual clock only lets
+        // blocks be mixed as AdvanceNullClock allows, otherwise they are mixed as fast
+        // as possible. Streams are still decoded in real time, so may fall behind.
+        static void SetNullOutput(std::string sWavFile, bool bCapture = true, bool bVirtualClock = true);
+        // Moves the virtual clock on by nFrames, and returns once every whole block
+        // it allows has been mixed
+        static void AdvanceNullClock(unsigned int nFrames);
+        static std::vector<short> GetNullOutput();
+        static uint64_t GetNullFramesMixed();
+#endif
 
     private:
 #ifdef USE_WINDOWS // Windows specific sound management
@@ -137,12 +340,221 @@ namespace olc
         static short *m_pBlockMemory;
 #endif
 
+#ifdef USE_NULL
+        static unsigned int m_nSampleRate;
+        static unsigned int m_nChannels;
+        static unsigned int m_nBlockSamples;
+        static short *m_pBlockMemory;
+        static std::string m_sNullFile;
+        static std::ofstream m_NullFile;
+        static bool m_bNullCapture;
+        static bool m_bNullVirtualClock;
+        static std::vector<short> m_vecNullOutput;
+        static uint64_t m_nNullFramesAllowed;
+        static uint64_t m_nNullFramesMixed;
+        static std::condition_variable m_cvNullClock;
+        static std::mutex m_muxNullClock;
+        static void WriteNullHeader();
+        // Acts on the queued commands from the game thread, if the audio thread is
+        // waiting on the virtual clock and so wont. Returns false if it isnt waiting
+        static bool ProcessCommandsWhilePaused();
+#endif
+
         static void AudioThread();
         static std::thread m_AudioThread;
         static std::atomic<bool> m_bAudioThreadActive;
         static std::atomic<float> m_fGlobalTime;
         static std::function<float(int, float, float)> funcUserSynth;
         static std::function<float(int, float, float)> funcUserFilter;
+        static std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> funcUserSynthBlock;
+        static std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> funcUserFilterBlock;
+        // Frames mixed since the audio thread started, which the backends take the
+        // global time from
+        static uint64_t m_nGlobalFrame;
+
+        // A request from the game thread to the audio thread
+        struct sCommand
+        {
+            enum
+            {
+                PLAY,
+                STOP_SAMPLE,
+                STOP_VOICE,
+                STOP_ALL,
+                SET_VOLUME,
+                SET_RATE,
+                SET_PAN,
+                FADE,
+                SET_POSITION,
+                SET_LISTENER,
+                SET_DISTANCE_MODEL,
+                ADD_SAMPLE
+            } nType;
+            int nAudioSampleID;
+            uint32_t nVoice;
+            bool bLoop;
+            float fValue;
+            float fRate = 1.0f;
+            int nStream = -1;
+            // Positions and distances, and a fade's length and curve
+            float fX = 0.0f;
+            float fY = 0.0f;
+            bool bExponential = false;
+            // A newly loaded sample, for the audio thread's own table
+            const AudioSample *pSample = nullptr;
+        };
+
+        // Single producer, single consumer ring of commands. The game thread only
+        // writes the tail, and the audio thread only writes the head
+        static constexpr uint32_t COMMAND_QUEUE_SIZE = 1024;
+        static sCommand m_Commands[COMMAND_QUEUE_SIZE];
+        static std::atomic<uint32_t> m_nCommandHead;
+        static std::atomic<uint32_t> m_nCommandTail;
+        // Waits for space while the audio thread is running, otherwise fails when full
+        static bool PushCommand(const sCommand &cmd);
+        // Acts on every queued command, called by the audio thread between blocks
+        static void ProcessCommands();
+        // Gives a PLAY command a voice, by stealing one if need be, and queues it
+        static uint32_t StartVoice(sCommand cmd);
+
+        // The game thread's view of each voice slot, used to hand them out. A slot is
+        // free once the audio thread has finished the generation it last gave out
+        struct sVoiceSlot
+        {
+            uint32_t nGeneration = 0;
+            uint64_t nStarted = 0;
+            float fVolume = 0.0f;
+            bool bLoop = false;
+        };
+        static sVoiceSlot m_VoiceSlots[MAX_VOICES];
+        static std::atomic<uint32_t> m_nVoiceFinished[MAX_VOICES];
+        static uint64_t m_nVoicesStarted;
+        static unsigned int m_nNextVoiceSlot;
+        static STEAL_POLICY m_nStealPolicy;
+        // True if a handle refers to the latest use of its slot, and may still be playing
+        static bool IsVoiceCurrent(uint32_t nVoice);
+        // Resets the pool, before the audio thread starts
+        static void ResetVoices();
+
+        // The audio thread's view of the loaded samples, by ID less one. Loading adds
+        // to it through the command queue, so it is never read while being resized
+        static std::vector<const AudioSample *> m_vecSampleTable;
+
+        // The audio thread's list of slots in use, so mixing only visits those
+        static uint16_t m_ActiveVoices[MAX_VOICES];
+        static unsigned int m_nActiveVoices;
+
+        // A file being played a chunk at a time. The game thread opens it and hands it
+        // to a voice, the stream thread decodes it into the ring and the audio thread
+        // mixes from the ring. When the voice ends the stream thread closes it
+        enum
+        {
+            STREAM_FREE,
+            STREAM_PLAYING,
+            STREAM_RELEASED
+        };
+        static constexpr unsigned int MAX_STREAMS = 16;
+        static constexpr unsigned int STREAM_RING_FRAMES = 16384;
+        static constexpr unsigned int STREAM_CHUNK_FRAMES = 4096;
+        struct sStream
+        {
+            std::atomic<int> nState{STREAM_FREE};
+            std::unique_ptr<olc::ResourceBuffer> pPackBuffer;
+            std::unique_ptr<std::istream> pFile;
+            std::streampos nDataStart;
+            uint32_t nDataSize = 0;
+            uint32_t nDataRead = 0;
+            unsigned int nChannels = 0;
+            unsigned int nSampleRate = 0;
+            unsigned int nBytes = 0;
+            bool bFloat = false;
+            bool bLoop = false;
+            std::vector<uint8_t> vChunk;
+            // Frames written by the stream thread and consumed by the audio thread
+            std::vector<float> vRing;
+            std::atomic<uint64_t> nWritten{0};
+            std::atomic<uint64_t> nRead{0};
+            std::atomic<bool> bEndOfData{false};
+            // Where the audio thread lines up the buffered frames to interpolate them
+            std::vector<float> vScratch;
+        };
+        static sStream m_Streams[MAX_STREAMS];
+        static std::thread m_StreamThread;
+        static std::atomic<bool> m_bStreamThreadActive;
+        static void StreamThread();
+        // Decodes until the ring is full or the file has ended
+        static void FillStream(sStream &st);
+        static void MixStream(float *pMix, unsigned int nChannels, sStream &st, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep);
+        // Stops the stream thread and closes every stream, once the audio thread has stopped
+        static void StopStreams();
+
+        // Reads a WAVE header up to the start of its data, shared by samples and streams
+        static bool ReadWaveHeader(std::istream &is, OLC_WAVEFORMATEX &wavHeader, bool &bFloat, uint32_t &nDataSize);
+        // Normalises nCount samples of nBytes each to floats
+        static void ConvertSamples(const uint8_t *pData, float *pOut, long nCount, unsigned int nBytes, bool bFloat);
+
+        // Counters behind GetAudioStats. The audio thread is the only writer, apart from
+        // resets, so the maximums are plain read then write
+        struct sStatsCounters
+        {
+            std::atomic<uint64_t> nBlocks{0};
+            std::atomic<uint64_t> nUnderruns{0};
+            std::atomic<uint64_t> nStreamUnderruns{0};
+            std::atomic<uint64_t> nBlockFrames{0};
+            std::atomic<float> fTimeStep{0.0f};
+            std::atomic<uint64_t> nRenderNs{0};
+            std::atomic<uint64_t> nRenderNsTotal{0};
+            std::atomic<uint64_t> nRenderNsMax{0};
+            std::atomic<uint64_t> nHeadroomFrames{0};
+            std::atomic<uint64_t> nHeadroomFramesMin{UINT64_MAX};
+            std::atomic<unsigned int> nActiveVoices{0};
+            std::atomic<unsigned int> nActiveVoicesMax{0};
+            std::atomic<unsigned int> nCommandQueueDepth{0};
+            std::atomic<unsigned int> nCommandQueueDepthMax{0};
+            std::atomic<uint32_t> nRenderHistogram[STATS_HISTOGRAM_BUCKETS] = {};
+            std::atomic<uint32_t> nHeadroomHistogram[STATS_HISTOGRAM_BUCKETS] = {};
+        };
+        static sStatsCounters m_Stats;
+        // Called by the backends as they hand a block to the device
+        static void RecordHeadroom(uint64_t nFramesQueued);
+
+        // Where the listener is and how distance attenuates, kept by the audio thread
+        static float m_fListenerX;
+        static float m_fListenerY;
+        static float m_fMinDistance;
+        static float m_fMaxDistance;
+        // Moves a voice's fade on by nFrames, then works out the gains it should reach
+        // by the end of the block, for the left and right of the output
+        static void UpdateVoiceGains(sCurrentlyPlayingSample &s, unsigned int nChannels, unsigned int nFrames, float fTimeStep, float *fGain);
+        // Adds nFrames of a voice into the mix, taking the gains of even and odd output
+        // channels linearly from fStart to fEnd. Mono output uses the first of each
+        static void PanFrames(float *pMix, unsigned int nChannels, const float *pSrc, unsigned int nSrcChannels, unsigned int nFrames, const float *fStart, const float *fEnd);
+        // Each voice that cant be added straight from its sample is rendered here first
+        static std::vector<float> m_vecVoiceBlock;
+
+        // Decodes up to ADPCM_DECODE_LANES channel blocks side by side, all
+        // ADPCM_BLOCK_FRAMES of each, so their lookups overlap
+        static constexpr unsigned int ADPCM_DECODE_LANES = 4;
+        static void DecodeADPCMBlocks(const uint8_t *const *pBlocks, float *const *pOut, unsigned int nBlocks);
+        // Decodes one block a code at a time, clipping the predictor as it goes
+        static void DecodeADPCMBlock(const uint8_t *pBlock, float *pOut);
+        // Decodes nCount frames of a compressed sample from nFirst, interleaved. Frames
+        // outside the sample wrap around if bLoop, otherwise they are silent
+        static void DecodeADPCM(const AudioSample &a, long nFirst, long nCount, bool bLoop, float *pOut);
+        // Mixes a compressed sample's voice, a window of decoded frames at a time
+        static void MixCompressed(float *pMix, unsigned int nChannels, const AudioSample &a, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep);
+        static std::vector<float> m_vecDecodeBlock;
+
+        // Adds nFrames of a sample with nSrcChannels into the mix, which has nChannels
+        static void MixFrames(float *pMix, unsigned int nChannels, const float *pSrc, unsigned int nSrcChannels, unsigned int nFrames, float fGain);
+        // Adds up to nFrames of a voice stepping through its sample at dStep source frames
+        // per output frame, interpolating with a cubic, at unity gain. Returns the frames
+        // mixed, fewer if the sample ended
+        static unsigned int MixResampled(float *pMix, unsigned int nChannels, const AudioSample &a, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep);
+        // Clips the mix to -1..1 and converts it to 16 bit
+        static void ConvertBlock(const float *pMix, short *pBlock, unsigned int nCount);
+        // The block being mixed, reused so the audio thread doesnt allocate
+        static std::vector<float> m_vecMixBlock;
     };
 }
 
@@ -165,205 +577,1640 @@ namespace olc
     olc::rcode SOUND::AudioSample::LoadFromFile(std::string sWavFile, olc::ResourcePack *pack)
     {
         auto ReadWave = [&](std::istream &is) {
-            char dump[4];
-            is.read(dump, sizeof(char) * 4); // Read "RIFF"
-            if (strncmp(dump, "RIFF", 4) != 0)
+            bool bFloat = false;
+            uint32_t nChunksize = 0;
+            if (!ReadWaveHeader(is, wavHeader, bFloat, nChunksize))
                 return olc::FAIL;
-            is.read(dump, sizeof(char) * 4); // Not Interested
-            is.read(dump, sizeof(char) * 4); // Read "WAVE"
-            if (strncmp(dump, "WAVE", 4) != 0)
+
+            // Only trust the data size as far as the stream goes, as streamed files
+            // often leave it as 0xFFFFFFFF. Pack buffers cant seek, but know what is left
+            std::streampos nDataStart = is.tellg();
+            std::streamoff nLeft = is.rdbuf()->in_avail();
+            if (nDataStart != std::streampos(-1) && is.seekg(0, std::ios::end))
+            {
+                nLeft = is.tellg() - nDataStart;
+                is.seekg(nDataStart);
+            }
+            nChunksize = (uint32_t)std::min<std::streamoff>(nChunksize, std::max<std::streamoff>(nLeft, 0));
+
+            // Read the data in at once. A truncated file keeps the whole frames it has
+            unsigned int nBytes = wavHeader.wBitsPerSample / 8;
+            std::vector<uint8_t> vData(nChunksize);
+            is.read((char *)vData.data(), nChunksize);
+            nChannels = wavHeader.nChannels;
+            nSampleRate = wavHeader.nSamplesPerSec;
+            nSamples = (long)(is.gcount() / (nChannels * nBytes));
+
+            // Create floating point buffer to hold audio sample, and normalise into it
+            fSample = new float[nSamples * nChannels];
+            ConvertSamples(vData.data(), fSample, nSamples * nChannels, nBytes, bFloat);
+
+            // All done, flag sound as valid
+            bSampleValid = true;
+            return olc::OK;
+        };
+
+        if (pack != nullptr)
+        {
+            olc::ResourceBuffer rb = pack->GetFileBuffer(sWavFile);
+            std::istream is(&rb);
+            return ReadWave(is);
+        }
+        else
+        {
+            // Read from file
+            std::ifstream ifs(sWavFile, std::ifstream::binary);
+            if (ifs.is_open())
+            {
+                return ReadWave(ifs);
+            }
+            else
                 return olc::FAIL;
+        }
+    }
+
+    bool SOUND::ReadWaveHeader(std::istream &is, OLC_WAVEFORMATEX &wavHeader, bool &bFloat, uint32_t &nDataSize)
+    {
+        char dump[4];
+        is.read(dump, sizeof(char) * 4); // Read "RIFF"
+        if (strncmp(dump, "RIFF", 4) != 0)
+            return false;
+        is.read(dump, sizeof(char) * 4); // Not Interested
+        is.read(dump, sizeof(char) * 4); // Read "WAVE"
+        if (strncmp(dump, "WAVE", 4) != 0)
+            return false;
+
+        // Read Wave description chunk. It may be longer than OLC_WAVEFORMATEX, when
+        // it is the extensible form that keeps the real format in a sub format GUID
+        is.read(dump, sizeof(char) * 4); // Read "fmt "
+        uint32_t nHeaderSize = 0;
+        is.read((char *)&nHeaderSize, sizeof(uint32_t));
+        std::vector<char> vHeader(std::max<uint32_t>(nHeaderSize + (nHeaderSize & 1), sizeof(OLC_WAVEFORMATEX)), 0);
+        is.read(vHeader.data(), nHeaderSize + (nHeaderSize & 1));
+        if (strncmp(dump, "fmt ", 4) != 0 || !is)
+            return false;
+        memcpy(&wavHeader, vHeader.data(), sizeof(OLC_WAVEFORMATEX));
+
+        uint16_t nFormat = wavHeader.wFormatTag;
+        if (nFormat == 0xFFFE && nHeaderSize >= 26)
+            memcpy(&nFormat, vHeader.data() + 24, sizeof(uint16_t));
+
+        // Integer PCM of 8, 16, 24 or 32 bits, or 32 or 64 bit floating point, at any rate
+        unsigned int nBytes = wavHeader.wBitsPerSample / 8;
+        bFloat = nFormat == 3;
+        if ((nFormat != 1 && !bFloat) || wavHeader.wBitsPerSample % 8 != 0 ||
+            (bFloat ? (nBytes != 4 && nBytes != 8) : (nBytes < 1 || nBytes > 4)) ||
+            wavHeader.nChannels == 0 || wavHeader.nSamplesPerSec == 0)
+            return false;
+
+        // Search for audio data chunk
+        is.read(dump, sizeof(char) * 4);               // Read chunk header
+        is.read((char *)&nDataSize, sizeof(uint32_t)); // Read chunk size
+        while (strncmp(dump, "data", 4) != 0)
+        {
+            // Not audio data, so just skip it, chunks are padded to even sizes
+            if (!is)
+                return false;
+            is.seekg(nDataSize + (nDataSize & 1), std::istream::cur);
+            is.read(dump, sizeof(char) * 4);
+            is.read((char *)&nDataSize, sizeof(uint32_t));
+        }
+        return (bool)is;
+    }
+
+    void SOUND::ConvertSamples(const uint8_t *pData, float *pOut, long nCount, unsigned int nBytes, bool bFloat)
+    {
+        for (long i = 0; i < nCount; i++, pData += nBytes)
+        {
+            if (bFloat && nBytes == 4)
+                memcpy(&pOut[i], pData, sizeof(float));
+            else if (bFloat)
+            {
+                double d;
+                memcpy(&d, pData, sizeof(double));
+                pOut[i] = (float)d;
+            }
+            else if (nBytes == 1)
+                pOut[i] = (float)(*pData - 128) / (float)(SCHAR_MAX);
+            else if (nBytes == 2)
+            {
+                short s;
+                memcpy(&s, pData, sizeof(short));
+                pOut[i] = (float)s / (float)(SHRT_MAX);
+            }
+            else if (nBytes == 3)
+                pOut[i] = (float)((int32_t)((uint32_t)pData[0] << 8 | (uint32_t)pData[1] << 16 | (uint32_t)pData[2] << 24) >> 8) / 8388607.0f;
+            else
+            {
+                int32_t n;
+                memcpy(&n, pData, sizeof(int32_t));
+                pOut[i] = (float)((double)n / (double)INT32_MAX);
+            }
+        }
+    }
+
+    // IMA ADPCM step sizes, and how each code moves through them
+    static const int32_t nADPCMStep[89] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+        50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+        337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+        2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+        15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+    static const int nADPCMIndex[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+    // The decoder's signed delta and next step index for each step index and code, so
+    // decoding a code is two lookups
+    struct sADPCMDecodeTable
+    {
+        int32_t nDelta[89 * 16];
+        uint8_t nNext[89 * 16];
+    };
+    static const sADPCMDecodeTable &ADPCMDecodeTable()
+    {
+        static const sADPCMDecodeTable table = [] {
+            sADPCMDecodeTable t;
+            for (int nIndex = 0; nIndex < 89; nIndex++)
+                for (int nCode = 0; nCode < 16; nCode++)
+                {
+                    int nStep = nADPCMStep[nIndex];
+                    int nDelta = (nStep >> 3) + (nCode & 4 ? nStep : 0) + (nCode & 2 ? nStep >> 1 : 0) + (nCode & 1 ? nStep >> 2 : 0);
+                    t.nDelta[nIndex * 16 + nCode] = nCode & 8 ? -nDelta : nDelta;
+                    t.nNext[nIndex * 16 + nCode] = (uint8_t)std::min(std::max(nIndex + nADPCMIndex[nCode], 0), 88);
+                }
+            return t;
+        }();
+        return table;
+    }
+
+    void SOUND::AudioSample::Compress()
+    {
+        if (!bSampleValid || bCompressed)
+            return;
+
+        long nBlocks = (nSamples + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+        vADPCM.assign(nBlocks * nChannels * ADPCM_BLOCK_BYTES, 0);
+        for (int c = 0; c < nChannels; c++)
+        {
+            // The encoder tracks exactly what the decoder will produce, so errors dont build up
+            int nPredictor = 0, nIndex = 0;
+            for (long b = 0; b < nBlocks; b++)
+            {
+                uint8_t *pBlock = vADPCM.data() + (b * nChannels + c) * ADPCM_BLOCK_BYTES;
+                int16_t nHeader = (int16_t)nPredictor;
+                memcpy(pBlock, &nHeader, sizeof(int16_t));
+                pBlock[2] = (uint8_t)nIndex;
+
+                for (unsigned int i = 0; i < ADPCM_BLOCK_FRAMES; i++)
+                {
+                    long n = b * ADPCM_BLOCK_FRAMES + i;
+                    float f = n < nSamples ? fSample[n * nChannels + c] : 0.0f;
+                    int nTarget = (int)std::lround(std::min(std::max(f, -1.0f), 1.0f) * (float)SHRT_MAX);
+
+                    int nStep = nADPCMStep[nIndex];
+                    int nDiff = nTarget - nPredictor;
+                    int nCode = 0;
+                    if (nDiff < 0)
+                    {
+                        nCode = 8;
+                        nDiff = -nDiff;
+                    }
+                    int nDelta = nStep >> 3;
+                    if (nDiff >= nStep)
+                    {
+                        nCode |= 4;
+                        nDiff -= nStep;
+                        nDelta += nStep;
+                    }
+                    if (nDiff >= nStep >> 1)
+                    {
+                        nCode |= 2;
+                        nDiff -= nStep >> 1;
+                        nDelta += nStep >> 1;
+                    }
+                    if (nDiff >= nStep >> 2)
+                    {
+                        nCode |= 1;
+                        nDelta += nStep >> 2;
+                    }
+
+                    nPredictor = std::min(std::max(nPredictor + (nCode & 8 ? -nDelta : nDelta), (int)SHRT_MIN), (int)SHRT_MAX);
+                    nIndex = std::min(std::max(nIndex + nADPCMIndex[nCode], 0), 88);
+                    pBlock[4 + i / 2] |= (uint8_t)(nCode << ((i & 1) * 4));
+                }
+            }
+        }
+
+        delete[] fSample;
+        fSample = nullptr;
+        bCompressed = true;
+    }
+
+    void SOUND::DecodeADPCMBlocks(const uint8_t *const *pBlocks, float *const *pOut, unsigned int nBlocks)
+    {
+#ifdef OLC_SOUND_SSE
+        const sADPCMDecodeTable &table = ADPCMDecodeTable();
+
+        // The deltas only depend on the codes, so look those up first, every block at
+        // once as each is a chain of dependent lookups. Then the output is their running
+        // sum, four at a time, which is exact unless the predictor clipped somewhere
+        alignas(16) int32_t nDeltas[ADPCM_DECODE_LANES][ADPCM_BLOCK_FRAMES];
+        auto LookUp = [&](unsigned int b, unsigned int i, unsigned int &nIndex) {
+            uint8_t nCodes = pBlocks[b][4 + i / 2];
+            unsigned int nLow = nIndex * 16 + (nCodes & 15);
+            unsigned int nHigh = table.nNext[nLow] * 16 + (nCodes >> 4);
+            nDeltas[b][i] = table.nDelta[nLow];
+            nDeltas[b][i + 1] = table.nDelta[nHigh];
+            nIndex = table.nNext[nHigh];
+        };
+        if (nBlocks == ADPCM_DECODE_LANES)
+        {
+            // Kept in registers, so the four chains really do run side by side
+            unsigned int nIndex0 = pBlocks[0][2], nIndex1 = pBlocks[1][2], nIndex2 = pBlocks[2][2], nIndex3 = pBlocks[3][2];
+            for (unsigned int i = 0; i < ADPCM_BLOCK_FRAMES; i += 2)
+            {
+                LookUp(0, i, nIndex0);
+                LookUp(1, i, nIndex1);
+                LookUp(2, i, nIndex2);
+                LookUp(3, i, nIndex3);
+            }
+        }
+        else
+            for (unsigned int b = 0; b < nBlocks; b++)
+            {
+                unsigned int nIndex = pBlocks[b][2];
+                for (unsigned int i = 0; i < ADPCM_BLOCK_FRAMES; i += 2)
+                    LookUp(b, i, nIndex);
+            }
+
+        const __m128 vScale = _mm_set1_ps(1.0f / (float)SHRT_MAX);
+        for (unsigned int b = 0; b < nBlocks; b++)
+        {
+            int16_t nHeader;
+            memcpy(&nHeader, pBlocks[b], sizeof(int16_t));
+            __m128i vPredictor = _mm_set1_epi32(nHeader);
+            __m128i vMin = vPredictor, vMax = vPredictor;
+            for (unsigned int i = 0; i < ADPCM_BLOCK_FRAMES; i += 4)
+            {
+                // Prefix sum across the four, on top of the last predictor
+                __m128i vDelta = _mm_load_si128((const __m128i *)(nDeltas[b] + i));
+                vDelta = _mm_add_epi32(vDelta, _mm_slli_si128(vDelta, 4));
+                vDelta = _mm_add_epi32(vDelta, _mm_slli_si128(vDelta, 8));
+                __m128i vValue = _mm_add_epi32(vPredictor, vDelta);
+                vPredictor = _mm_shuffle_epi32(vValue, _MM_SHUFFLE(3, 3, 3, 3));
+
+                vMin = _mm_sub_epi32(vMin, _mm_and_si128(_mm_cmplt_epi32(vValue, vMin), _mm_sub_epi32(vMin, vValue)));
+                vMax = _mm_add_epi32(vMax, _mm_and_si128(_mm_cmpgt_epi32(vValue, vMax), _mm_sub_epi32(vValue, vMax)));
+                _mm_storeu_ps(pOut[b] + i, _mm_mul_ps(_mm_cvtepi32_ps(vValue), vScale));
+            }
+
+            alignas(16) int32_t nMin[4], nMax[4];
+            _mm_store_si128((__m128i *)nMin, vMin);
+            _mm_store_si128((__m128i *)nMax, vMax);
+            if (std::min({nMin[0], nMin[1], nMin[2], nMin[3]}) < SHRT_MIN || std::max({nMax[0], nMax[1], nMax[2], nMax[3]}) > SHRT_MAX)
+                DecodeADPCMBlock(pBlocks[b], pOut[b]);
+        }
+#else
+        for (unsigned int b = 0; b < nBlocks; b++)
+            DecodeADPCMBlock(pBlocks[b], pOut[b]);
+#endif
+    }
+
+    void SOUND::DecodeADPCMBlock(const uint8_t *pBlock, float *pOut)
+    {
+        const sADPCMDecodeTable &table = ADPCMDecodeTable();
+        int16_t nHeader;
+        memcpy(&nHeader, pBlock, sizeof(int16_t));
+        int nPredictor = nHeader;
+        unsigned int nIndex = pBlock[2];
+        const uint8_t *pCodes = pBlock + 4;
+        for (unsigned int i = 0; i < ADPCM_BLOCK_FRAMES; i++)
+        {
+            unsigned int nLookup = nIndex * 16 + ((pCodes[i / 2] >> ((i & 1) * 4)) & 15);
+            nPredictor = std::min(std::max(nPredictor + table.nDelta[nLookup], (int)SHRT_MIN), (int)SHRT_MAX);
+            nIndex = table.nNext[nLookup];
+            pOut[i] = (float)nPredictor * (1.0f / (float)SHRT_MAX);
+        }
+    }
+
+    // This holds all loaded sound samples in memory. A deque never moves what it
+    // already holds, so a sample being mixed stays put while another is loaded
+    std::deque<olc::SOUND::AudioSample> vecAudioSamples;
+
+    // This structure represents a sound that is currently playing. It only
+    // holds the sound ID and where this instance of it is up to for its
+    // current playback
+
+    void SOUND::SetUserSynthFunction(std::function<float(int, float, float)> func)
+    {
+        funcUserSynth = func;
+    }
+
+    void SOUND::SetUserFilterFunction(std::function<float(int, float, float)> func)
+    {
+        funcUserFilter = func;
+    }
+
+    void SOUND::SetUserSynthBlockFunction(std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> func)
+    {
+        funcUserSynthBlock = func;
+    }
+
+    void SOUND::SetUserFilterBlockFunction(std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> func)
+    {
+        funcUserFilterBlock = func;
+    }
+
+    // Load a PCM or floating point WAVE file into memory. A sample ID
+    // number is returned if successful, otherwise -1
+    int SOUND::LoadAudioSample(std::string sWavFile, olc::ResourcePack *pack, bool bCompress)
+    {
+
+        olc::SOUND::AudioSample a(sWavFile, pack);
+        if (a.bSampleValid)
+        {
+            if (bCompress)
+                a.Compress();
+            vecAudioSamples.push_back(std::move(a));
+            int id = (int)vecAudioSamples.size();
+
+            // If this fails the audio thread isnt running, and picks the sample up when it starts
+            sCommand cmd{sCommand::ADD_SAMPLE, id, 0, false, 0.0f};
+            cmd.pSample = &vecAudioSamples.back();
+            PushCommand(cmd);
+            return id;
+        }
+        else
+            return -1;
+    }
+
+    bool SOUND::PushCommand(const sCommand &cmd)
+    {
+        uint32_t nTail = m_nCommandTail.load(std::memory_order_relaxed);
+        while (nTail - m_nCommandHead.load(std::memory_order_acquire) == COMMAND_QUEUE_SIZE)
+        {
+            if (!m_bAudioThreadActive)
+                return false;
+#ifdef USE_NULL
+            // A paused virtual clock would leave the queue full until the next
+            // AdvanceNullClock, which this thread is the one to call
+            if (m_bNullVirtualClock && ProcessCommandsWhilePaused())
+                continue;
+#endif
+            std::this_thread::yield();
+        }
+
+        m_Commands[nTail & (COMMAND_QUEUE_SIZE - 1)] = cmd;
+        m_nCommandTail.store(nTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void SOUND::ProcessCommands()
+    {
+        uint32_t nHead = m_nCommandHead.load(std::memory_order_relaxed);
+        uint32_t nTail = m_nCommandTail.load(std::memory_order_acquire);
+        for (; nHead != nTail; nHead++)
+        {
+            const sCommand &cmd = m_Commands[nHead & (COMMAND_QUEUE_SIZE - 1)];
+            sCurrentlyPlayingSample &v = m_Voices[cmd.nVoice & (MAX_VOICES - 1)];
+            uint32_t nGeneration = cmd.nVoice >> VOICE_SLOT_BITS;
+            switch (cmd.nType)
+            {
+            case sCommand::PLAY:
+                // A busy slot is being stolen, so it keeps its place in the active list
+                if (!v.bActive)
+                    m_ActiveVoices[m_nActiveVoices++] = (uint16_t)(cmd.nVoice & (MAX_VOICES - 1));
+                else if (v.nStream >= 0)
+                    m_Streams[v.nStream].nState.store(STREAM_RELEASED, std::memory_order_release);
+                v = sCurrentlyPlayingSample();
+                v.nStream = cmd.nStream;
+                v.nAudioSampleID = cmd.nAudioSampleID;
+                v.nGeneration = nGeneration;
+                v.fVolume = cmd.fValue;
+                v.fRate = cmd.fRate;
+                v.bLoop = cmd.bLoop;
+                v.bActive = true;
+                break;
+
+            case sCommand::STOP_SAMPLE:
+                // Find first occurence of sample id
+                for (unsigned int i = 0; i < m_nActiveVoices; i++)
+                {
+                    sCurrentlyPlayingSample &s = m_Voices[m_ActiveVoices[i]];
+                    if (s.nAudioSampleID == cmd.nAudioSampleID && !s.bFlagForStop)
+                    {
+                        s.bFlagForStop = true;
+                        break;
+                    }
+                }
+                break;
+
+            case sCommand::STOP_ALL:
+                for (unsigned int i = 0; i < m_nActiveVoices; i++)
+                    m_Voices[m_ActiveVoices[i]].bFlagForStop = true;
+                break;
+
+            case sCommand::STOP_VOICE:
+                if (v.bActive && v.nGeneration == nGeneration)
+                    v.bFlagForStop = true;
+                break;
+
+            case sCommand::SET_VOLUME:
+                if (v.bActive && v.nGeneration == nGeneration)
+                {
+                    // Setting the volume outright cancels any fade
+                    v.fVolume = cmd.fValue;
+                    v.bFadePending = false;
+                    v.nFadeFrames = 0;
+                }
+                break;
+
+            case sCommand::SET_RATE:
+                if (v.bActive && v.nGeneration == nGeneration)
+                    v.fRate = cmd.fRate;
+                break;
+
+            case sCommand::SET_PAN:
+                if (v.bActive && v.nGeneration == nGeneration)
+                    v.fPan = cmd.fValue;
+                break;
+
+            case sCommand::FADE:
+                if (v.bActive && v.nGeneration == nGeneration)
+                {
+                    v.fFadeTarget = cmd.fValue;
+                    v.fFadeTime = cmd.fX;
+                    v.bFadeExponential = cmd.bExponential;
+                    v.bStopAfterFade = cmd.bLoop;
+                    v.bFadePending = true;
+                    v.nFadeFrames = 0;
+                }
+                break;
+
+            case sCommand::SET_POSITION:
+                if (v.bActive && v.nGeneration == nGeneration)
+                {
+                    v.fX = cmd.fX;
+                    v.fY = cmd.fY;
+                    v.bPositional = true;
+                }
+                break;
+
+            case sCommand::SET_LISTENER:
+                m_fListenerX = cmd.fX;
+                m_fListenerY = cmd.fY;
+                break;
+
+            case sCommand::SET_DISTANCE_MODEL:
+                m_fMinDistance = cmd.fX;
+                m_fMaxDistance = cmd.fY;
+                break;
+
+            case sCommand::ADD_SAMPLE:
+                if ((size_t)cmd.nAudioSampleID > m_vecSampleTable.size())
+                    m_vecSampleTable.resize(cmd.nAudioSampleID, nullptr);
+                m_vecSampleTable[cmd.nAudioSampleID - 1] = cmd.pSample;
+                break;
+            }
+        }
+        m_nCommandHead.store(nHead, std::memory_order_release);
+    }
+
+    bool SOUND::IsVoiceCurrent(uint32_t nVoice)
+    {
+        uint32_t nSlot = nVoice & (MAX_VOICES - 1);
+        uint32_t nGeneration = nVoice >> VOICE_SLOT_BITS;
+        return nVoice != 0 && m_VoiceSlots[nSlot].nGeneration == nGeneration &&
+               m_nVoiceFinished[nSlot].load(std::memory_order_acquire) != nGeneration;
+    }
+
+    void SOUND::ResetVoices()
+    {
+        for (unsigned int i = 0; i < MAX_VOICES; i++)
+        {
+            m_Voices[i] = sCurrentlyPlayingSample();
+            m_nVoiceFinished[i] = m_VoiceSlots[i].nGeneration;
+        }
+        m_nActiveVoices = 0;
+        m_nCommandHead = m_nCommandTail.load();
+        m_nGlobalFrame = 0;
+
+        // Queued samples were just dropped, so take every sample loaded so far
+        m_vecSampleTable.clear();
+        for (auto &a : vecAudioSamples)
+            m_vecSampleTable.push_back(&a);
+
+        // Any streams still playing lost their voices too
+        for (auto &st : m_Streams)
+        {
+            int nState = STREAM_PLAYING;
+            st.nState.compare_exchange_strong(nState, STREAM_RELEASED);
+        }
+    }
+
+    void SOUND::SetStealPolicy(STEAL_POLICY nPolicy)
+    {
+        m_nStealPolicy = nPolicy;
+    }
+
+    uint32_t SOUND::StartVoice(sCommand cmd)
+    {
+        // Look for a free slot, starting after the last one handed out
+        uint32_t nSlot = MAX_VOICES;
+        for (unsigned int i = 0; i < MAX_VOICES && nSlot == MAX_VOICES; i++)
+        {
+            uint32_t n = (m_nNextVoiceSlot + i) & (MAX_VOICES - 1);
+            if (m_nVoiceFinished[n].load(std::memory_order_acquire) == m_VoiceSlots[n].nGeneration)
+                nSlot = n;
+        }
+
+        // Otherwise steal one, preferring those that dont loop
+        if (nSlot == MAX_VOICES)
+        {
+            if (m_nStealPolicy == STEAL_NONE)
+                return 0;
+
+            auto Better = [](const sVoiceSlot &a, const sVoiceSlot &b) {
+                if (a.bLoop != b.bLoop)
+                    return !a.bLoop;
+                if (m_nStealPolicy == STEAL_QUIETEST && a.fVolume != b.fVolume)
+                    return a.fVolume < b.fVolume;
+                return a.nStarted < b.nStarted;
+            };
+            nSlot = 0;
+            for (uint32_t n = 1; n < MAX_VOICES; n++)
+                if (Better(m_VoiceSlots[n], m_VoiceSlots[nSlot]))
+                    nSlot = n;
+        }
+
+        // Handles are never 0, so 0 can mean no voice
+        sVoiceSlot &slot = m_VoiceSlots[nSlot];
+        slot.nGeneration = (slot.nGeneration + 1) & (UINT32_MAX >> VOICE_SLOT_BITS);
+        if (slot.nGeneration == 0)
+            slot.nGeneration = 1;
+        slot.nStarted = ++m_nVoicesStarted;
+        slot.fVolume = cmd.fValue;
+        slot.bLoop = cmd.bLoop;
+        m_nNextVoiceSlot = nSlot + 1;
+
+        cmd.nVoice = (slot.nGeneration << VOICE_SLOT_BITS) | nSlot;
+        if (!PushCommand(cmd))
+        {
+            m_nVoiceFinished[nSlot] = slot.nGeneration;
+            return 0;
+        }
+        return cmd.nVoice;
+    }
+
+    // Add sample 'id' to the mixers sounds to play list
+    uint32_t SOUND::PlaySample(int id, bool bLoop, float fVolume, float fRate)
+    {
+        return StartVoice({sCommand::PLAY, id, 0, bLoop, fVolume, fRate});
+    }
+
+    uint32_t SOUND::PlayStream(std::string sWavFile, olc::ResourcePack *pack, bool bLoop, float fVolume, float fRate)
+    {
+        int nStream = -1;
+        for (unsigned int i = 0; i < MAX_STREAMS && nStream < 0; i++)
+            if (m_Streams[i].nState.load(std::memory_order_acquire) == STREAM_FREE)
+                nStream = (int)i;
+        if (nStream < 0)
+            return 0;
+
+        // A free stream is only touched by this thread, so it can be set up here
+        sStream &st = m_Streams[nStream];
+        if (pack != nullptr)
+        {
+            st.pPackBuffer.reset(new olc::ResourceBuffer(pack->GetFileBuffer(sWavFile)));
+            st.pFile.reset(new std::istream(st.pPackBuffer.get()));
+        }
+        else
+            st.pFile.reset(new std::ifstream(sWavFile, std::ifstream::binary));
+
+        OLC_WAVEFORMATEX wavHeader;
+        if (!ReadWaveHeader(*st.pFile, wavHeader, st.bFloat, st.nDataSize))
+        {
+            st.pFile.reset();
+            st.pPackBuffer.reset();
+            return 0;
+        }
+        st.nDataStart = st.pFile->tellg();
+        st.nDataRead = 0;
+        st.nChannels = wavHeader.nChannels;
+        st.nSampleRate = wavHeader.nSamplesPerSec;
+        st.nBytes = wavHeader.wBitsPerSample / 8;
+        st.bLoop = bLoop;
+        st.vChunk.resize(STREAM_CHUNK_FRAMES * st.nChannels * st.nBytes);
+        st.vRing.resize(STREAM_RING_FRAMES * st.nChannels);
+        st.vScratch.resize(STREAM_CHUNK_FRAMES * st.nChannels);
+        st.nWritten = 0;
+        st.nRead = 0;
+        st.bEndOfData = false;
+
+        // Fill the ring now, so the voice has something to play from its first block
+        FillStream(st);
+
+        if (!m_bStreamThreadActive)
+        {
+            if (m_StreamThread.joinable())
+                m_StreamThread.join();
+            m_bStreamThreadActive = true;
+            m_StreamThread = std::thread(&SOUND::StreamThread);
+        }
+
+        st.nState.store(STREAM_PLAYING, std::memory_order_release);
+        uint32_t nVoice = StartVoice({sCommand::PLAY, 0, 0, bLoop, fVolume, fRate, nStream});
+        if (nVoice == 0)
+            st.nState.store(STREAM_RELEASED, std::memory_order_release);
+        return nVoice;
+    }
+
+    void SOUND::FillStream(sStream &st)
+    {
+        const unsigned int nFrameBytes = st.nChannels * st.nBytes;
+        while (!st.bEndOfData.load(std::memory_order_relaxed))
+        {
+            uint64_t nWritten = st.nWritten.load(std::memory_order_relaxed);
+            uint64_t nSpace = STREAM_RING_FRAMES - (nWritten - st.nRead.load(std::memory_order_acquire));
+            if (nSpace == 0)
+                break;
+
+            // Go back to the start of the data to loop, as long as there is some
+            uint32_t nFrames = (uint32_t)std::min<uint64_t>({nSpace, STREAM_CHUNK_FRAMES, (st.nDataSize - st.nDataRead) / nFrameBytes});
+            if (nFrames > 0)
+            {
+                st.pFile->read((char *)st.vChunk.data(), nFrames * nFrameBytes);
+                nFrames = (uint32_t)(st.pFile->gcount() / nFrameBytes);
+            }
+            if (nFrames == 0)
+            {
+                if (st.bLoop && st.nDataRead >= nFrameBytes)
+                {
+                    // A truncated file loops from where it really ends
+                    st.nDataSize = st.nDataRead;
+                    st.nDataRead = 0;
+                    st.pFile->clear();
+                    st.pFile->seekg(st.nDataStart);
+                    continue;
+                }
+                st.bEndOfData.store(true, std::memory_order_release);
+                break;
+            }
+
+            // Convert into the ring, in two parts if it wraps
+            uint32_t nStart = (uint32_t)(nWritten & (STREAM_RING_FRAMES - 1));
+            uint32_t nFirst = std::min(nFrames, STREAM_RING_FRAMES - nStart);
+            ConvertSamples(st.vChunk.data(), st.vRing.data() + nStart * st.nChannels, nFirst * st.nChannels, st.nBytes, st.bFloat);
+            ConvertSamples(st.vChunk.data() + nFirst * nFrameBytes, st.vRing.data(), (nFrames - nFirst) * st.nChannels, st.nBytes, st.bFloat);
+            st.nDataRead += nFrames * nFrameBytes;
+            st.nWritten.store(nWritten + nFrames, std::memory_order_release);
+        }
+    }
+
+    void SOUND::StreamThread()
+    {
+        while (m_bStreamThreadActive)
+        {
+            for (auto &st : m_Streams)
+            {
+                int nState = st.nState.load(std::memory_order_acquire);
+                if (nState == STREAM_PLAYING)
+                    FillStream(st);
+                else if (nState == STREAM_RELEASED)
+                {
+                    st.pFile.reset();
+                    st.pPackBuffer.reset();
+                    st.nState.store(STREAM_FREE, std::memory_order_release);
+                }
+            }
+
+            // The ring holds a third of a second at 44100Hz, so this has plenty of slack
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    void SOUND::StopStreams()
+    {
+        m_bStreamThreadActive = false;
+        if (m_StreamThread.joinable())
+            m_StreamThread.join();
+        for (auto &st : m_Streams)
+        {
+            st.pFile.reset();
+            st.pPackBuffer.reset();
+            st.nState = STREAM_FREE;
+        }
+    }
+
+    void SOUND::StopSample(int id)
+    {
+        PushCommand({sCommand::STOP_SAMPLE, id, 0, false, 0.0f});
+    }
+
+    void SOUND::StopVoice(uint32_t nVoice)
+    {
+        if (IsVoiceCurrent(nVoice))
+            PushCommand({sCommand::STOP_VOICE, 0, nVoice, false, 0.0f});
+    }
+
+    void SOUND::SetVoiceVolume(uint32_t nVoice, float fVolume)
+    {
+        if (!IsVoiceCurrent(nVoice))
+            return;
+        m_VoiceSlots[nVoice & (MAX_VOICES - 1)].fVolume = fVolume;
+        PushCommand({sCommand::SET_VOLUME, 0, nVoice, false, fVolume});
+    }
+
+    void SOUND::SetVoiceRate(uint32_t nVoice, float fRate)
+    {
+        if (IsVoiceCurrent(nVoice))
+            PushCommand({sCommand::SET_RATE, 0, nVoice, false, 0.0f, fRate});
+    }
+
+    void SOUND::SetVoicePan(uint32_t nVoice, float fPan)
+    {
+        if (IsVoiceCurrent(nVoice))
+            PushCommand({sCommand::SET_PAN, 0, nVoice, false, std::min(std::max(fPan, -1.0f), 1.0f)});
+    }
+
+    void SOUND::FadeVoice(uint32_t nVoice, float fTarget, float fSeconds, bool bExponential, bool bStop)
+    {
+        if (!IsVoiceCurrent(nVoice))
+            return;
+        m_VoiceSlots[nVoice & (MAX_VOICES - 1)].fVolume = fTarget;
+        sCommand cmd{sCommand::FADE, 0, nVoice, bStop, fTarget};
+        cmd.fX = std::max(fSeconds, 0.0f);
+        cmd.bExponential = bExponential;
+        PushCommand(cmd);
+    }
+
+    void SOUND::SetVoicePosition(uint32_t nVoice, float fX, float fY)
+    {
+        if (!IsVoiceCurrent(nVoice))
+            return;
+        sCommand cmd{sCommand::SET_POSITION, 0, nVoice, false, 0.0f};
+        cmd.fX = fX;
+        cmd.fY = fY;
+        PushCommand(cmd);
+    }
+
+    void SOUND::SetListenerPosition(float fX, float fY)
+    {
+        sCommand cmd{sCommand::SET_LISTENER, 0, 0, false, 0.0f};
+        cmd.fX = fX;
+        cmd.fY = fY;
+        PushCommand(cmd);
+    }
+
+    void SOUND::SetDistanceModel(float fMinDistance, float fMaxDistance)
+    {
+        sCommand cmd{sCommand::SET_DISTANCE_MODEL, 0, 0, false, 0.0f};
+        cmd.fX = std::max(fMinDistance, 0.0f);
+        cmd.fY = std::max(fMaxDistance, cmd.fX);
+        PushCommand(cmd);
+    }
+
+    void SOUND::StopAll()
+    {
+        PushCommand({sCommand::STOP_ALL, 0, 0, false, 0.0f});
+    }
+
+    void SOUND::MixBlock(short *pBlock, unsigned int nFrames, unsigned int nChannels, float fGlobalTime, float fTimeStep)
+    {
+        auto tpStart = std::chrono::steady_clock::now();
+        unsigned int nQueued = m_nCommandTail.load(std::memory_order_acquire) - m_nCommandHead.load(std::memory_order_relaxed);
+        ProcessCommands();
+
+        unsigned int nCount = nFrames * nChannels;
+        if (m_vecMixBlock.size() < nCount)
+            m_vecMixBlock.resize(nCount);
+        float *pMix = m_vecMixBlock.data();
+        std::fill(pMix, pMix + nCount, 0.0f);
+
+        // Each sample adds as much of itself as it can in one go, wrapping if it loops
+        for (unsigned int i = 0; i < m_nActiveVoices; i++)
+        {
+            sCurrentlyPlayingSample &s = m_Voices[m_ActiveVoices[i]];
+
+            // A stopped voice is given one more block to ramp down in, unless it
+            // hasnt been heard yet
+            if (s.bFlagForStop && !s.bGainSet)
+            {
+                s.bLoop = false;
+                s.bFinished = true;
+                continue;
+            }
+
+            // The gains ramp across the block from where the last one left off
+            float fStart[2], fEnd[2];
+            UpdateVoiceGains(s, nChannels, nFrames, fTimeStep, fEnd);
+            const bool bStopping = s.bFlagForStop;
+            if (bStopping)
+                fEnd[0] = fEnd[1] = 0.0f;
+            fStart[0] = s.bGainSet ? s.fGain[0] : fEnd[0];
+            fStart[1] = s.bGainSet ? s.fGain[1] : fEnd[1];
+            s.fGain[0] = fEnd[0];
+            s.fGain[1] = fEnd[1];
+            s.bGainSet = true;
+
+            // A sample ID that was never loaded plays nothing
+            const AudioSample *pSample = nullptr;
+            if (s.nStream < 0)
+            {
+                if (s.nAudioSampleID < 1 || (size_t)s.nAudioSampleID > m_vecSampleTable.size() || m_vecSampleTable[s.nAudioSampleID - 1] == nullptr)
+                {
+                    s.bFinished = true;
+                    continue;
+                }
+                pSample = m_vecSampleTable[s.nAudioSampleID - 1];
+            }
+            const unsigned int nSrcChannels = pSample != nullptr ? (unsigned int)pSample->nChannels : m_Streams[s.nStream].nChannels;
+            const unsigned int nSrcRate = pSample != nullptr ? pSample->nSampleRate : m_Streams[s.nStream].nSampleRate;
+
+            // A step within a rounding error of one counts as one, as fTimeStep is inexact
+            double dStep = (double)nSrcRate * (double)fTimeStep * (double)std::max(s.fRate, 0.0f);
+            if (std::abs(dStep - 1.0) <= 1e-6)
+                dStep = 1.0;
+
+            // Samples at the output rate, played at their own speed, are added straight
+            // from the sample, the gains at each run's ends following the block's ramp
+            if (pSample != nullptr && !pSample->bCompressed && dStep == 1.0 && s.fFraction == 0.0f)
+            {
+                const AudioSample &a = *pSample;
+                unsigned int n = 0;
+                while (n < nFrames)
+                {
+                    if (s.nSamplePosition >= a.nSamples)
+                    {
+                        if (s.bLoop && a.nSamples > 0)
+                            s.nSamplePosition = 0;
+                        else
+                        {
+                            s.bFinished = true; // Else sound has completed
+                            break;
+                        }
+                    }
+
+                    unsigned int nRun = (unsigned int)std::min((long)(nFrames - n), a.nSamples - s.nSamplePosition);
+                    float fRunStart[2], fRunEnd[2];
+                    for (unsigned int k = 0; k < 2; k++)
+                    {
+                        fRunStart[k] = fStart[k] + (fEnd[k] - fStart[k]) * (float)n / (float)nFrames;
+                        fRunEnd[k] = fStart[k] + (fEnd[k] - fStart[k]) * (float)(n + nRun) / (float)nFrames;
+                    }
+                    PanFrames(pMix + n * nChannels, nChannels, a.fSample + s.nSamplePosition * a.nChannels, a.nChannels, nRun, fRunStart, fRunEnd);
+                    s.nSamplePosition += nRun;
+                    n += nRun;
+                }
+            }
+            else
+            {
+                // Anything else is rendered as it is, then added in the same way
+                if (m_vecVoiceBlock.size() < nFrames * nSrcChannels)
+                    m_vecVoiceBlock.resize(nFrames * nSrcChannels);
+                float *pVoice = m_vecVoiceBlock.data();
+                std::fill(pVoice, pVoice + nFrames * nSrcChannels, 0.0f);
+
+                if (pSample == nullptr)
+                    MixStream(pVoice, nSrcChannels, m_Streams[s.nStream], s, nFrames, dStep);
+                else if (pSample->bCompressed)
+                    MixCompressed(pVoice, nSrcChannels, *pSample, s, nFrames, dStep);
+                else
+                {
+                    unsigned int n = 0;
+                    while (n < nFrames && !s.bFinished)
+                        n += MixResampled(pVoice + n * nSrcChannels, nSrcChannels, *pSample, s, nFrames - n, dStep);
+                }
+                PanFrames(pMix, nChannels, pVoice, nSrcChannels, nFrames, fStart, fEnd);
+            }
+
+            // Only now the stop's ramp has been heard is the voice done with
+            if (bStopping)
+            {
+                s.bLoop = false;
+                s.bFinished = true;
+            }
+        }
+
+        // If sounds have completed then remove them, and let the game thread reuse their slots
+        for (unsigned int i = 0; i < m_nActiveVoices;)
+        {
+            sCurrentlyPlayingSample &s = m_Voices[m_ActiveVoices[i]];
+            if (s.bFinished)
+            {
+                if (s.nStream >= 0)
+                    m_Streams[s.nStream].nState.store(STREAM_RELEASED, std::memory_order_release);
+                s.bActive = false;
+                m_nVoiceFinished[m_ActiveVoices[i]].store(s.nGeneration, std::memory_order_release);
+                m_ActiveVoices[i] = m_ActiveVoices[--m_nActiveVoices];
+            }
+            else
+                i++;
+        }
+
+        // The backends all run at a whole number of frames a second, so recover it
+        // exactly for the block hooks rather than pass on the rounding in fTimeStep
+        const double dTimeStep = 1.0 / std::round(1.0 / (double)fTimeStep);
+
+        // The users application might be generating sound, so grab that if it exists
+        if (funcUserSynth != nullptr)
+            for (unsigned int n = 0; n < nFrames; n++)
+                for (unsigned int c = 0; c < nChannels; c++)
+                    pMix[n * nChannels + c] += funcUserSynth(c, fGlobalTime + fTimeStep * (float)n, fTimeStep);
+        if (funcUserSynthBlock != nullptr)
+            funcUserSynthBlock(pMix, nFrames, nChannels, m_nGlobalFrame, dTimeStep);
+
+        // Then pass it through an optional user override to filter the sound
+        if (funcUserFilter != nullptr)
+            for (unsigned int n = 0; n < nFrames; n++)
+                for (unsigned int c = 0; c < nChannels; c++)
+                    pMix[n * nChannels + c] = funcUserFilter(c, fGlobalTime + fTimeStep * (float)n, pMix[n * nChannels + c]);
+        if (funcUserFilterBlock != nullptr)
+            funcUserFilterBlock(pMix, nFrames, nChannels, m_nGlobalFrame, dTimeStep);
+
+        ConvertBlock(pMix, pBlock, nCount);
+        m_nGlobalFrame += nFrames;
+
+        // Render time as a fraction of the time the block lasts
+        uint64_t nRenderNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tpStart).count();
+        double dBudgetNs = (double)nFrames * (double)fTimeStep * 1e9;
+        unsigned int nBucket = (unsigned int)std::min((double)(STATS_HISTOGRAM_BUCKETS - 1), (double)nRenderNs * 8.0 / std::max(dBudgetNs, 1.0));
+        m_Stats.nBlocks.fetch_add(1, std::memory_order_relaxed);
+        m_Stats.nBlockFrames.store(nFrames, std::memory_order_relaxed);
+        m_Stats.fTimeStep.store(fTimeStep, std::memory_order_relaxed);
+        m_Stats.nRenderNs.store(nRenderNs, std::memory_order_relaxed);
+        m_Stats.nRenderNsTotal.fetch_add(nRenderNs, std::memory_order_relaxed);
+        if (nRenderNs > m_Stats.nRenderNsMax.load(std::memory_order_relaxed))
+            m_Stats.nRenderNsMax.store(nRenderNs, std::memory_order_relaxed);
+        m_Stats.nRenderHistogram[nBucket].fetch_add(1, std::memory_order_relaxed);
+        m_Stats.nActiveVoices.store(m_nActiveVoices, std::memory_order_relaxed);
+        if (m_nActiveVoices > m_Stats.nActiveVoicesMax.load(std::memory_order_relaxed))
+            m_Stats.nActiveVoicesMax.store(m_nActiveVoices, std::memory_order_relaxed);
+        m_Stats.nCommandQueueDepth.store(nQueued, std::memory_order_relaxed);
+        if (nQueued > m_Stats.nCommandQueueDepthMax.load(std::memory_order_relaxed))
+            m_Stats.nCommandQueueDepthMax.store(nQueued, std::memory_order_relaxed);
+    }
+
+    void SOUND::RecordHeadroom(uint64_t nFramesQueued)
+    {
+        uint64_t nBlockFrames = std::max<uint64_t>(m_Stats.nBlockFrames.load(std::memory_order_relaxed), 1);
+        m_Stats.nHeadroomFrames.store(nFramesQueued, std::memory_order_relaxed);
+        if (nFramesQueued < m_Stats.nHeadroomFramesMin.load(std::memory_order_relaxed))
+            m_Stats.nHeadroomFramesMin.store(nFramesQueued, std::memory_order_relaxed);
+        m_Stats.nHeadroomHistogram[std::min<uint64_t>(nFramesQueued / nBlockFrames, STATS_HISTOGRAM_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SOUND::AudioStats SOUND::GetAudioStats()
+    {
+        AudioStats stats;
+        double dFrameUs = (double)m_Stats.fTimeStep.load(std::memory_order_relaxed) * 1e6;
+        uint64_t nHeadroomMin = m_Stats.nHeadroomFramesMin.load(std::memory_order_relaxed);
+        stats.nBlocks = m_Stats.nBlocks.load(std::memory_order_relaxed);
+        stats.nUnderruns = m_Stats.nUnderruns.load(std::memory_order_relaxed);
+        stats.nStreamUnderruns = m_Stats.nStreamUnderruns.load(std::memory_order_relaxed);
+        stats.fBlockBudget = (float)((double)m_Stats.nBlockFrames.load(std::memory_order_relaxed) * dFrameUs);
+        stats.fRenderTime = (float)m_Stats.nRenderNs.load(std::memory_order_relaxed) / 1000.0f;
+        stats.fRenderTimeMean = stats.nBlocks > 0 ? (float)((double)m_Stats.nRenderNsTotal.load(std::memory_order_relaxed) / 1000.0 / (double)stats.nBlocks) : 0.0f;
+        stats.fRenderTimeMax = (float)m_Stats.nRenderNsMax.load(std::memory_order_relaxed) / 1000.0f;
+        stats.fHeadroom = (float)((double)m_Stats.nHeadroomFrames.load(std::memory_order_relaxed) * dFrameUs);
+        stats.fHeadroomMin = nHeadroomMin == UINT64_MAX ? 0.0f : (float)((double)nHeadroomMin * dFrameUs);
+        stats.nActiveVoices = m_Stats.nActiveVoices.load(std::memory_order_relaxed);
+        stats.nActiveVoicesMax = m_Stats.nActiveVoicesMax.load(std::memory_order_relaxed);
+        stats.nCommandQueueDepth = m_Stats.nCommandQueueDepth.load(std::memory_order_relaxed);
+        stats.nCommandQueueDepthMax = m_Stats.nCommandQueueDepthMax.load(std::memory_order_relaxed);
+        for (unsigned int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        {
+            stats.nRenderHistogram[i] = m_Stats.nRenderHistogram[i].load(std::memory_order_relaxed);
+            stats.nHeadroomHistogram[i] = m_Stats.nHeadroomHistogram[i].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    void SOUND::ResetAudioStats()
+    {
+        m_Stats.nBlocks = 0;
+        m_Stats.nUnderruns = 0;
+        m_Stats.nStreamUnderruns = 0;
+        m_Stats.nRenderNs = 0;
+        m_Stats.nRenderNsTotal = 0;
+        m_Stats.nRenderNsMax = 0;
+        m_Stats.nHeadroomFrames = 0;
+        m_Stats.nHeadroomFramesMin = UINT64_MAX;
+        m_Stats.nActiveVoices = 0;
+        m_Stats.nActiveVoicesMax = 0;
+        m_Stats.nCommandQueueDepth = 0;
+        m_Stats.nCommandQueueDepthMax = 0;
+        for (unsigned int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        {
+            m_Stats.nRenderHistogram[i] = 0;
+            m_Stats.nHeadroomHistogram[i] = 0;
+        }
+    }
+
+    void SOUND::MixFrames(float *pMix, unsigned int nChannels, const float *pSrc, unsigned int nSrcChannels, unsigned int nFrames, float fGain)
+    {
+        // Matching layouts are one contiguous run
+        if (nSrcChannels == nChannels)
+        {
+            unsigned int nCount = nFrames * nChannels;
+            unsigned int i = 0;
+#ifdef OLC_SOUND_SSE
+            const __m128 vGain = _mm_set1_ps(fGain);
+            for (; i + 4 <= nCount; i += 4)
+                _mm_storeu_ps(pMix + i, _mm_add_ps(_mm_loadu_ps(pMix + i), _mm_mul_ps(_mm_loadu_ps(pSrc + i), vGain)));
+#endif
+            for (; i < nCount; i++)
+                pMix[i] += pSrc[i] * fGain;
+            return;
+        }
+
+        // Otherwise the sample's channels repeat across the output, so mono plays
+        // from every speaker, and any extra channels are dropped
+        for (unsigned int c = 0; c < nChannels; c++)
+        {
+            const float *pIn = pSrc + c % nSrcChannels;
+            float *pOut = pMix + c;
+            for (unsigned int n = 0; n < nFrames; n++)
+                pOut[n * nChannels] += pIn[n * nSrcChannels] * fGain;
+        }
+    }
+
+    void SOUND::UpdateVoiceGains(sCurrentlyPlayingSample &s, unsigned int nChannels, unsigned int nFrames, float fTimeStep, float *fGain)
+    {
+        // Exponential fades cant start or end at silence, so run between -60dB instead
+        const float fFloor = 0.001f;
+        if (s.bFadePending)
+        {
+            s.bFadePending = false;
+            s.nFadeFrames = std::max(1L, (long)std::lround(s.fFadeTime / fTimeStep));
+            if (s.bFadeExponential)
+            {
+                s.fVolume = std::max(s.fVolume, fFloor);
+                s.fFadeStep = std::pow(std::max(s.fFadeTarget, fFloor) / s.fVolume, 1.0f / (float)s.nFadeFrames);
+            }
+            else
+                s.fFadeStep = (s.fFadeTarget - s.fVolume) / (float)s.nFadeFrames;
+        }
+
+        // The curve is followed exactly at block boundaries, and linearly between
+        if (s.nFadeFrames > 0)
+        {
+            long nStep = std::min((long)nFrames, s.nFadeFrames);
+            s.nFadeFrames -= nStep;
+            if (s.nFadeFrames == 0)
+            {
+                s.fVolume = s.fFadeTarget;
+                if (s.bStopAfterFade)
+                    s.bFlagForStop = true;
+            }
+            else if (s.bFadeExponential)
+                s.fVolume *= std::pow(s.fFadeStep, (float)nStep);
+            else
+                s.fVolume += s.fFadeStep * (float)nStep;
+        }
+
+        float fVolume = s.fVolume;
+        float fPan = s.fPan;
+        if (s.bPositional)
+        {
+            float dx = s.fX - m_fListenerX, dy = s.fY - m_fListenerY;
+            float fDistance = std::sqrt(dx * dx + dy * dy);
+            if (fDistance >= m_fMaxDistance)
+                fVolume = 0.0f;
+            else if (fDistance > m_fMinDistance)
+                fVolume *= (m_fMaxDistance - fDistance) / (m_fMaxDistance - m_fMinDistance);
+
+            // Sounds to one side pan fully once clear of the listener
+            fPan += dx / std::max({fDistance, m_fMinDistance, 1e-6f});
+            fPan = std::min(std::max(fPan, -1.0f), 1.0f);
+        }
+
+        // Centre keeps both sides at full volume, so unpanned voices sound as before,
+        // and turning away from a side fades it out along a quarter cosine
+        const float fHalfPi = 1.57079632679f;
+        fGain[0] = fGain[1] = fVolume;
+        if (nChannels > 1)
+        {
+            if (fPan > 0.0f)
+                fGain[0] *= std::cos(fPan * fHalfPi);
+            else if (fPan < 0.0f)
+                fGain[1] *= std::cos(-fPan * fHalfPi);
+        }
+    }
+
+    void SOUND::PanFrames(float *pMix, unsigned int nChannels, const float *pSrc, unsigned int nSrcChannels, unsigned int nFrames, const float *fStart, const float *fEnd)
+    {
+        if (nFrames == 0)
+            return;
+        const float fStep[2] = {(fEnd[0] - fStart[0]) / (float)nFrames, (fEnd[1] - fStart[1]) / (float)nFrames};
+        unsigned int n = 0;
+
+#ifdef OLC_SOUND_SSE
+        // The common layouts a few frames at a time, stepping the gains along with them
+        if (nChannels == 2 && nSrcChannels == 2)
+        {
+            __m128 vGain = _mm_setr_ps(fStart[0], fStart[1], fStart[0] + fStep[0], fStart[1] + fStep[1]);
+            const __m128 vStep = _mm_setr_ps(2.0f * fStep[0], 2.0f * fStep[1], 2.0f * fStep[0], 2.0f * fStep[1]);
+            for (; n + 2 <= nFrames; n += 2, vGain = _mm_add_ps(vGain, vStep))
+                _mm_storeu_ps(pMix + n * 2, _mm_add_ps(_mm_loadu_ps(pMix + n * 2), _mm_mul_ps(_mm_loadu_ps(pSrc + n * 2), vGain)));
+        }
+        else if (nChannels == 2 && nSrcChannels == 1)
+        {
+            __m128 vGain0 = _mm_setr_ps(fStart[0], fStart[1], fStart[0] + fStep[0], fStart[1] + fStep[1]);
+            __m128 vGain1 = _mm_setr_ps(fStart[0] + 2.0f * fStep[0], fStart[1] + 2.0f * fStep[1], fStart[0] + 3.0f * fStep[0], fStart[1] + 3.0f * fStep[1]);
+            const __m128 vStep = _mm_setr_ps(4.0f * fStep[0], 4.0f * fStep[1], 4.0f * fStep[0], 4.0f * fStep[1]);
+            for (; n + 4 <= nFrames; n += 4, vGain0 = _mm_add_ps(vGain0, vStep), vGain1 = _mm_add_ps(vGain1, vStep))
+            {
+                __m128 v = _mm_loadu_ps(pSrc + n);
+                _mm_storeu_ps(pMix + n * 2, _mm_add_ps(_mm_loadu_ps(pMix + n * 2), _mm_mul_ps(_mm_unpacklo_ps(v, v), vGain0)));
+                _mm_storeu_ps(pMix + n * 2 + 4, _mm_add_ps(_mm_loadu_ps(pMix + n * 2 + 4), _mm_mul_ps(_mm_unpackhi_ps(v, v), vGain1)));
+            }
+        }
+        else if (nChannels == 1 && nSrcChannels == 1)
+        {
+            __m128 vGain = _mm_setr_ps(fStart[0], fStart[0] + fStep[0], fStart[0] + 2.0f * fStep[0], fStart[0] + 3.0f * fStep[0]);
+            const __m128 vStep = _mm_set1_ps(4.0f * fStep[0]);
+            for (; n + 4 <= nFrames; n += 4, vGain = _mm_add_ps(vGain, vStep))
+                _mm_storeu_ps(pMix + n, _mm_add_ps(_mm_loadu_ps(pMix + n), _mm_mul_ps(_mm_loadu_ps(pSrc + n), vGain)));
+        }
+#endif
+
+        // The rest, and any other layout, with the sample's channels repeating across
+        // the output as MixFrames does
+        for (; n < nFrames; n++)
+            for (unsigned int c = 0; c < nChannels; c++)
+            {
+                unsigned int nSide = nChannels > 1 ? c & 1 : 0;
+                pMix[n * nChannels + c] += pSrc[n * nSrcChannels + c % nSrcChannels] * (fStart[nSide] + fStep[nSide] * (float)n);
+            }
+    }
 
-            // Read Wave description chunk
-            is.read(dump, sizeof(char) * 4); // Read "fmt "
-            unsigned int nHeaderSize = 0;
-            is.read((char *)&nHeaderSize, sizeof(unsigned int)); // Not Interested
-            is.read((char *)&wavHeader, nHeaderSize);            // sizeof(WAVEFORMATEX)); // Read Wave Format Structure chunk
-                                                                 // Note the -2, because the structure has 2 bytes to indicate its own size
-                                                                 // which are not in the wav file
+    unsigned int SOUND::MixResampled(float *pMix, unsigned int nChannels, const AudioSample &a, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep)
+    {
+        const long nSamples = a.nSamples;
+        const unsigned int nSrcChannels = (unsigned int)a.nChannels;
+        if (s.nSamplePosition >= nSamples)
+        {
+            if (s.bLoop && nSamples > 0)
+                s.nSamplePosition %= nSamples;
+            else
+            {
+                s.bFinished = true;
+                return 0;
+            }
+        }
 
-            // Just check if wave format is compatible with olcPGE
-            if (wavHeader.wBitsPerSample != 16 || wavHeader.nSamplesPerSec != 44100)
-                return olc::FAIL;
+        // Frames before the end of the sample, or before it wraps if looping
+        double dStart = (double)s.nSamplePosition + (double)s.fFraction;
+        unsigned int nRun = (unsigned int)std::min((double)nFrames, std::ceil(((double)nSamples - dStart) / dStep));
 
-            // Search for audio data chunk
-            uint32_t nChunksize = 0;
-            is.read(dump, sizeof(char) * 4);                // Read chunk header
-            is.read((char *)&nChunksize, sizeof(uint32_t)); // Read chunk size
-            while (strncmp(dump, "data", 4) != 0)
+        // Reads outside the sample wrap around a loop, or are silent
+        auto Fetch = [&](long i, unsigned int c) {
+            if (i < 0 || i >= nSamples)
             {
-                // Not audio data, so just skip it
-                //std::fseek(f, nChunksize, SEEK_CUR);
-                is.seekg(nChunksize, std::istream::cur);
-                is.read(dump, sizeof(char) * 4);
-                is.read((char *)&nChunksize, sizeof(uint32_t));
+                if (!s.bLoop)
+                    return 0.0f;
+                i = (i % nSamples + nSamples) % nSamples;
             }
+            return a.fSample[i * nSrcChannels + c];
+        };
 
-            // Finally got to data, so read it all in and convert to float samples
-            nSamples = nChunksize / (wavHeader.nChannels * (wavHeader.wBitsPerSample >> 3));
-            nChannels = wavHeader.nChannels;
+        // Step in 32.32 fixed point, so the position never drifts within a run
+        const double dFixed = 4294967296.0;
+        uint64_t nPos = (uint64_t)(dStart * dFixed), nStep = (uint64_t)(dStep * dFixed);
+        for (unsigned int n = 0; n < nRun; n++, nPos += nStep)
+        {
+            long i = (long)(nPos >> 32);
+            float t = (float)(uint32_t)nPos * (1.0f / 4294967296.0f);
 
-            // Create floating point buffer to hold audio sample
-            fSample = new float[nSamples * nChannels];
-            float *pSample = fSample;
+            // Catmull-Rom weights for the frames either side
+            float w0 = 0.5f * t * ((2.0f - t) * t - 1.0f);
+            float w1 = 0.5f * (t * t * (3.0f * t - 5.0f) + 2.0f);
+            float w2 = 0.5f * t * ((4.0f - 3.0f * t) * t + 1.0f);
+            float w3 = 0.5f * t * t * (t - 1.0f);
 
-            // Read in audio data and normalise
-            for (long i = 0; i < nSamples; i++)
+            float *pOut = pMix + n * nChannels;
+            if (i >= 1 && i + 2 < nSamples)
             {
-                for (int c = 0; c < nChannels; c++)
+                const float *p = a.fSample + (i - 1) * nSrcChannels;
+                if (nSrcChannels == 1)
                 {
-                    short s = 0;
-                    if (!is.eof())
+                    // Mono taps are contiguous, and the result goes to every channel
+#ifdef OLC_SOUND_SSE
+                    __m128 v = _mm_mul_ps(_mm_loadu_ps(p), _mm_set_ps(w3, w2, w1, w0));
+                    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+                    float fOut = _mm_cvtss_f32(_mm_add_ss(v, _mm_shuffle_ps(v, v, 1)));
+#else
+                    float fOut = w0 * p[0] + w1 * p[1] + w2 * p[2] + w3 * p[3];
+#endif
+                    for (unsigned int c = 0; c < nChannels; c++)
+                        pOut[c] += fOut;
+                }
+                else
+                    for (unsigned int c = 0; c < nChannels; c++)
                     {
-                        is.read((char *)&s, sizeof(short));
-
-                        *pSample = (float)s / (float)(SHRT_MAX);
-                        pSample++;
+                        unsigned int sc = c % nSrcChannels;
+                        pOut[c] += w0 * p[sc] + w1 * p[nSrcChannels + sc] + w2 * p[2 * nSrcChannels + sc] + w3 * p[3 * nSrcChannels + sc];
                     }
+            }
+            else
+            {
+                for (unsigned int c = 0; c < nChannels; c++)
+                {
+                    unsigned int sc = c % nSrcChannels;
+                    pOut[c] += w0 * Fetch(i - 1, sc) + w1 * Fetch(i, sc) + w2 * Fetch(i + 1, sc) + w3 * Fetch(i + 2, sc);
                 }
             }
+        }
 
-            // All done, flag sound as valid
-            bSampleValid = true;
-            return olc::OK;
-        };
+        s.nSamplePosition = (long)(nPos >> 32);
+        s.fFraction = (float)((double)(uint32_t)nPos / dFixed);
+        return nRun;
+    }
 
-        if (pack != nullptr)
-        {
-            olc::ResourceBuffer rb = pack->GetFileBuffer(sWavFile);
-            std::istream is(&rb);
-            return ReadWave(is);
-        }
-        else
+    void SOUND::MixStream(float *pMix, unsigned int nChannels, sStream &st, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep)
+    {
+        const unsigned int nSrcChannels = st.nChannels;
+        const uint64_t nScratchFrames = st.vScratch.size() / nSrcChannels;
+        unsigned int n = 0;
+        while (n < nFrames)
         {
-            // Read from file
-            std::ifstream ifs(sWavFile, std::ifstream::binary);
-            if (ifs.is_open())
+            // The end flag is read first, so when it is set the frame count is final
+            bool bEnd = st.bEndOfData.load(std::memory_order_acquire);
+            uint64_t nWritten = st.nWritten.load(std::memory_order_acquire);
+            uint64_t nRead = st.nRead.load(std::memory_order_relaxed);
+
+            // Line up what is buffered, from the frame before the voice's position, up to
+            // the last frame the rest of the block could interpolate from
+            uint64_t nNeeded = (uint64_t)std::max(0L, s.nSamplePosition - (long)nRead) + (uint64_t)std::ceil((double)(nFrames - n) * dStep) + 4;
+            uint32_t nCopy = (uint32_t)std::min({nWritten - nRead, nScratchFrames, nNeeded});
+            uint32_t nStart = (uint32_t)(nRead & (STREAM_RING_FRAMES - 1));
+            uint32_t nFirst = std::min(nCopy, STREAM_RING_FRAMES - nStart);
+            std::copy(st.vRing.data() + nStart * nSrcChannels, st.vRing.data() + (nStart + nFirst) * nSrcChannels, st.vScratch.data());
+            std::copy(st.vRing.data(), st.vRing.data() + (nCopy - nFirst) * nSrcChannels, st.vScratch.data() + nFirst * nSrcChannels);
+            bool bAll = bEnd && nRead + nCopy == nWritten;
+
+            AudioSample a;
+            a.fSample = st.vScratch.data();
+            a.nSamples = nCopy;
+            a.nChannels = (int)nSrcChannels;
+            sCurrentlyPlayingSample v = s;
+            v.nSamplePosition -= (long)nRead;
+            v.bLoop = false;
+
+            unsigned int nMix = 0;
+            if (dStep == 1.0 && v.fFraction == 0.0f)
             {
-                return ReadWave(ifs);
+                nMix = (unsigned int)std::max(0L, std::min((long)(nFrames - n), a.nSamples - v.nSamplePosition));
+                MixFrames(pMix + n * nChannels, nChannels, a.fSample + v.nSamplePosition * nSrcChannels, nSrcChannels, nMix, 1.0f);
+                v.nSamplePosition += nMix;
             }
             else
-                return olc::FAIL;
-        }
-    }
+            {
+                // Only the frames whose taps are all buffered, unless the stream has ended
+                double dAhead = (double)nCopy - 2.0 - ((double)v.nSamplePosition + (double)v.fFraction);
+                unsigned int nLimit = bAll ? nFrames - n : (dAhead > 0.0 ? (unsigned int)std::min((double)(nFrames - n), std::ceil(dAhead / dStep)) : 0);
+                if (nLimit > 0)
+                    nMix = MixResampled(pMix + n * nChannels, nChannels, a, v, nLimit, dStep);
+            }
 
-    // This vector holds all loaded sound samples in memory
-    std::vector<olc::SOUND::AudioSample> vecAudioSamples;
+            s.nSamplePosition = v.nSamplePosition + (long)nRead;
+            s.fFraction = v.fFraction;
+            n += nMix;
+            if (bAll && (uint64_t)s.nSamplePosition >= nWritten)
+            {
+                s.bFinished = true;
+                return;
+            }
 
-    // This structure represents a sound that is currently playing. It only
-    // holds the sound ID and where this instance of it is up to for its
-    // current playback
+            // Hand back the frames no longer needed, keeping one behind for interpolation
+            uint64_t nKeep = std::min<uint64_t>(s.nSamplePosition > 0 ? s.nSamplePosition - 1 : 0, nWritten);
+            if (nKeep > nRead)
+                st.nRead.store(nKeep, std::memory_order_release);
 
-    void SOUND::SetUserSynthFunction(std::function<float(int, float, float)> func)
-    {
-        funcUserSynth = func;
+            // Nothing buffered, the rest of this block is silent until the decoder catches up
+            if (nMix == 0)
+            {
+                m_Stats.nStreamUnderruns.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
     }
 
-    void SOUND::SetUserFilterFunction(std::function<float(int, float, float)> func)
+    void SOUND::DecodeADPCM(const AudioSample &a, long nFirst, long nCount, bool bLoop, float *pOut)
     {
-        funcUserFilter = func;
+        const unsigned int nSrcChannels = (unsigned int)a.nChannels;
+
+        // Channel blocks are gathered and decoded together, then their wanted frames copied out
+        struct sPart
+        {
+            const uint8_t *pBlock;
+            long nOffset;
+            long nRun;
+            float *pDest;
+        };
+        sPart parts[ADPCM_DECODE_LANES];
+        unsigned int nParts = 0;
+        alignas(16) float fBlocks[ADPCM_DECODE_LANES][ADPCM_BLOCK_FRAMES];
+        auto Flush = [&]() {
+            if (nParts == 0)
+                return;
+            const uint8_t *pBlocks[ADPCM_DECODE_LANES] = {};
+            float *pDecoded[ADPCM_DECODE_LANES] = {};
+            for (unsigned int k = 0; k < nParts; k++)
+            {
+                pBlocks[k] = parts[k].pBlock;
+                pDecoded[k] = fBlocks[k];
+            }
+            DecodeADPCMBlocks(pBlocks, pDecoded, nParts);
+            for (unsigned int k = 0; k < nParts; k++)
+                for (long f = 0; f < parts[k].nRun; f++)
+                    parts[k].pDest[f * nSrcChannels] = fBlocks[k][parts[k].nOffset + f];
+            nParts = 0;
+        };
+
+        long n = 0;
+        while (n < nCount)
+        {
+            long i = nFirst + n;
+            if (i < 0 || i >= a.nSamples)
+            {
+                if (!bLoop || a.nSamples == 0)
+                {
+                    // Silence up to the start of the sample, or all the rest after it
+                    long nRun = i < 0 ? std::min(nCount - n, -i) : nCount - n;
+                    std::fill(pOut + n * nSrcChannels, pOut + (n + nRun) * nSrcChannels, 0.0f);
+                    n += nRun;
+                    continue;
+                }
+                i = (i % a.nSamples + a.nSamples) % a.nSamples;
+            }
+
+            // As much of this block as is wanted, without running past the sample
+            long nBlock = i / ADPCM_BLOCK_FRAMES;
+            long nOffset = i - nBlock * ADPCM_BLOCK_FRAMES;
+            long nRun = std::min({nCount - n, (long)ADPCM_BLOCK_FRAMES - nOffset, a.nSamples - i});
+            for (unsigned int c = 0; c < nSrcChannels; c++)
+            {
+                parts[nParts++] = {a.vADPCM.data() + (nBlock * nSrcChannels + c) * ADPCM_BLOCK_BYTES, nOffset, nRun, pOut + n * nSrcChannels + c};
+                if (nParts == ADPCM_DECODE_LANES)
+                    Flush();
+            }
+            n += nRun;
+        }
+        Flush();
     }
 
-    // Load a 16-bit WAVE file @ 44100Hz ONLY into memory. A sample ID
-    // number is returned if successful, otherwise -1
-    int SOUND::LoadAudioSample(std::string sWavFile, olc::ResourcePack *pack)
+    void SOUND::MixCompressed(float *pMix, unsigned int nChannels, const AudioSample &a, sCurrentlyPlayingSample &s, unsigned int nFrames, double dStep)
     {
-
-        olc::SOUND::AudioSample a(sWavFile, pack);
-        if (a.bSampleValid)
+        const unsigned int nSrcChannels = (unsigned int)a.nChannels;
+        const unsigned int nWindowFrames = 4 * ADPCM_BLOCK_FRAMES;
+        if (m_vecDecodeBlock.size() < nWindowFrames * nSrcChannels)
+            m_vecDecodeBlock.resize(nWindowFrames * nSrcChannels);
+        float *pDecoded = m_vecDecodeBlock.data();
+
+        unsigned int n = 0;
+        while (n < nFrames)
         {
-            vecAudioSamples.push_back(a);
-            return (unsigned int)vecAudioSamples.size();
+            if (s.nSamplePosition >= a.nSamples)
+            {
+                if (s.bLoop && a.nSamples > 0)
+                    s.nSamplePosition %= a.nSamples;
+                else
+                {
+                    s.bFinished = true; // Else sound has completed
+                    return;
+                }
+            }
+
+            if (dStep == 1.0 && s.fFraction == 0.0f)
+            {
+                unsigned int nRun = (unsigned int)std::min({(long)(nFrames - n), (long)nWindowFrames, a.nSamples - s.nSamplePosition});
+                DecodeADPCM(a, s.nSamplePosition, nRun, false, pDecoded);
+                MixFrames(pMix + n * nChannels, nChannels, pDecoded, nSrcChannels, nRun, 1.0f);
+                s.nSamplePosition += nRun;
+                n += nRun;
+                continue;
+            }
+
+            // Decode every tap the next frames need, up to the end of the sample or the
+            // window, and resample from that as if it were the whole sample
+            double dStart = (double)s.nSamplePosition + (double)s.fFraction;
+            unsigned int nRun = (unsigned int)std::max(1.0, std::min({(double)(nFrames - n), std::floor((nWindowFrames - 4) / dStep), std::ceil(((double)a.nSamples - dStart) / dStep)}));
+            long nFirst = s.nSamplePosition - 1;
+            long nLast = (long)(dStart + (double)(nRun - 1) * dStep) + 2;
+            DecodeADPCM(a, nFirst, std::min(nLast - nFirst + 1, (long)nWindowFrames), s.bLoop, pDecoded);
+
+            AudioSample w;
+            w.fSample = pDecoded;
+            w.nSamples = std::min(nLast - nFirst + 1, (long)nWindowFrames);
+            w.nChannels = a.nChannels;
+            sCurrentlyPlayingSample v = s;
+            v.nSamplePosition = 1;
+            v.bLoop = false;
+            unsigned int nMixed = MixResampled(pMix + n * nChannels, nChannels, w, v, nRun, dStep);
+            s.nSamplePosition = nFirst + v.nSamplePosition;
+            s.fFraction = v.fFraction;
+            n += nMixed;
+            if (nMixed == 0)
+                return;
         }
-        else
-            return -1;
     }
 
-    // Add sample 'id' to the mixers sounds to play list
-    void SOUND::PlaySample(int id, bool bLoop)
+    void SOUND::Oscillator::Render(float *pOut, unsigned int nFrames, double dTimeStep)
     {
-        olc::SOUND::sCurrentlyPlayingSample a;
-        a.nAudioSampleID = id;
-        a.nSamplePosition = 0;
-        a.bFinished = false;
-        a.bFlagForStop = false;
-        a.bLoop = bLoop;
-        SOUND::listActiveSamples.push_back(a);
+        const double dStep = std::max(dFrequency, 0.0) * dTimeStep;
+        const float fTwoPi = 6.28318530718f;
+
+        // Phases are worked out in float from a base kept in double, which is moved
+        // on every run so the offsets stay small enough to be exact
+        const unsigned int nRunFrames = 64;
+        for (unsigned int nRunStart = 0; nRunStart < nFrames; nRunStart += nRunFrames)
+        {
+            unsigned int nRun = std::min(nRunFrames, nFrames - nRunStart);
+            float *p = pOut + nRunStart;
+            const float fBase = (float)dPhase, fStep = (float)dStep;
+            unsigned int n = 0;
+
+#ifdef OLC_SOUND_SSE
+            if (nWave == SINE)
+            {
+                // Four phases at a time, folded into the quarter cycle either side of
+                // zero and put through a ninth order polynomial
+                const __m128 vSign = _mm_set1_ps(-0.0f), vHalf = _mm_set1_ps(0.5f), vQuarter = _mm_set1_ps(0.25f);
+                const __m128 vAmplitude = _mm_set1_ps(fAmplitude), vTwoPi = _mm_set1_ps(fTwoPi);
+                __m128 vIndex = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+                for (; n + 4 <= nRun; n += 4, vIndex = _mm_add_ps(vIndex, _mm_set1_ps(4.0f)))
+                {
+                    __m128 vPhase = _mm_add_ps(_mm_set1_ps(fBase), _mm_mul_ps(vIndex, _mm_set1_ps(fStep)));
+                    vPhase = _mm_sub_ps(vPhase, _mm_cvtepi32_ps(_mm_cvttps_epi32(vPhase)));
+                    __m128 x = _mm_sub_ps(vPhase, vHalf);
+                    __m128 vFold = _mm_cmpgt_ps(_mm_andnot_ps(vSign, x), vQuarter);
+                    __m128 vMirror = _mm_sub_ps(_mm_or_ps(vHalf, _mm_and_ps(vSign, x)), x);
+                    x = _mm_mul_ps(_mm_or_ps(_mm_and_ps(vFold, vMirror), _mm_andnot_ps(vFold, x)), vTwoPi);
+                    __m128 x2 = _mm_mul_ps(x, x);
+                    __m128 y = _mm_add_ps(_mm_set1_ps(-1.0f / 5040.0f), _mm_mul_ps(x2, _mm_set1_ps(1.0f / 362880.0f)));
+                    y = _mm_add_ps(_mm_set1_ps(1.0f / 120.0f), _mm_mul_ps(x2, y));
+                    y = _mm_add_ps(_mm_set1_ps(-1.0f / 6.0f), _mm_mul_ps(x2, y));
+                    y = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x2, y));
+                    // Half a cycle on from where x was measured, so the sign flips
+                    y = _mm_mul_ps(_mm_mul_ps(x, y), vAmplitude);
+                    _mm_storeu_ps(p + n, _mm_sub_ps(_mm_loadu_ps(p + n), y));
+                }
+            }
+#endif
+
+            // Branch free, so the compiler can vectorise them too
+            for (; n < nRun; n++)
+            {
+                float fPhase = fBase + fStep * (float)n;
+                fPhase -= (float)(int)fPhase;
+                float fValue;
+                switch (nWave)
+                {
+                case SQUARE:
+                    fValue = fPhase < 0.5f ? 1.0f : -1.0f;
+                    break;
+                case SAW:
+                    fValue = 2.0f * fPhase - 1.0f;
+                    break;
+                case TRIANGLE:
+                    fValue = 1.0f - 4.0f * std::abs(fPhase - 0.25f - (fPhase > 0.75f ? 1.0f : 0.0f));
+                    break;
+                default:
+                    fValue = std::sin(fTwoPi * fPhase);
+                    break;
+                }
+                p[n] += fValue * fAmplitude;
+            }
+
+            dPhase += dStep * (double)nRun;
+            dPhase -= std::floor(dPhase);
+        }
     }
 
-    void SOUND::StopSample(int id)
+    void SOUND::Envelope::NoteOn()
     {
-        // Find first occurence of sample id
-        auto s = std::find_if(listActiveSamples.begin(), listActiveSamples.end(), [&](const olc::SOUND::sCurrentlyPlayingSample &s) { return s.nAudioSampleID == id; });
-        if (s != listActiveSamples.end())
-            s->bFlagForStop = true;
+        nStage = ATTACK;
     }
 
-    void SOUND::StopAll()
+    void SOUND::Envelope::NoteOff()
     {
-        for (auto &s : listActiveSamples)
+        if (nStage != IDLE)
         {
-            s.bFlagForStop = true;
+            nStage = RELEASE;
+            fReleaseFrom = fLevel;
         }
     }
 
-    float SOUND::GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep)
+    bool SOUND::Envelope::IsFinished() const
     {
-        // Accumulate sample for this channel
-        float fMixerSample = 0.0f;
+        return nStage == IDLE;
+    }
 
-        for (auto &s : listActiveSamples)
+    void SOUND::Envelope::Apply(float *pBuffer, unsigned int nFrames, double dTimeStep)
+    {
+        // Each stage is a straight line to its target, so a run of it is one ramp
+        const float fTimeStep = (float)dTimeStep;
+        unsigned int n = 0;
+        while (n < nFrames)
         {
-            if (m_bAudioThreadActive)
+            float fTarget = 0.0f, fStep = 0.0f;
+            switch (nStage)
             {
-                if (s.bFlagForStop)
-                {
-                    s.bLoop = false;
-                    s.bFinished = true;
-                }
-                else
-                {
-                    // Calculate sample position
-                    s.nSamplePosition += roundf((float)vecAudioSamples[s.nAudioSampleID - 1].wavHeader.nSamplesPerSec * fTimeStep);
+            case ATTACK:
+                fTarget = 1.0f;
+                fStep = fTimeStep / std::max(fAttack, fTimeStep);
+                break;
+            case DECAY:
+                fTarget = fSustain;
+                fStep = -(1.0f - fSustain) * fTimeStep / std::max(fDecay, fTimeStep);
+                break;
+            case RELEASE:
+                fTarget = 0.0f;
+                fStep = -fReleaseFrom * fTimeStep / std::max(fRelease, fTimeStep);
+                break;
+            default:
+                // Idle and sustain hold their level for the rest of the block
+                fLevel = fTarget = nStage == IDLE ? 0.0f : fSustain;
+                break;
+            }
 
-                    // If sample position is valid add to the mix
-                    if (s.nSamplePosition < vecAudioSamples[s.nAudioSampleID - 1].nSamples)
-                        fMixerSample += vecAudioSamples[s.nAudioSampleID - 1].fSample[(s.nSamplePosition * vecAudioSamples[s.nAudioSampleID - 1].nChannels) + nChannel];
-                    else
-                    {
-                        if (s.bLoop)
-                        {
-                            s.nSamplePosition = 0;
-                        }
-                        else
-                            s.bFinished = true; // Else sound has completed
-                    }
-                }
+            unsigned int nRun = nFrames - n;
+            if (fStep != 0.0f)
+                nRun = (unsigned int)std::min((float)nRun, std::max(0.0f, std::floor((fTarget - fLevel) / fStep)));
+            for (unsigned int k = 0; k < nRun; k++)
+                pBuffer[n + k] *= fLevel + fStep * (float)(k + 1);
+            fLevel += fStep * (float)nRun;
+            n += nRun;
+
+            // Frames are left over, so the target was reached
+            if (n < nFrames || fStep == 0.0f)
+            {
+                fLevel = fTarget;
+                if (nStage == ATTACK)
+                    nStage = DECAY;
+                else if (nStage == DECAY)
+                    nStage = SUSTAIN;
+                else if (nStage == RELEASE)
+                    nStage = IDLE;
             }
-            else
-                return 0.0f;
         }
+    }
 
-        // If sounds have completed then remove them
-        listActiveSamples.remove_if([](const sCurrentlyPlayingSample &s) { return s.bFinished; });
-
-        // The users application might be generating sound, so grab that if it exists
-        if (funcUserSynth != nullptr)
-            fMixerSample += funcUserSynth(nChannel, fGlobalTime, fTimeStep);
+    void SOUND::MixMono(float *pMix, unsigned int nFrames, unsigned int nChannels, const float *pSrc, float fGain)
+    {
+        const float fGains[2] = {fGain, fGain};
+        PanFrames(pMix, nChannels, pSrc, 1, nFrames, fGains, fGains);
+    }
 
-        // Return the sample via an optional user override to filter the sound
-        if (funcUserFilter != nullptr)
-            return funcUserFilter(nChannel, fGlobalTime, fMixerSample);
-        else
-            return fMixerSample;
+    void SOUND::ConvertBlock(const float *pMix, short *pBlock, unsigned int nCount)
+    {
+        unsigned int i = 0;
+#ifdef OLC_SOUND_SSE
+        // Eight at a time, the pack saturates but clipping first keeps the scale exact
+        const __m128 vMin = _mm_set1_ps(-1.0f), vMax = _mm_set1_ps(1.0f), vScale = _mm_set1_ps((float)SHRT_MAX);
+        for (; i + 8 <= nCount; i += 8)
+        {
+            __m128 a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(pMix + i), vMin), vMax), vScale);
+            __m128 b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(pMix + i + 4), vMin), vMax), vScale);
+            _mm_storeu_si128((__m128i *)(pBlock + i), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+        }
+#endif
+        for (; i < nCount; i++)
+            pBlock[i] = (short)(std::min(std::max(pMix[i], -1.0f), 1.0f) * (float)SHRT_MAX);
     }
 
     std::thread SOUND::m_AudioThread;
+    SOUND::sStatsCounters SOUND::m_Stats;
+    SOUND::sStream SOUND::m_Streams[SOUND::MAX_STREAMS];
+    std::thread SOUND::m_StreamThread;
+    std::atomic<bool> SOUND::m_bStreamThreadActive{false};
     std::atomic<bool> SOUND::m_bAudioThreadActive{false};
     std::atomic<float> SOUND::m_fGlobalTime{0.0f};
-    std::list<SOUND::sCurrentlyPlayingSample> SOUND::listActiveSamples;
+    SOUND::sCurrentlyPlayingSample SOUND::m_Voices[SOUND::MAX_VOICES];
     std::function<float(int, float, float)> SOUND::funcUserSynth = nullptr;
     std::function<float(int, float, float)> SOUND::funcUserFilter = nullptr;
+    std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> SOUND::funcUserSynthBlock = nullptr;
+    std::function<void(float *, unsigned int, unsigned int, uint64_t, double)> SOUND::funcUserFilterBlock = nullptr;
+    uint64_t SOUND::m_nGlobalFrame = 0;
+    std::vector<float> SOUND::m_vecMixBlock;
+    std::vector<float> SOUND::m_vecDecodeBlock;
+    std::vector<float> SOUND::m_vecVoiceBlock;
+    float SOUND::m_fListenerX = 0.0f;
+    float SOUND::m_fListenerY = 0.0f;
+    float SOUND::m_fMinDistance = 1.0f;
+    float SOUND::m_fMaxDistance = 100.0f;
+    SOUND::sCommand SOUND::m_Commands[SOUND::COMMAND_QUEUE_SIZE];
+    std::atomic<uint32_t> SOUND::m_nCommandHead{0};
+    std::atomic<uint32_t> SOUND::m_nCommandTail{0};
+    SOUND::sVoiceSlot SOUND::m_VoiceSlots[SOUND::MAX_VOICES];
+    std::atomic<uint32_t> SOUND::m_nVoiceFinished[SOUND::MAX_VOICES];
+    uint64_t SOUND::m_nVoicesStarted = 0;
+    unsigned int SOUND::m_nNextVoiceSlot = 0;
+    SOUND::STEAL_POLICY SOUND::m_nStealPolicy = SOUND::STEAL_OLDEST;
+    std::vector<const SOUND::AudioSample *> SOUND::m_vecSampleTable;
+    uint16_t SOUND::m_ActiveVoices[SOUND::MAX_VOICES];
+    unsigned int SOUND::m_nActiveVoices = 0;
 }
 
 // Implementation, Windows-specific
@@ -395,7 +2242,8 @@ namespace olc
         waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
         waveFormat.cbSize = 0;
 
-        listActiveSamples.clear();
+        ResetVoices();
+        ResetAudioStats();
 
         // Open Device if valid
         if (waveOutOpen(&m_hwDevice, WAVE_MAPPER, &waveFormat, (DWORD_PTR)SOUND::waveOutProc, (DWORD_PTR)0, CALLBACK_FUNCTION) != S_OK)
@@ -434,6 +2282,7 @@ namespace olc
         m_bAudioThreadActive = false;
         if (m_AudioThread.joinable())
             m_AudioThread.join();
+        StopStreams();
         return false;
     }
 
@@ -455,17 +2304,15 @@ namespace olc
     {
         m_fGlobalTime = 0.0f;
         static float fTimeStep = 1.0f / (float)m_nSampleRate;
-
-        // Goofy hack to get maximum integer for a type at run-time
-        short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
-        float fMaxSample = (float)nMaxSample;
-        short nPreviousSample = 0;
-
-        auto tp1 = std::chrono::system_clock::now();
-        auto tp2 = std::chrono::system_clock::now();
+        unsigned int nFrames = m_nBlockSamples / m_nChannels;
 
         while (m_bAudioThreadActive)
         {
+            // Every block back from the device means it has run dry
+            unsigned int nFree = m_nBlockFree;
+            if (nFree == m_nBlockCount && m_Stats.nBlocks.load(std::memory_order_relaxed) > 0)
+                m_Stats.nUnderruns.fetch_add(1, std::memory_order_relaxed);
+
             // Wait for block to become available
             if (m_nBlockFree == 0)
             {
@@ -481,37 +2328,13 @@ namespace olc
             if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
                 waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
 
-            short nNewSample = 0;
+            // User Process
             int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
+            MixBlock(m_pBlockMemory + nCurrentBlock, nFrames, m_nChannels, m_fGlobalTime, fTimeStep);
+            m_fGlobalTime = (float)((double)m_nGlobalFrame * (double)fTimeStep);
 
-            auto clip = [](float fSample, float fMax) {
-                if (fSample >= 0.0)
-                    return fmin(fSample, fMax);
-                else
-                    return fmax(fSample, -fMax);
-            };
-
-            tp2 = std::chrono::system_clock::now();
-            std::chrono::duration<float> elapsedTime = tp2 - tp1;
-            tp1 = tp2;
-
-            // Our time per frame coefficient
-            float fElapsedTime = elapsedTime.count();
-
-            for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-            {
-                // User Process
-                for (unsigned int c = 0; c < m_nChannels; c++)
-                {
-                    nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime + fTimeStep * (float)n, fTimeStep), 1.0) * fMaxSample);
-                    m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-                    nPreviousSample = nNewSample;
-                }
-            }
-
-            m_fGlobalTime = m_fGlobalTime + fTimeStep * (float)m_nBlockSamples;
-
-            // Send block to sound device
+            // Send block to sound device, behind those it still has queued
+            RecordHeadroom((uint64_t)(m_nBlockCount - 1 - m_nBlockFree) * nFrames);
             waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
             waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
             m_nBlockCurrent++;
@@ -568,7 +2391,8 @@ namespace olc
         if (rc < 0)
             return DestroyAudio();
 
-        listActiveSamples.clear();
+        ResetVoices();
+        ResetAudioStats();
 
         // Allocate Wave|Block Memory
         m_pBlockMemory = new short[m_nBlockSamples];
@@ -579,7 +2403,7 @@ namespace olc
         // Unsure if really needed, helped prevent underrun on my setup
         snd_pcm_start(m_pPCM);
         for (unsigned int i = 0; i < nBlocks; i++)
-            rc = snd_pcm_writei(m_pPCM, m_pBlockMemory, 512);
+            rc = snd_pcm_writei(m_pPCM, m_pBlockMemory, m_nBlockSamples / m_nChannels);
 
         snd_pcm_start(m_pPCM);
         m_bAudioThreadActive = true;
@@ -594,6 +2418,7 @@ namespace olc
         m_bAudioThreadActive = false;
         if (m_AudioThread.joinable())
             m_AudioThread.join();
+        StopStreams();
         snd_pcm_drain(m_pPCM);
         snd_pcm_close(m_pPCM);
         return false;
@@ -607,38 +2432,19 @@ namespace olc
     {
         m_fGlobalTime = 0.0f;
         static float fTimeStep = 1.0f / (float)m_nSampleRate;
-
-        // Goofy hack to get maximum integer for a type at run-time
-        short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
-        float fMaxSample = (float)nMaxSample;
-        short nPreviousSample = 0;
+        unsigned int nFrames = m_nBlockSamples / m_nChannels;
 
         while (m_bAudioThreadActive)
         {
-            short nNewSample = 0;
-
-            auto clip = [](float fSample, float fMax) {
-                if (fSample >= 0.0)
-                    return fmin(fSample, fMax);
-                else
-                    return fmax(fSample, -fMax);
-            };
-
-            for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-            {
-                // User Process
-                for (unsigned int c = 0; c < m_nChannels; c++)
-                {
-                    nNewSample = (short)(GetMixerOutput(c, m_fGlobalTime + fTimeStep * (float)n, fTimeStep), 1.0) * fMaxSample;
-                    m_pBlockMemory[n + c] = nNewSample;
-                    nPreviousSample = nNewSample;
-                }
-            }
-
-            m_fGlobalTime = m_fGlobalTime + fTimeStep * (float)m_nBlockSamples;
-
-            // Send block to sound device
-            snd_pcm_uframes_t nLeft = m_nBlockSamples;
+            // User Process
+            MixBlock(m_pBlockMemory, nFrames, m_nChannels, m_fGlobalTime, fTimeStep);
+            m_fGlobalTime = (float)((double)m_nGlobalFrame * (double)fTimeStep);
+
+            // Send block to sound device, behind those it still has queued
+            snd_pcm_sframes_t nDelay = 0;
+            if (snd_pcm_delay(m_pPCM, &nDelay) == 0)
+                RecordHeadroom((uint64_t)std::max<snd_pcm_sframes_t>(nDelay, 0));
+            snd_pcm_uframes_t nLeft = nFrames;
             short *pBlockPos = m_pBlockMemory;
             while (nLeft > 0)
             {
@@ -651,7 +2457,10 @@ namespace olc
                 if (rc == -EAGAIN)
                     continue;
                 if (rc == -EPIPE) // an underrun occured, prepare the device for more data
+                {
+                    m_Stats.nUnderruns.fetch_add(1, std::memory_order_relaxed);
                     snd_pcm_prepare(m_pPCM);
+                }
             }
         }
     }
@@ -696,7 +2505,8 @@ namespace olc
         for (unsigned int i = 0; i < m_nBlockCount; i++)
             m_qAvailableBuffers.push(m_pBuffers[i]);
 
-        listActiveSamples.clear();
+        ResetVoices();
+        ResetAudioStats();
 
         // Allocate Wave|Block Memory
         m_pBlockMemory = new short[m_nBlockSamples];
@@ -715,6 +2525,7 @@ namespace olc
         m_bAudioThreadActive = false;
         if (m_AudioThread.joinable())
             m_AudioThread.join();
+        StopStreams();
 
         alDeleteBuffers(m_nBlockCount, m_pBuffers);
         delete[] m_pBuffers;
@@ -734,11 +2545,7 @@ namespace olc
     {
         m_fGlobalTime = 0.0f;
         static float fTimeStep = 1.0f / (float)m_nSampleRate;
-
-        // Goofy hack to get maximum integer for a type at run-time
-        short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
-        float fMaxSample = (float)nMaxSample;
-        short nPreviousSample = 0;
+        unsigned int nFrames = m_nBlockSamples / m_nChannels;
 
         std::vector<ALuint> vProcessed;
 
@@ -758,27 +2565,14 @@ namespace olc
             if (m_qAvailableBuffers.empty())
                 continue;
 
-            short nNewSample = 0;
-
-            auto clip = [](float fSample, float fMax) {
-                if (fSample >= 0.0)
-                    return fmin(fSample, fMax);
-                else
-                    return fmax(fSample, -fMax);
-            };
-
-            for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-            {
-                // User Process
-                for (unsigned int c = 0; c < m_nChannels; c++)
-                {
-                    nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime, fTimeStep), 1.0) * fMaxSample);
-                    m_pBlockMemory[n + c] = nNewSample;
-                    nPreviousSample = nNewSample;
-                }
+            // User Process
+            MixBlock(m_pBlockMemory, nFrames, m_nChannels, m_fGlobalTime, fTimeStep);
+            m_fGlobalTime = (float)((double)m_nGlobalFrame * (double)fTimeStep);
 
-                m_fGlobalTime = m_fGlobalTime + fTimeStep;
-            }
+            // A source that stopped on its own has played everything it was given
+            if (nState == AL_STOPPED)
+                m_Stats.nUnderruns.fetch_add(1, std::memory_order_relaxed);
+            RecordHeadroom((uint64_t)(m_nBlockCount - m_qAvailableBuffers.size()) * nFrames);
 
             // Fill OpenAL data buffer
             alBufferData(
@@ -810,6 +2604,182 @@ namespace olc
     short *SOUND::m_pBlockMemory = nullptr;
 }
 
+#elif defined(USE_NULL)
+
+namespace olc
+{
+    void SOUND::SetNullOutput(std::string sWavFile, bool bCapture, bool bVirtualClock)
+    {
+        m_sNullFile = sWavFile;
+        m_bNullCapture = bCapture;
+        m_bNullVirtualClock = bVirtualClock;
+    }
+
+    bool SOUND::InitialiseAudio(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples)
+    {
+        // Initialise Sound Engine
+        m_bAudioThreadActive = false;
+        m_nSampleRate = nSampleRate;
+        m_nChannels = nChannels;
+        m_nBlockSamples = nBlockSamples;
+        m_pBlockMemory = nullptr;
+        m_vecNullOutput.clear();
+        // There is no device queue to size, each block is handed on as soon as it is mixed
+        (void)nBlocks;
+        m_nNullFramesAllowed = 0;
+        m_nNullFramesMixed = 0;
+
+        // The data size is filled in when the file is closed
+        if (!m_sNullFile.empty())
+        {
+            m_NullFile.open(m_sNullFile, std::ofstream::binary);
+            if (!m_NullFile.is_open())
+                return DestroyAudio();
+            WriteNullHeader();
+        }
+
+        ResetVoices();
+        ResetAudioStats();
+
+        // Allocate Wave|Block Memory
+        m_pBlockMemory = new short[m_nBlockSamples];
+        std::fill(m_pBlockMemory, m_pBlockMemory + m_nBlockSamples, 0);
+
+        m_bAudioThreadActive = true;
+        m_AudioThread = std::thread(&SOUND::AudioThread);
+        return true;
+    }
+
+    // Stop and clean up audio system
+    bool SOUND::DestroyAudio()
+    {
+        {
+            std::unique_lock<std::mutex> lm(m_muxNullClock);
+            m_bAudioThreadActive = false;
+            m_cvNullClock.notify_all();
+        }
+        if (m_AudioThread.joinable())
+            m_AudioThread.join();
+        StopStreams();
+
+        if (m_NullFile.is_open())
+        {
+            WriteNullHeader();
+            m_NullFile.close();
+        }
+        delete[] m_pBlockMemory;
+        m_pBlockMemory = nullptr;
+        return false;
+    }
+
+    void SOUND::WriteNullHeader()
+    {
+        uint32_t nDataSize = (uint32_t)(m_nNullFramesMixed * m_nChannels * sizeof(short));
+        uint32_t nRiffSize = 36 + nDataSize;
+        uint32_t nFormatSize = 16;
+        OLC_WAVEFORMATEX wavHeader;
+        wavHeader.wFormatTag = 1;
+        wavHeader.nChannels = (uint16_t)m_nChannels;
+        wavHeader.nSamplesPerSec = m_nSampleRate;
+        wavHeader.wBitsPerSample = sizeof(short) * 8;
+        wavHeader.nBlockAlign = (uint16_t)(sizeof(short) * m_nChannels);
+        wavHeader.nAvgBytesPerSec = m_nSampleRate * wavHeader.nBlockAlign;
+
+        m_NullFile.seekp(0);
+        m_NullFile.write("RIFF", 4);
+        m_NullFile.write((const char *)&nRiffSize, sizeof(uint32_t));
+        m_NullFile.write("WAVEfmt ", 8);
+        m_NullFile.write((const char *)&nFormatSize, sizeof(uint32_t));
+        m_NullFile.write((const char *)&wavHeader, nFormatSize);
+        m_NullFile.write("data", 4);
+        m_NullFile.write((const char *)&nDataSize, sizeof(uint32_t));
+        m_NullFile.seekp(0, std::ofstream::end);
+    }
+
+    void SOUND::AdvanceNullClock(unsigned int nFrames)
+    {
+        // Nothing to advance before InitialiseAudio, or after DestroyAudio
+        if (!m_bAudioThreadActive || m_nChannels == 0)
+            return;
+        unsigned int nBlockFrames = m_nBlockSamples / m_nChannels;
+        std::unique_lock<std::mutex> lm(m_muxNullClock);
+        m_nNullFramesAllowed += nFrames;
+        m_cvNullClock.notify_all();
+        m_cvNullClock.wait(lm, [&] { return !m_bAudioThreadActive || m_nNullFramesMixed + nBlockFrames > m_nNullFramesAllowed; });
+    }
+
+    bool SOUND::ProcessCommandsWhilePaused()
+    {
+        // Holding the lock with the clock used up, the audio thread cant start a block
+        std::unique_lock<std::mutex> lm(m_muxNullClock);
+        unsigned int nBlockFrames = m_nBlockSamples / m_nChannels;
+        if (!m_bAudioThreadActive || m_nNullFramesMixed + nBlockFrames <= m_nNullFramesAllowed)
+            return false;
+        ProcessCommands();
+        return true;
+    }
+
+    std::vector<short> SOUND::GetNullOutput()
+    {
+        std::unique_lock<std::mutex> lm(m_muxNullClock);
+        return m_vecNullOutput;
+    }
+
+    uint64_t SOUND::GetNullFramesMixed()
+    {
+        std::unique_lock<std::mutex> lm(m_muxNullClock);
+        return m_nNullFramesMixed;
+    }
+
+    // Audio thread. There is no device to wait on, so it mixes whenever the virtual
+    // clock lets it, or all the time
+    void SOUND::AudioThread()
+    {
+        m_fGlobalTime = 0.0f;
+        static float fTimeStep = 1.0f / (float)m_nSampleRate;
+        unsigned int nFrames = m_nBlockSamples / m_nChannels;
+
+        while (m_bAudioThreadActive)
+        {
+            if (m_bNullVirtualClock)
+            {
+                std::unique_lock<std::mutex> lm(m_muxNullClock);
+                m_cvNullClock.wait(lm, [&] { return !m_bAudioThreadActive || m_nNullFramesMixed + nFrames <= m_nNullFramesAllowed; });
+                if (!m_bAudioThreadActive)
+                    break;
+            }
+
+            // User Process
+            MixBlock(m_pBlockMemory, nFrames, m_nChannels, m_fGlobalTime, fTimeStep);
+            m_fGlobalTime = (float)((double)m_nGlobalFrame * (double)fTimeStep);
+
+            // Send block to the file and memory instead of a device
+            if (m_NullFile.is_open())
+                m_NullFile.write((const char *)m_pBlockMemory, m_nBlockSamples * sizeof(short));
+
+            std::unique_lock<std::mutex> lm(m_muxNullClock);
+            if (m_bNullCapture)
+                m_vecNullOutput.insert(m_vecNullOutput.end(), m_pBlockMemory, m_pBlockMemory + m_nBlockSamples);
+            m_nNullFramesMixed += nFrames;
+            m_cvNullClock.notify_all();
+        }
+    }
+
+    unsigned int SOUND::m_nSampleRate = 0;
+    unsigned int SOUND::m_nChannels = 0;
+    unsigned int SOUND::m_nBlockSamples = 0;
+    short *SOUND::m_pBlockMemory = nullptr;
+    std::string SOUND::m_sNullFile;
+    std::ofstream SOUND::m_NullFile;
+    bool SOUND::m_bNullCapture = true;
+    bool SOUND::m_bNullVirtualClock = true;
+    std::vector<short> SOUND::m_vecNullOutput;
+    uint64_t SOUND::m_nNullFramesAllowed = 0;
+    uint64_t SOUND::m_nNullFramesMixed = 0;
+    std::condition_variable SOUND::m_cvNullClock;
+    std::mutex SOUND::m_muxNullClock;
+}
+
 #else // Some other platform
 
 namespace olc
@@ -822,6 +2792,7 @@ namespace olc
     // Stop and clean up audio system
     bool SOUND::DestroyAudio()
     {
+        StopStreams();
         return false;
     }
 
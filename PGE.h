@@ -377,6 +377,11 @@ namespace olc
 			HORIZ = 1,
 			VERT = 2
 		};
+		enum Layout
+		{
+			LINEAR, // Rows, one after another
+			TILED   // 4x4 blocks of pixels, each one cache line, stored in rows of blocks
+		};
 
 	public:
 		void SetSampleMode(olc::Sprite::Mode mode = olc::Sprite::Mode::NORMAL);
@@ -389,6 +394,27 @@ namespace olc
 		Pixel *GetData();
 		Pixel *pColData = nullptr;
 		Mode modeSample = Mode::NORMAL;
+
+	public:
+		// Rearranges the pixels in memory. Textures sampled at any angle, as in GFX3D,
+		// touch fewer cache lines when TILED. GetPixel, SetPixel and sampling work the
+		// same either way, but GetData no longer returns rows, so a TILED sprite is not
+		// suitable as a draw target.
+		void SetLayout(olc::Sprite::Layout layout);
+		olc::Sprite::Layout GetLayout();
+
+	public:
+		// Builds a chain of box filtered copies, each half the size of the one before,
+		// down to 1x1. Level 0 is the sprite itself. Call again if the sprite changes.
+		void GenerateMipMaps();
+		uint32_t GetMipLevelCount();
+		olc::Sprite *GetMipLevel(uint32_t nLevel);
+
+	private:
+		inline int32_t GetIndex(int32_t x, int32_t y);
+		inline static int32_t GetTiledIndex(int32_t x, int32_t y, int32_t w);
+		std::vector<olc::Sprite *> vecMipLevels;
+		Layout layoutData = Layout::LINEAR;
 	};
 
 	// O------------------------------------------------------------------------------O
@@ -816,12 +842,15 @@ namespace olc
 	{
 		if (pColData)
 			delete[] pColData;
+		for (auto &m : vecMipLevels)
+			delete m;
 	}
 
 	olc::rcode Sprite::LoadFromPGESprFile(const std::string &sImageFile, olc::ResourcePack *pack)
 	{
 		if (pColData)
 			delete[] pColData;
+		layoutData = Layout::LINEAR;
 		auto ReadData = [&](std::istream &is) {
 			is.read((char *)&width, sizeof(int32_t));
 			is.read((char *)&height, sizeof(int32_t));
@@ -864,7 +893,12 @@ namespace olc
 		{
 			ofs.write((char *)&width, sizeof(int32_t));
 			ofs.write((char *)&height, sizeof(int32_t));
-			ofs.write((char *)pColData, (size_t)width * (size_t)height * sizeof(uint32_t));
+			if (layoutData == Layout::LINEAR)
+				ofs.write((char *)pColData, (size_t)width * (size_t)height * sizeof(uint32_t));
+			else
+				for (int32_t y = 0; y < height; y++)
+					for (int32_t x = 0; x < width; x++)
+						ofs.write((char *)&pColData[GetIndex(x, y)], sizeof(uint32_t));
 			ofs.close();
 			return olc::OK;
 		}
@@ -892,13 +926,13 @@ namespace olc
 		if (modeSample == olc::Sprite::Mode::NORMAL)
 		{
 			if (x >= 0 && x < width && y >= 0 && y < height)
-				return pColData[y * width + x];
+				return pColData[GetIndex(x, y)];
 			else
 				return Pixel(0, 0, 0, 0);
 		}
 		else
 		{
-			return pColData[abs(y % height) * width + abs(x % width)];
+			return pColData[GetIndex(abs(x % width), abs(y % height))];
 		}
 	}
 
@@ -906,7 +940,7 @@ namespace olc
 	{
 		if (x >= 0 && x < width && y >= 0 && y < height)
 		{
-			pColData[y * width + x] = p;
+			pColData[GetIndex(x, y)] = p;
 			return true;
 		}
 		else
@@ -947,6 +981,97 @@ namespace olc
 		return pColData;
 	}
 
+	int32_t Sprite::GetIndex(int32_t x, int32_t y)
+	{
+		if (layoutData == Layout::LINEAR)
+			return y * width + x;
+		return GetTiledIndex(x, y, width);
+	}
+
+	int32_t Sprite::GetTiledIndex(int32_t x, int32_t y, int32_t w)
+	{
+		return ((((y >> 2) * ((w + 3) >> 2) + (x >> 2)) << 4) | ((y & 3) << 2) | (x & 3));
+	}
+
+	void Sprite::SetLayout(olc::Sprite::Layout layout)
+	{
+		if (layout == layoutData || pColData == nullptr)
+		{
+			layoutData = layout;
+			return;
+		}
+
+		// Tiles cover whole blocks, so the tiled buffer is padded out to a multiple of 4
+		int32_t nPixels = (layout == Layout::LINEAR) ? width * height : ((width + 3) & ~3) * ((height + 3) & ~3);
+		Pixel *pNewData = new Pixel[nPixels];
+		for (int32_t y = 0; y < height; y++)
+			for (int32_t x = 0; x < width; x++)
+			{
+				if (layout == Layout::TILED)
+					pNewData[GetTiledIndex(x, y, width)] = pColData[y * width + x];
+				else
+					pNewData[y * width + x] = pColData[GetTiledIndex(x, y, width)];
+			}
+		delete[] pColData;
+		pColData = pNewData;
+		layoutData = layout;
+
+		for (auto &m : vecMipLevels)
+			m->SetLayout(layout);
+	}
+
+	olc::Sprite::Layout Sprite::GetLayout()
+	{
+		return layoutData;
+	}
+
+	void Sprite::GenerateMipMaps()
+	{
+		for (auto &m : vecMipLevels)
+			delete m;
+		vecMipLevels.clear();
+
+		olc::Sprite *src = this;
+		while (src->width > 1 || src->height > 1)
+		{
+			olc::Sprite *dst = new olc::Sprite(std::max(src->width / 2, 1), std::max(src->height / 2, 1));
+			dst->modeSample = modeSample;
+
+			// Average each 2x2 block, odd edges reuse the last row or column
+			for (int32_t y = 0; y < dst->height; y++)
+			{
+				int32_t y0 = std::min(y * 2, src->height - 1), y1 = std::min(y * 2 + 1, src->height - 1);
+				for (int32_t x = 0; x < dst->width; x++)
+				{
+					int32_t x0 = std::min(x * 2, src->width - 1), x1 = std::min(x * 2 + 1, src->width - 1);
+					const Pixel &a = src->pColData[src->GetIndex(x0, y0)], &b = src->pColData[src->GetIndex(x1, y0)];
+					const Pixel &c = src->pColData[src->GetIndex(x0, y1)], &d = src->pColData[src->GetIndex(x1, y1)];
+					dst->pColData[y * dst->width + x] = Pixel(
+						uint8_t((a.r + b.r + c.r + d.r + 2) >> 2),
+						uint8_t((a.g + b.g + c.g + d.g + 2) >> 2),
+						uint8_t((a.b + b.b + c.b + d.b + 2) >> 2),
+						uint8_t((a.a + b.a + c.a + d.a + 2) >> 2));
+				}
+			}
+
+			dst->SetLayout(layoutData);
+			vecMipLevels.push_back(dst);
+			src = dst;
+		}
+	}
+
+	uint32_t Sprite::GetMipLevelCount()
+	{
+		return uint32_t(vecMipLevels.size()) + 1;
+	}
+
+	olc::Sprite *Sprite::GetMipLevel(uint32_t nLevel)
+	{
+		if (nLevel == 0 || vecMipLevels.empty())
+			return this;
+		return vecMipLevels[std::min(nLevel, uint32_t(vecMipLevels.size())) - 1];
+	}
+
 	// O------------------------------------------------------------------------------O
 	// | olc::Decal IMPLEMENTATION                                                   |
 	// O------------------------------------------------------------------------------O
@@ -1702,7 +1827,9 @@ namespace olc
 
 	void PixelGameEngine::Clear(Pixel p)
 	{
-		int pixels = GetDrawTargetWidth() * GetDrawTargetHeight();
+		// A tiled target is padded out to whole tiles, so clear the padding too
+		int w = GetDrawTargetWidth(), h = GetDrawTargetHeight();
+		int pixels = (GetDrawTarget()->GetLayout() == Sprite::Layout::TILED) ? ((w + 3) & ~3) * ((h + 3) & ~3) : w * h;
 		Pixel *m = GetDrawTarget()->GetData();
 		for (int i = 0; i < pixels; i++)
 			m[i] = p;
@@ -2893,7 +3020,27 @@ namespace olc
 
 		void UpdateTexture(uint32_t id, olc::Sprite *spr) override
 		{
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, spr->width, spr->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, spr->GetData());
+			// OpenGL wants rows, so tiled sprites are uploaded via a linear copy
+			std::vector<olc::Pixel> vLinear;
+			auto Upload = [&](GLint level, olc::Sprite *s) {
+				const olc::Pixel *pData = s->GetData();
+				if (s->GetLayout() != olc::Sprite::Layout::LINEAR)
+				{
+					vLinear.resize(size_t(s->width) * size_t(s->height));
+					for (int32_t y = 0; y < s->height; y++)
+						for (int32_t x = 0; x < s->width; x++)
+							vLinear[y * s->width + x] = s->GetPixel(x, y);
+					pData = vLinear.data();
+				}
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, s->width, s->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pData);
+			};
+
+			Upload(0, spr);
+
+			// Upload any mip chain too, and let minified decals blend between its levels
+			for (uint32_t i = 1; i < spr->GetMipLevelCount(); i++)
+				Upload(i, spr->GetMipLevel(i));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, spr->GetMipLevelCount() > 1 ? GL_NEAREST_MIPMAP_LINEAR : GL_NEAREST);
 		}
 
 		uint32_t DeleteTexture(const uint32_t id) override
@@ -3246,6 +3393,7 @@ namespace olc
 			return olc::NO_FILE;
 		width = bmp->GetWidth();
 		height = bmp->GetHeight();
+		layoutData = Layout::LINEAR;
 		pColData = new Pixel[width * height];
 
 		for (int y = 0; y < height; y++)
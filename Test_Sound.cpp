@@ -0,0 +1,198 @@
+/*
+	Checks for olcPGEX_Sound.h, run against the null backend so they need no
+	sound device. Returns 0 if every check passes.
+*/
+
+#define OLC_PGE_APPLICATION
+#include "PGE.h"
+
+#define USE_NULL
+#define OLC_PGEX_SOUND
+#include "Extension_Sound.h"
+
+#include <cstdio>
+#include <fstream>
+
+// Writes a mono 16 bit WAVE file holding nFrames of a constant level
+static bool WriteConstantWave(const std::string &sFile, uint32_t nSampleRate, uint32_t nFrames, int16_t nLevel)
+{
+    std::ofstream file(sFile, std::ofstream::binary);
+    if (!file.is_open())
+        return false;
+
+    uint32_t nDataSize = nFrames * sizeof(int16_t);
+    uint32_t nRiffSize = 36 + nDataSize;
+    uint32_t nFormatSize = 16;
+    OLC_WAVEFORMATEX wavHeader;
+    wavHeader.wFormatTag = 1;
+    wavHeader.nChannels = 1;
+    wavHeader.nSamplesPerSec = nSampleRate;
+    wavHeader.wBitsPerSample = 16;
+    wavHeader.nBlockAlign = sizeof(int16_t);
+    wavHeader.nAvgBytesPerSec = nSampleRate * wavHeader.nBlockAlign;
+    wavHeader.cbSize = 0;
+
+    file.write("RIFF", 4);
+    file.write((const char *)&nRiffSize, sizeof(uint32_t));
+    file.write("WAVEfmt ", 8);
+    file.write((const char *)&nFormatSize, sizeof(uint32_t));
+    file.write((const char *)&wavHeader, nFormatSize);
+    file.write("data", 4);
+    file.write((const char *)&nDataSize, sizeof(uint32_t));
+    std::vector<int16_t> vData(nFrames, nLevel);
+    file.write((const char *)vData.data(), nDataSize);
+    return file.good();
+}
+
+// A looping voice stopped mid-play should ramp down over a block, not cut off,
+// whether it is copied straight in or resampled
+static bool TestStopRamp(uint32_t nSampleRate, float fRate)
+{
+    const std::string sFile = "./test_sound_stop.wav";
+    if (!WriteConstantWave(sFile, nSampleRate, nSampleRate, 16384))
+        return false;
+
+    olc::SOUND::SetNullOutput("", true, true);
+    olc::SOUND::InitialiseAudio(44100, 1, 8, 512);
+    int id = olc::SOUND::LoadAudioSample(sFile);
+    uint32_t nVoice = olc::SOUND::PlaySample(id, true, 1.0f, fRate);
+    olc::SOUND::AdvanceNullClock(2048);
+    olc::SOUND::StopVoice(nVoice);
+    olc::SOUND::AdvanceNullClock(2048);
+    std::vector<short> vOutput = olc::SOUND::GetNullOutput();
+    olc::SOUND::DestroyAudio();
+    std::remove(sFile.c_str());
+
+    // Once the voice is playing, no frame may jump far from the one before
+    size_t nStart = 0;
+    while (nStart < vOutput.size() && vOutput[nStart] == 0)
+        nStart++;
+    int nMaxJump = 0;
+    for (size_t i = nStart + 1; i < vOutput.size(); i++)
+        nMaxJump = std::max(nMaxJump, std::abs(vOutput[i] - vOutput[i - 1]));
+
+    bool bPass = nStart < vOutput.size() && nMaxJump < 256 && vOutput.back() == 0;
+    printf("%s stop ramp, %uHz sample at rate %.2f: largest step %d\n", bPass ? "PASS" : "FAIL", nSampleRate, fRate, nMaxJump);
+    return bPass;
+}
+
+// The level a constant 16384 sample should come out at, played with fGain
+static bool NearGain(short nOutput, float fGain)
+{
+    float fExpected = 16384.0f * fGain;
+    return std::abs((float)nOutput - fExpected) <= 2.0f + 0.01f * fExpected;
+}
+
+// Plays a constant sample looping in stereo, with blocks of 441 frames so a
+// hundredth of a second always ends on a block boundary
+static uint32_t StartConstantVoice(const std::string &sFile)
+{
+    WriteConstantWave(sFile, 44100, 44100, 16384);
+    olc::SOUND::SetNullOutput("", true, true);
+    olc::SOUND::InitialiseAudio(44100, 2, 8, 882);
+    int id = olc::SOUND::LoadAudioSample(sFile);
+    return olc::SOUND::PlaySample(id, true);
+}
+
+// Panned voices keep the near side at full volume and take the far side down
+// along a quarter cosine
+static bool TestPan()
+{
+    const std::string sFile = "./test_sound_pan.wav";
+    uint32_t nVoice = StartConstantVoice(sFile);
+    const float fPans[] = {0.0f, 0.5f, -0.5f, 1.0f, -1.0f};
+    const float fHalfPi = 1.57079632679f;
+    bool bPass = true;
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        // Give the gains a block to ramp to the new pan, then look at the last frame
+        olc::SOUND::SetVoicePan(nVoice, fPans[i]);
+        olc::SOUND::AdvanceNullClock(882);
+        std::vector<short> vOutput = olc::SOUND::GetNullOutput();
+        short nLeft = vOutput[vOutput.size() - 2], nRight = vOutput.back();
+        float fLeft = fPans[i] > 0.0f ? std::cos(fPans[i] * fHalfPi) : 1.0f;
+        float fRight = fPans[i] < 0.0f ? std::cos(-fPans[i] * fHalfPi) : 1.0f;
+        bool bOk = NearGain(nLeft, fLeft) && NearGain(nRight, fRight);
+        printf("%s pan %.2f: left %d right %d\n", bOk ? "PASS" : "FAIL", fPans[i], nLeft, nRight);
+        bPass &= bOk;
+    }
+    olc::SOUND::DestroyAudio();
+    std::remove(sFile.c_str());
+    return bPass;
+}
+
+// A one second fade from full volume should be at the start, middle and end of
+// its curve after none, half and all of its frames
+static bool TestFade(bool bExponential, float fTarget, float fMiddle)
+{
+    const std::string sFile = "./test_sound_fade.wav";
+    uint32_t nVoice = StartConstantVoice(sFile);
+    olc::SOUND::AdvanceNullClock(4410);
+    olc::SOUND::FadeVoice(nVoice, fTarget, 1.0f, bExponential);
+    olc::SOUND::AdvanceNullClock(44100 + 441);
+    std::vector<short> vOutput = olc::SOUND::GetNullOutput();
+    olc::SOUND::DestroyAudio();
+    std::remove(sFile.c_str());
+
+    // The fade starts with the block after the one it was asked for in
+    const size_t nFadeStart = 4410;
+    const size_t nFrames[3] = {nFadeStart, nFadeStart + 22050, nFadeStart + 44100};
+    const float fGains[3] = {1.0f, fMiddle, fTarget};
+    if (vOutput.size() < (nFrames[2] + 1) * 2)
+    {
+        printf("FAIL %s fade to %.2f: only %zu frames mixed\n", bExponential ? "exponential" : "linear", fTarget, vOutput.size() / 2);
+        return false;
+    }
+    bool bPass = true;
+    for (unsigned int i = 0; i < 3; i++)
+        bPass &= NearGain(vOutput[nFrames[i] * 2], fGains[i]) && NearGain(vOutput[nFrames[i] * 2 + 1], fGains[i]);
+    printf("%s %s fade to %.2f: start %d middle %d end %d\n", bPass ? "PASS" : "FAIL", bExponential ? "exponential" : "linear", fTarget,
+           vOutput[nFrames[0] * 2], vOutput[nFrames[1] * 2], vOutput[nFrames[2] * 2]);
+    return bPass;
+}
+
+// Positional voices are at full volume within the minimum distance, fall off
+// linearly to silence at the maximum, and pan towards the side they are on
+static bool TestDistance()
+{
+    const std::string sFile = "./test_sound_distance.wav";
+    uint32_t nVoice = StartConstantVoice(sFile);
+    olc::SOUND::SetDistanceModel(10.0f, 110.0f);
+    olc::SOUND::SetListenerPosition(100.0f, 100.0f);
+    struct sPlace { float fX, fY, fLeft, fRight; };
+    const sPlace places[] = {
+        {100.0f, 105.0f, 1.0f, 1.0f},
+        {100.0f, 160.0f, 0.5f, 0.5f},
+        {100.0f, 15.0f, 0.25f, 0.25f},
+        {100.0f, 300.0f, 0.0f, 0.0f},
+        {160.0f, 100.0f, 0.0f, 0.5f},
+    };
+    bool bPass = true;
+    for (const sPlace &p : places)
+    {
+        olc::SOUND::SetVoicePosition(nVoice, p.fX, p.fY);
+        olc::SOUND::AdvanceNullClock(882);
+        std::vector<short> vOutput = olc::SOUND::GetNullOutput();
+        short nLeft = vOutput[vOutput.size() - 2], nRight = vOutput.back();
+        bool bOk = NearGain(nLeft, p.fLeft) && NearGain(nRight, p.fRight);
+        printf("%s distance to (%.0f, %.0f): left %d right %d\n", bOk ? "PASS" : "FAIL", p.fX, p.fY, nLeft, nRight);
+        bPass &= bOk;
+    }
+    olc::SOUND::DestroyAudio();
+    std::remove(sFile.c_str());
+    return bPass;
+}
+
+int main()
+{
+    bool bPass = true;
+    bPass &= TestStopRamp(44100, 1.0f);
+    bPass &= TestStopRamp(22050, 1.0f);
+    bPass &= TestStopRamp(44100, 1.5f);
+    bPass &= TestPan();
+    bPass &= TestFade(false, 0.0f, 0.5f);
+    bPass &= TestFade(false, 0.25f, 0.625f);
+    bPass &= TestFade(true, 0.01f, 0.1f);
+    bPass &= TestDistance();
+    return bPass ? 0 : 1;
+}